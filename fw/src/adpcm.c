@@ -0,0 +1,74 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include "adpcm.h"
+
+static const int8_t index_table[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int16_t step_table[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static uint8_t encode_sample(int *predictor, int *index, int sample) {
+	int step = step_table[*index];
+	int diff = sample - *predictor;
+	uint8_t code = 0;
+	if (diff < 0) {
+		code = 8;
+		diff = -diff;
+	}
+
+	// same rounding as the decoder, which adds up step / 8 + the bits' steps
+	int delta = step >> 3;
+	if (diff >= step) {
+		code |= 4;
+		diff -= step;
+		delta += step;
+	}
+	step >>= 1;
+	if (diff >= step) {
+		code |= 2;
+		diff -= step;
+		delta += step;
+	}
+	step >>= 1;
+	if (diff >= step) {
+		code |= 1;
+		delta += step;
+	}
+
+	int p = *predictor + (code & 8 ? -delta : delta);
+	if (p > INT16_MAX) p = INT16_MAX;
+	if (p < INT16_MIN) p = INT16_MIN;
+	*predictor = p;
+
+	int i = *index + index_table[code];
+	if (i < 0) i = 0;
+	if (i > 88) i = 88;
+	*index = i;
+
+	return code;
+}
+
+void adpcm_encode(struct adpcm_state *state, const int16_t *in, uint32_t n, uint8_t *out) {
+	int predictor = state->predictor;
+	int index = state->index;
+	for (uint32_t i = 0; i < n; i += 2) {
+		uint8_t lo = encode_sample(&predictor, &index, in[i]);
+		uint8_t hi = encode_sample(&predictor, &index, in[i + 1]);
+		out[i / 2] = lo | hi << 4;
+	}
+	state->predictor = predictor;
+	state->index = index;
+}
@@ -0,0 +1,19 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+// IMA-ADPCM, 16-bit samples down to 4 bits each (decoded in adpcm.py)
+// This doesn't depend on Zephyr so that it can be built on the host
+
+struct adpcm_state {
+	// last sample as the decoder will see it
+	int16_t predictor;
+	// into the step size table, 0-88
+	uint8_t index;
+};
+
+// Encodes n (even) samples into n / 2 bytes, first sample in the low nibble
+void adpcm_encode(struct adpcm_state *state, const int16_t *in, uint32_t n, uint8_t *out);
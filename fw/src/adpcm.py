@@ -0,0 +1,125 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Captures the badge's ADPCM sound stream (see sound.h) into a WAV file, or decodes
+# one saved earlier (raw frames, e.g. from badge_rpc.py stream adpcm)
+# python3 adpcm.py <port> <seconds> <out.wav>
+# python3 adpcm.py -f <frames file> <out.wav>
+
+import struct
+import sys
+import time
+import wave
+
+SAMPLE_RATE = 16000
+SAMPLES_PER_BLOCK = 1024
+HEADER_SIZE = 8
+FRAME_SIZE = HEADER_SIZE + SAMPLES_PER_BLOCK // 2
+MAGIC = b'AD'
+
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8] * 2
+
+STEP_TABLE = [
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+
+def decode_block(predictor, index, data):
+	out = []
+	for byte in data:
+		for code in (byte & 0xf, byte >> 4):
+			step = STEP_TABLE[index]
+			delta = step >> 3
+			if code & 4:
+				delta += step
+			if code & 2:
+				delta += step >> 1
+			if code & 1:
+				delta += step >> 2
+			predictor += -delta if code & 8 else delta
+			predictor = max(-32768, min(32767, predictor))
+			index = max(0, min(88, index + INDEX_TABLE[code]))
+			out.append(predictor)
+	return out
+
+def parse_header(frame):
+	# returns (sequence number, predictor, index), or None if it isn't one
+	if len(frame) < HEADER_SIZE or frame[:2] != MAGIC:
+		return None
+	seq, predictor, index, zero = struct.unpack_from('<HhBB', frame, 2)
+	if index > 88 or zero:
+		return None
+	return seq, predictor, index
+
+class Decoder:
+	# takes the stream in any pieces, finds the frames in it and decodes them,
+	# with silence in place of lost blocks
+	def __init__(self):
+		self.buf = bytearray()
+		self.next_seq = None
+		self.blocks = 0
+		self.lost = 0
+		self.skipped_bytes = 0
+
+	def feed(self, data):
+		self.buf += data
+		samples = []
+		while len(self.buf) >= FRAME_SIZE:
+			header = parse_header(self.buf)
+			if not header:
+				# (console output, or a frame cut short)
+				start = self.buf.find(MAGIC, 1)
+				skip = start if start > 0 else len(self.buf) - 1
+				self.skipped_bytes += skip
+				del self.buf[:skip]
+				continue
+			seq, predictor, index = header
+			if self.next_seq is not None and seq != self.next_seq:
+				missing = (seq - self.next_seq) & 0xffff
+				self.lost += missing
+				samples += [0] * (missing * SAMPLES_PER_BLOCK)
+			self.next_seq = (seq + 1) & 0xffff
+			samples += decode_block(predictor, index, self.buf[HEADER_SIZE:FRAME_SIZE])
+			self.blocks += 1
+			del self.buf[:FRAME_SIZE]
+		return samples
+
+def write_wav(filename, samples):
+	with wave.open(filename, 'wb') as f:
+		f.setnchannels(1)
+		f.setsampwidth(2)
+		f.setframerate(SAMPLE_RATE)
+		f.writeframes(struct.pack(f'<{len(samples)}h', *samples))
+
+def main(argv):
+	decoder = Decoder()
+	samples = []
+	if len(argv) == 4 and argv[1] == '-f':
+		with open(argv[2], 'rb') as f:
+			samples = decoder.feed(f.read())
+		out = argv[3]
+	elif len(argv) == 4:
+		# (only needed for this)
+		import serial
+		ser = serial.Serial(argv[1], timeout=0.1)
+		ser.write(b'debug sound adpcm\n')
+		deadline = time.monotonic() + float(argv[2])
+		while time.monotonic() < deadline:
+			samples += decoder.feed(ser.read(4096))
+		ser.write(b'debug sound off\n')
+		out = argv[3]
+	else:
+		sys.exit('usage: adpcm.py <port> <seconds> <out.wav> | -f <frames file> <out.wav>')
+	write_wav(out, samples)
+	print(f'{decoder.blocks} blocks ({len(samples) / SAMPLE_RATE:.1f} s), {decoder.lost} lost, '
+		f'{decoder.skipped_bytes} bytes skipped', file=sys.stderr)
+
+if __name__ == '__main__':
+	main(sys.argv)
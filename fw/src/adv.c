@@ -0,0 +1,116 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <string.h>
+
+#include "adv.h"
+
+void adv_gossip_encode(uint8_t *out, const struct adv_gossip *gossip) {
+	const uint8_t *r = gossip->regs;
+	out[0] = (GOSSIP_VERSION << 6) | gossip->slice;
+	out[1] = (r[0] << 2) | (r[1] >> 4);
+	out[2] = (r[1] << 4) | (r[2] >> 2);
+	out[3] = (r[2] << 6) | r[3];
+	out[4] = gossip->epoch;
+	out[5] = gossip->epoch >> 8;
+}
+
+static int gossip_decode(const uint8_t *data, int len, struct adv_gossip *gossip) {
+	if (len != GOSSIP_DATA_LEN || data[0] >> 6 != GOSSIP_VERSION)
+		return 0;
+
+	gossip->slice = data[0] & 0x3f;
+	if (gossip->slice >= GOSSIP_NUM_SLICES)
+		return 0;
+	gossip->regs[0] = data[1] >> 2;
+	gossip->regs[1] = ((data[1] & 0x03) << 4) | (data[2] >> 4);
+	gossip->regs[2] = ((data[2] & 0x0f) << 2) | (data[3] >> 6);
+	gossip->regs[3] = data[3] & 0x3f;
+	gossip->epoch = data[4] | (data[5] << 8);
+	gossip->valid = 1;
+	return 1;
+}
+
+// The magic element as it appears in an advert, header included
+static const uint8_t magic_element[] = { MAGIC_MANUF_DATA_LEN + 1, ADV_TYPE_MANUF_DATA, 'S', 't', 'a', 'y' };
+#define MAGIC_ELEMENT_LEN	((int)(2 + MAGIC_MANUF_DATA_LEN))
+// where badges put it, after the flags and the appearance
+#define MAGIC_ELEMENT_OFFSET	7
+
+int adv_maybe_ours(const uint8_t *data, int len) {
+	if (len < MAGIC_ELEMENT_LEN)
+		return 0;
+	if (len >= MAGIC_ELEMENT_OFFSET + MAGIC_ELEMENT_LEN &&
+		!memcmp(data + MAGIC_ELEMENT_OFFSET, magic_element, sizeof(magic_element)))
+		return 1;
+
+	// anything else (spoofers) only has its element headers looked at
+	while (len >= MAGIC_ELEMENT_LEN) {
+		if (!memcmp(data, magic_element, sizeof(magic_element)))
+			return 1;
+		if (data[0] == 0)
+			break;
+		len -= 1 + data[0];
+		data += 1 + data[0];
+	}
+	return 0;
+}
+
+enum peer_type adv_classify(const uint8_t *data, int len, struct adv_gossip *gossip) {
+	// 0 = no, otherwise the enum peer_type it implies
+	uint8_t found_appearance = 0;
+	// 0 = no
+	// 1 = yes, valid, ours
+	// 2 = yes, not correct (not relevant to us)
+	uint8_t found_manuf_data = 0;
+
+	if (gossip)
+		gossip->valid = 0;
+	if (!adv_maybe_ours(data, len))
+		return PEER_TYPE_EMPTY;
+
+	// badges have the gossip element last, so keep going for it
+	while (len > 1 && (!found_appearance || !found_manuf_data || (gossip && found_manuf_data == 1 && !gossip->valid))) {
+		int field_len = data[0];
+		// early termination, or truncated
+		if (field_len == 0 || field_len > len - 1)
+			break;
+
+		const uint8_t *field = data + 2;
+		int field_data_len = field_len - 1;
+
+		switch (data[1]) {
+			case ADV_TYPE_APPEARANCE:
+				if (field_data_len == 2 && !memcmp(field, MAGIC_APPEARANCE, 2))
+					found_appearance = PEER_TYPE_BADGE;
+				else if (field_data_len == 2 && !memcmp(field, MAGIC_APPEARANCE_EASTEREGG, 2))
+					found_appearance = PEER_TYPE_EASTEREGG;
+				else
+					found_appearance = PEER_TYPE_SPOOFED;
+				break;
+
+			case ADV_TYPE_MANUF_DATA:
+				if (found_manuf_data == 1) {
+					// the magic has already been seen, so this could be gossip
+					if (gossip)
+						gossip_decode(field, field_data_len, gossip);
+					break;
+				}
+				if (field_data_len == MAGIC_MANUF_DATA_LEN && !memcmp(field, MAGIC_MANUF_DATA, MAGIC_MANUF_DATA_LEN))
+					found_manuf_data = 1;
+				else
+					found_manuf_data = 2;
+				break;
+
+			default:
+				break;
+		}
+
+		data += 1 + field_len;
+		len -= 1 + field_len;
+	}
+
+	if (found_manuf_data != 1)
+		return PEER_TYPE_EMPTY;
+	return found_appearance ? found_appearance : PEER_TYPE_NO_APPEARANCE;
+}
@@ -0,0 +1,59 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "hll.h"
+#include "peers.h"
+
+// Recognizing badge adverts
+// This doesn't depend on Zephyr so that it can be built on the host (see bench_adv.c)
+
+// This is a trick borrowed from DCFurs
+// Android phones cannot set this value via the API, so we can prevent
+// trivial badge spoofing via an app
+#define MAGIC_APPEARANCE "Y!"
+#define MAGIC_APPEARANCE_EASTEREGG "?R"
+
+// We cheat and don't put in a manufacturer ID
+#define MAGIC_MANUF_DATA	"Stay paranoid!"
+#define MAGIC_MANUF_DATA_LEN (sizeof(MAGIC_MANUF_DATA) - 1)
+
+// Same as BT_DATA_GAP_APPEARANCE and BT_DATA_MANUFACTURER_DATA
+#define ADV_TYPE_APPEARANCE	0x19
+#define ADV_TYPE_MANUF_DATA	0xff
+
+// Badges append a second manufacturer data element after the magic one, carrying a
+// rotating slice of their crowd size sketch and their animation clock (see radio.c)
+// Old firmware stops parsing as soon as it has found the appearance and the magic,
+// so it never gets to it
+#define GOSSIP_VERSION		2
+#define GOSSIP_REGS_PER_SLICE	4
+#define GOSSIP_NUM_SLICES	(HLL_NUM_REGS / GOSSIP_REGS_PER_SLICE)
+// version in the top 2 bits and the slice index in the bottom 6, then 4 6-bit registers,
+// then the 16-bit clock epoch (little endian), which fills the advert up to 31 bytes
+#define GOSSIP_DATA_LEN		6
+
+_Static_assert(GOSSIP_NUM_SLICES <= 64, "Slice index doesn't fit");
+
+struct adv_gossip {
+	uint8_t valid;
+	uint8_t slice;
+	uint8_t regs[GOSSIP_REGS_PER_SLICE];
+	// which step of the sender's animation clock it's in, wraps around
+	uint16_t epoch;
+};
+
+void adv_gossip_encode(uint8_t *out, const struct adv_gossip *gossip);
+
+// Quick check on the raw advert: 0 if it can't be one of ours, which is most of them
+// Only looks for the magic element, where badges put it and then at the start of each
+// AD structure, so adv_classify() still has to have the final word
+int adv_maybe_ours(const uint8_t *data, int len);
+
+// Walks the AD structures of an advert (like bt_data_parse())
+// Returns what kind of badge sent it, or PEER_TYPE_EMPTY if it's not one of ours
+// If gossip isn't NULL, it's filled in from the gossip element (valid = 0 if none)
+enum peer_type adv_classify(const uint8_t *data, int len, struct adv_gossip *gossip);
@@ -0,0 +1,265 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Host side of the binary protocol on the badge's USB serial port (see rpc.h and usb.c)
+# As a library:
+#   badge = BadgeRPC('/dev/ttyACM0')
+#   badge.get('num_leds'), badge.set('radio_level', 2), badge.command('badges met')
+#   for stream, seq, data in badge.streams(): ...
+# From the command line:
+#   python3 badge_rpc.py <port> get <param> | set <param> <value> | cmd <console command...>
+#   python3 badge_rpc.py <port> stream <sound|fft|adpcm|bands> <blocks> <file>
+#   (adpcm.py -f and bands.py -f decode those two)
+#   python3 badge_rpc.py <port> bench
+
+import binascii
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+# message types, host to badge
+RPC_PING = 0x01
+RPC_COMMAND = 0x02
+RPC_GET = 0x03
+RPC_SET = 0x04
+RPC_EXIT = 0x05
+# badge to host
+RPC_REPLY = 0x80
+RPC_TEXT = 0x81
+RPC_STREAM = 0x82
+
+STATUS = {0: 'ok', -1: 'unknown message', -2: 'bad length', -3: 'unknown parameter', -4: 'read only',
+	-5: 'write only', -6: 'bad value'}
+
+PARAMS = {
+	'num_leds': 1,
+	'radio_level': 2,
+	'dup_filter': 3,
+	'factory': 4,
+	'unlocked_patterns': 5,
+	'sound_stream': 6,
+	'fft_stream': 7,
+	'badges_met': 8,
+	'crowd_size': 9,
+	'peers': 10,
+	'sound_level': 11,
+	'anim_clock': 12,
+	'bands_stream': 13,
+	# counted since boot
+	'adverts': 14,
+	'badge_adverts': 15,
+	'ring_overflows': 16,
+}
+
+STREAMS = {1: 'sound', 2: 'fft', 3: 'enclog', 4: 'adpcm', 5: 'bands'}
+# parameter and value that turn each on
+STREAM_PARAMS = {'sound': ('sound_stream', 1), 'fft': ('fft_stream', 1), 'adpcm': ('sound_stream', 2),
+	'bands': ('bands_stream', 1)}
+
+def crc16(data):
+	return binascii.crc_hqx(data, 0xffff)
+
+def cobs_encode(data):
+	out = bytearray()
+	for block in _split(data):
+		out.append(len(block) + 1)
+		out += block
+	return bytes(out)
+
+def _split(data):
+	# blocks end at each 0 (which is dropped) or after 254 bytes
+	block = bytearray()
+	blocks = []
+	for b in data:
+		if b == 0:
+			blocks.append(block)
+			block = bytearray()
+		else:
+			block.append(b)
+			if len(block) == 254:
+				blocks.append(block)
+				block = bytearray()
+	blocks.append(block)
+	return blocks
+
+def cobs_decode(data):
+	out = bytearray()
+	i = 0
+	while i < len(data):
+		code = data[i]
+		block = data[i + 1:i + code]
+		if code == 0 or len(block) != code - 1 or 0 in block:
+			raise ValueError('bad COBS')
+		out += block
+		i += code
+		if code != 0xff and i < len(data):
+			out.append(0)
+	return bytes(out)
+
+def encode_frame(msg_type, seq, payload=b''):
+	body = bytes([msg_type, seq & 0xff]) + payload
+	return cobs_encode(body + struct.pack('<H', crc16(body))) + b'\0'
+
+def decode_frame(data):
+	# returns (type, seq, payload), raises ValueError if it's damaged
+	body = cobs_decode(data)
+	if len(body) < 4 or struct.unpack('<H', body[-2:])[0] != crc16(body[:-2]):
+		raise ValueError('bad CRC')
+	return body[0], body[1], body[2:-2]
+
+class BadgeRPC:
+	def __init__(self, port):
+		self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+		tty.setraw(self.fd)
+		termios.tcflush(self.fd, termios.TCIOFLUSH)
+		self.rx = bytearray()
+		self.seq = 0
+		self.bad_frames = 0
+		# frames that came in while waiting for something else
+		self.pending = []
+		# stream -> next sequence number expected, and frames found missing
+		self.stream_seq = {}
+		self.stream_lost = 0
+		# a 0 switches the console over, and ends whatever half frame the badge has
+		os.write(self.fd, b'\0')
+
+	def close(self):
+		try:
+			os.write(self.fd, encode_frame(RPC_EXIT, 0))
+		finally:
+			os.close(self.fd)
+
+	def _read_frame(self, timeout):
+		deadline = time.monotonic() + timeout
+		while True:
+			end = self.rx.find(b'\0')
+			if end >= 0:
+				raw = bytes(self.rx[:end])
+				del self.rx[:end + 1]
+				if not raw:
+					continue
+				try:
+					return decode_frame(raw)
+				except ValueError:
+					# (also the text console's output from before the switch)
+					self.bad_frames += 1
+					continue
+			left = deadline - time.monotonic()
+			if left <= 0:
+				raise TimeoutError
+			if select.select([self.fd], [], [], left)[0]:
+				self.rx += os.read(self.fd, 65536)
+
+	def _next(self, timeout=2):
+		if self.pending:
+			return self.pending.pop(0)
+		return self._read_frame(timeout)
+
+	def request(self, msg_type, payload=b'', timeout=2):
+		# returns (status, reply payload, text printed by the command)
+		self.seq = (self.seq + 1) & 0xff
+		os.write(self.fd, encode_frame(msg_type, self.seq, payload))
+		text = b''
+		deadline = time.monotonic() + timeout
+		while True:
+			t, seq, data = self._read_frame(max(0, deadline - time.monotonic()))
+			if t == RPC_TEXT and seq == self.seq:
+				text += data
+			elif t == RPC_REPLY and seq == self.seq:
+				return struct.unpack_from('<b', data)[0], data[1:], text
+			else:
+				self.pending.append((t, seq, data))
+
+	def _check(self, status):
+		if status:
+			raise RuntimeError(STATUS.get(status, status))
+
+	def ping(self, data=b''):
+		status, reply, _ = self.request(RPC_PING, data)
+		self._check(status)
+		return reply
+
+	def command(self, line, timeout=2):
+		status, _, text = self.request(RPC_COMMAND, line.encode(), timeout)
+		self._check(status)
+		return text.decode(errors='replace')
+
+	def get(self, param):
+		status, reply, _ = self.request(RPC_GET, struct.pack('<H', PARAMS[param]))
+		self._check(status)
+		return struct.unpack('<i', reply)[0]
+
+	def set(self, param, value):
+		status, _, _ = self.request(RPC_SET, struct.pack('<Hi', PARAMS[param], value))
+		self._check(status)
+
+	def streams(self, timeout=2):
+		# yields (stream name, sequence number, data), keeps count of lost frames
+		while True:
+			t, seq, data = self._next(timeout)
+			if t != RPC_STREAM or not data:
+				continue
+			name = STREAMS.get(data[0], data[0])
+			expected = self.stream_seq.get(name)
+			if expected is not None and seq != expected:
+				self.stream_lost += (seq - expected) & 0xff
+			self.stream_seq[name] = (seq + 1) & 0xff
+			yield name, seq, data[1:]
+
+def main(argv):
+	if len(argv) < 3:
+		sys.exit('usage: badge_rpc.py <port> get <param> | set <param> <value> | cmd <command...> | '
+			'stream <sound|fft|adpcm|bands> <blocks> <file> | bench')
+	badge = BadgeRPC(argv[1])
+	try:
+		op = argv[2]
+		if op == 'get':
+			print(badge.get(argv[3]))
+		elif op == 'set':
+			badge.set(argv[3], int(argv[4], 0))
+		elif op == 'cmd':
+			print(badge.command(' '.join(argv[3:])), end='')
+		elif op == 'stream':
+			name, blocks, filename = argv[3], int(argv[4]), argv[5]
+			got = 0
+			got_blocks = 0
+			start = time.monotonic()
+			param, value = STREAM_PARAMS[name]
+			badge.set(param, value)
+			with open(filename, 'wb') as f:
+				for stream, _, data in badge.streams():
+					if stream != name:
+						continue
+					# (one message per 64 ms block)
+					f.write(data)
+					got += len(data)
+					got_blocks += 1
+					if got_blocks >= blocks:
+						break
+			badge.set(param, 0)
+			elapsed = time.monotonic() - start
+			print(f'{got} bytes in {elapsed:.1f} s ({got / elapsed / 1024:.1f} KB/s), '
+				f'{badge.stream_lost} frames lost, {badge.bad_frames} bad frames', file=sys.stderr)
+		elif op == 'bench':
+			n = 200
+			start = time.monotonic()
+			for i in range(n):
+				assert badge.ping(bytes([i]) * 64) == bytes([i]) * 64
+			elapsed = time.monotonic() - start
+			print(f'{n / elapsed:.0f} round trips/s ({elapsed / n * 1000:.2f} ms each)')
+			start = time.monotonic()
+			for i in range(n):
+				badge.get('peers')
+			elapsed = time.monotonic() - start
+			print(f'{n / elapsed:.0f} gets/s')
+		else:
+			sys.exit(f'unknown operation {op}')
+	finally:
+		badge.close()
+
+if __name__ == '__main__':
+	main(sys.argv)
@@ -0,0 +1,134 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Captures the badge's band data stream (see sound.h) and prints it as CSV:
+# time in ms, sound level, then for each band its energy, history (both in dB) and hue
+# python3 bands.py <port> <seconds>
+# python3 bands.py -f <records file>     (e.g. from badge_rpc.py stream bands)
+
+import struct
+import sys
+import time
+
+NUM_BANDS = 21
+HEADER_SIZE = 8
+STEPS_PER_DOUBLING = 6
+NIBBLES_LEN = (NUM_BANDS + 1) // 2
+KEY_SIZE = HEADER_SIZE + 3 * NUM_BANDS
+# a delta record without any hue changes
+DELTA_MIN_SIZE = HEADER_SIZE + NUM_BANDS + NIBBLES_LEN + 3
+# history nibble for "the same as the energy"
+HISTORY_IS_ENERGY = -8
+# from log2(1 + energy) steps to dB
+DB_PER_STEP = 10 * 0.30103 / STEPS_PER_DOUBLING
+
+def nibbles(data):
+	out = []
+	for i in range(NUM_BANDS):
+		v = data[i // 2] >> (i % 2 * 4) & 0xf
+		out.append(v - 16 if v & 8 else v)
+	return out
+
+class Decoder:
+	# takes the stream in any pieces, yields (time, level, energies, histories, hues)
+	# for each record it can decode; deltas after a lost record wait for the next key
+	def __init__(self):
+		self.buf = bytearray()
+		self.state = None
+		self.next_seq = None
+		self.records = 0
+		self.keys = 0
+		self.lost = 0
+		self.bytes = 0
+		self.skipped_bytes = 0
+
+	def _size(self):
+		# of the record at the start of buf, None if it needs more, 0 if it isn't one
+		if len(self.buf) < 2:
+			return None
+		if self.buf[0] != ord('B') or self.buf[1] not in b'KD':
+			return 0
+		if self.buf[1] == ord('K'):
+			return KEY_SIZE
+		if len(self.buf) < DELTA_MIN_SIZE:
+			return None
+		changed = int.from_bytes(self.buf[DELTA_MIN_SIZE - 3:DELTA_MIN_SIZE], 'little')
+		if changed >> NUM_BANDS:
+			return 0
+		return DELTA_MIN_SIZE + bin(changed).count('1')
+
+	def feed(self, data):
+		self.buf += data
+		while True:
+			size = self._size()
+			if size is None or len(self.buf) < (size or 0):
+				return
+			if not size:
+				# (console output)
+				start = self.buf.find(b'B', 1)
+				skip = start if start > 0 else len(self.buf)
+				self.skipped_bytes += skip
+				del self.buf[:skip]
+				continue
+			record = bytes(self.buf[:size])
+			del self.buf[:size]
+			out = self._decode(record)
+			if out:
+				yield out
+
+	def _decode(self, record):
+		kind, seq, level, t = struct.unpack_from('<cBBI', record, 1)
+		if self.next_seq is not None and seq != self.next_seq:
+			self.lost += (seq - self.next_seq) & 0xff
+			self.state = None
+		self.next_seq = (seq + 1) & 0xff
+		self.records += 1
+		self.bytes += len(record)
+		body = record[HEADER_SIZE:]
+		if kind == b'K':
+			self.keys += 1
+			self.state = [list(body[:NUM_BANDS]), list(body[NUM_BANDS:2 * NUM_BANDS]), list(body[2 * NUM_BANDS:])]
+		elif self.state:
+			energy, history, hue = self.state
+			energy[:] = body[:NUM_BANDS]
+			body = body[NUM_BANDS:]
+			for i, d in enumerate(nibbles(body)):
+				history[i] = energy[i] if d == HISTORY_IS_ENERGY else (history[i] + d) & 0xff
+			changed = int.from_bytes(body[NIBBLES_LEN:NIBBLES_LEN + 3], 'little')
+			new_hues = iter(body[NIBBLES_LEN + 3:])
+			for i in range(NUM_BANDS):
+				if changed & (1 << i):
+					hue[i] = next(new_hues)
+		else:
+			return None
+		return t, level, list(self.state[0]), list(self.state[1]), list(self.state[2])
+
+def print_csv(records):
+	for t, level, energy, history, hue in records:
+		print(','.join([str(t), str(level)] + [f'{e * DB_PER_STEP:.1f}' for e in energy] +
+			[f'{h * DB_PER_STEP:.1f}' for h in history] + [str(h) for h in hue]))
+
+def main(argv):
+	decoder = Decoder()
+	print(','.join(['time_ms', 'level'] + [f'energy{i}' for i in range(NUM_BANDS)] +
+		[f'history{i}' for i in range(NUM_BANDS)] + [f'hue{i}' for i in range(NUM_BANDS)]))
+	if len(argv) == 3 and argv[1] == '-f':
+		with open(argv[2], 'rb') as f:
+			print_csv(decoder.feed(f.read()))
+	elif len(argv) == 3:
+		# (only needed for this)
+		import serial
+		ser = serial.Serial(argv[1], timeout=0.1)
+		ser.write(b'debug bands on\n')
+		deadline = time.monotonic() + float(argv[2])
+		while time.monotonic() < deadline:
+			print_csv(decoder.feed(ser.read(1024)))
+		ser.write(b'debug bands off\n')
+	else:
+		sys.exit('usage: bands.py <port> <seconds> | -f <records file>')
+	if decoder.records:
+		print(f'{decoder.records} records, {decoder.keys} key, {decoder.bytes / decoder.records:.1f} bytes each '
+			f'on average, {decoder.lost} lost, {decoder.skipped_bytes} bytes skipped', file=sys.stderr)
+
+if __name__ == '__main__':
+	main(sys.argv)
@@ -0,0 +1,299 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// Host benchmark for the advert ingest path (adv_classify() + the peer table + gossip),
+// replaying a synthetic crowd of badges and other BLE devices
+// cc -O2 -o bench_adv bench_adv.c adv.c peers.c
+// ./bench_adv [-d devices] [-r adverts/s] [-s seconds] [-c churn/s] [-m badge,egg,spoof,phone,other] [-f refresh ms]
+// -f models the controller's duplicate filtering (see scan_refresh_handler() in radio.c):
+// only the first advert from each device per refresh reaches the host
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adv.h"
+#include "peers.h"
+
+// same as radio.c
+#define PEER_MAX_AGE 60000
+
+enum kind {
+	KIND_BADGE,
+	KIND_EGG,
+	KIND_SPOOF,
+	KIND_PHONE,
+	KIND_OTHER,
+	NUM_KINDS,
+};
+static const char *kind_names[NUM_KINDS] = { "badge", "egg", "spoof", "phone", "other" };
+
+struct device {
+	uint8_t addr[PEER_ADDR_LEN];
+	uint8_t kind;
+	uint8_t adv_len;
+	uint8_t adv[31];
+	// enum peer_type it should be classified as
+	uint8_t expected_type;
+	// -1 = never
+	int64_t last_heard;
+	// refresh period it was last reported to the host in, -1 = never
+	int64_t last_reported;
+};
+
+struct event {
+	uint32_t device;
+	uint32_t time;
+	// dropped by the controller
+	uint8_t filtered;
+};
+
+static uint32_t rng_state = 1;
+static uint32_t rng() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int put_gossip(uint8_t *adv, int len) {
+	struct adv_gossip gossip = { .slice = rng() % GOSSIP_NUM_SLICES, .epoch = rng() };
+	for (int i = 0; i < GOSSIP_REGS_PER_SLICE; i++)
+		gossip.regs[i] = rng() % 8;
+	adv[len] = GOSSIP_DATA_LEN + 1;
+	adv[len + 1] = ADV_TYPE_MANUF_DATA;
+	adv_gossip_encode(adv + len + 2, &gossip);
+	return len + 2 + GOSSIP_DATA_LEN;
+}
+
+static int put_field(uint8_t *adv, int len, uint8_t type, const void *data, int data_len) {
+	adv[len] = data_len + 1;
+	adv[len + 1] = type;
+	memcpy(adv + len + 2, data, data_len);
+	return len + 2 + data_len;
+}
+
+static void make_device(struct device *d, enum kind kind) {
+	static const uint8_t flags[] = { 0x04 };
+	static const uint8_t phone_appearance[] = { 0x40, 0x00 };
+	static const uint8_t apple[] = { 0x4c, 0x00, 0x10, 0x05, 0x01, 0x18, 0x2b, 0x7e, 0x9a };
+	static const uint8_t uuids[] = { 0x0a, 0x18, 0x0f, 0x18, 0x6e, 0xfd };
+	static const uint8_t name[] = "Fitness Tracker";
+
+	d->addr[0] = 1;
+	for (int i = 1; i < PEER_ADDR_LEN; i++)
+		d->addr[i] = rng();
+	d->kind = kind;
+	d->last_heard = -1;
+	d->last_reported = -1;
+
+	int len = put_field(d->adv, 0, 0x01, flags, sizeof(flags));
+	switch (kind) {
+		case KIND_BADGE:
+			len = put_field(d->adv, len, ADV_TYPE_APPEARANCE, MAGIC_APPEARANCE, 2);
+			len = put_field(d->adv, len, ADV_TYPE_MANUF_DATA, MAGIC_MANUF_DATA, MAGIC_MANUF_DATA_LEN);
+			len = put_gossip(d->adv, len);
+			d->expected_type = PEER_TYPE_BADGE;
+			break;
+		case KIND_EGG:
+			len = put_field(d->adv, len, ADV_TYPE_APPEARANCE, MAGIC_APPEARANCE_EASTEREGG, 2);
+			len = put_field(d->adv, len, ADV_TYPE_MANUF_DATA, MAGIC_MANUF_DATA, MAGIC_MANUF_DATA_LEN);
+			len = put_gossip(d->adv, len);
+			d->expected_type = PEER_TYPE_EASTEREGG;
+			break;
+		case KIND_SPOOF:
+			// half of them an app that can't set the appearance, half with the wrong one
+			if (rng() & 1) {
+				len = put_field(d->adv, len, ADV_TYPE_APPEARANCE, phone_appearance, 2);
+				d->expected_type = PEER_TYPE_SPOOFED;
+			} else {
+				d->expected_type = PEER_TYPE_NO_APPEARANCE;
+			}
+			len = put_field(d->adv, len, ADV_TYPE_MANUF_DATA, MAGIC_MANUF_DATA, MAGIC_MANUF_DATA_LEN);
+			break;
+		case KIND_PHONE:
+			len = put_field(d->adv, len, ADV_TYPE_MANUF_DATA, apple, sizeof(apple));
+			len = put_field(d->adv, len, 0x0a, "\x0c", 1);
+			d->expected_type = PEER_TYPE_EMPTY;
+			break;
+		default:
+			len = put_field(d->adv, len, 0x03, uuids, sizeof(uuids));
+			len = put_field(d->adv, len, 0x09, name, sizeof(name) - 1);
+			d->expected_type = PEER_TYPE_EMPTY;
+			break;
+	}
+	d->adv_len = len;
+}
+
+static enum kind pick_kind(const int *mix) {
+	int r = rng() % 100;
+	for (int k = 0; k < NUM_KINDS; k++) {
+		if (r < mix[k])
+			return k;
+		r -= mix[k];
+	}
+	return KIND_OTHER;
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct peer_table table;
+static struct hll crowd;
+
+int main(int argc, char **argv) {
+	int num_devices = 500;
+	int rate = 5000;
+	int seconds = 120;
+	int churn = 5;
+	int mix[NUM_KINDS] = { 30, 2, 3, 40, 25 };
+	// 0 = no duplicate filtering
+	int refresh_ms = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:r:s:c:m:f:")) != -1) {
+		switch (opt) {
+			case 'd': num_devices = atoi(optarg); break;
+			case 'r': rate = atoi(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			case 'c': churn = atoi(optarg); break;
+			case 'm':
+				if (sscanf(optarg, "%d,%d,%d,%d,%d", &mix[0], &mix[1], &mix[2], &mix[3], &mix[4]) != 5) {
+					fprintf(stderr, "-m needs 5 percentages\n");
+					return 1;
+				}
+				break;
+			case 'f': refresh_ms = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-d devices] [-r adverts/s] [-s seconds] [-c churn/s] [-m badge,egg,spoof,phone,other] [-f refresh ms]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	// everyone who is ever around, churn replaces present devices with new ones
+	int max_devices = num_devices + churn * seconds;
+	struct device *devices = calloc(max_devices, sizeof(*devices));
+	int *present = calloc(num_devices, sizeof(*present));
+	int total_devices = 0;
+	for (int i = 0; i < num_devices; i++) {
+		make_device(&devices[total_devices], pick_kind(mix));
+		present[i] = total_devices++;
+	}
+
+	// the whole stream up front, so that generating it isn't timed
+	long num_events = (long)rate * seconds;
+	struct event *events = calloc(num_events, sizeof(*events));
+	for (long i = 0; i < num_events; i++) {
+		uint32_t t = i * 1000 / rate;
+		if (i && t / 1000 != events[i - 1].time / 1000) {
+			for (int c = 0; c < churn; c++) {
+				make_device(&devices[total_devices], pick_kind(mix));
+				present[rng() % num_devices] = total_devices++;
+			}
+		}
+		events[i].device = present[rng() % num_devices];
+		events[i].time = t;
+	}
+
+	// what the controller drops never costs the host anything, so it's done up front too
+	long num_reported = 0;
+	for (long i = 0; i < num_events; i++) {
+		struct device *d = &devices[events[i].device];
+		int64_t period = refresh_ms ? events[i].time / refresh_ms : i;
+		events[i].filtered = d->last_reported == period;
+		d->last_reported = period;
+		num_reported += !events[i].filtered;
+	}
+
+	peers_init(&table);
+	double ingest_ns = 0;
+	long misclassified = 0;
+	long ours = 0;
+	int count_errors = 0;
+
+	long i = 0;
+	for (int sec = 0; sec < seconds; sec++) {
+		long start = i;
+		uint32_t end_time = (sec + 1) * 1000;
+
+		// what device_found() and adv_work_handler() do, timed in one go
+		double t0 = now_ns();
+		for (; i < num_events && events[i].time < end_time; i++) {
+			if (events[i].filtered)
+				continue;
+			struct device *d = &devices[events[i].device];
+			struct adv_gossip gossip;
+			enum peer_type type = adv_classify(d->adv, d->adv_len, &gossip);
+			if (type != PEER_TYPE_EMPTY) {
+				peers_find(&table, d->addr);
+				peers_seen(&table, d->addr, type, -60, events[i].time);
+				if (gossip.valid && (type == PEER_TYPE_BADGE || type == PEER_TYPE_EASTEREGG)) {
+					uint8_t *regs = &crowd.regs[gossip.slice * GOSSIP_REGS_PER_SLICE];
+					for (int k = 0; k < GOSSIP_REGS_PER_SLICE; k++)
+						if (gossip.regs[k] > regs[k])
+							regs[k] = gossip.regs[k];
+				}
+			}
+		}
+		uint32_t oldest_seen;
+		peers_expire(&table, end_time, PEER_MAX_AGE, &oldest_seen);
+		ingest_ns += now_ns() - t0;
+
+		// check against what actually happened
+		for (long j = start; j < i; j++) {
+			if (events[j].filtered)
+				continue;
+			struct device *d = &devices[events[j].device];
+			struct adv_gossip gossip;
+			if (adv_classify(d->adv, d->adv_len, &gossip) != d->expected_type)
+				misclassified++;
+			if (gossip.valid != (d->kind == KIND_BADGE || d->kind == KIND_EGG))
+				misclassified++;
+			if (d->expected_type != PEER_TYPE_EMPTY)
+				ours++;
+			d->last_heard = events[j].time;
+		}
+
+		if (table.num_evictions)
+			continue;
+		int expected_peers = 0, expected_imposters = 0, expected_badge_makers = 0;
+		for (int j = 0; j < total_devices; j++) {
+			struct device *d = &devices[j];
+			if (d->expected_type == PEER_TYPE_EMPTY || d->last_heard < 0 || end_time - d->last_heard >= PEER_MAX_AGE)
+				continue;
+			expected_peers++;
+			if (d->expected_type == PEER_TYPE_EASTEREGG)
+				expected_badge_makers++;
+			else if (d->expected_type != PEER_TYPE_BADGE)
+				expected_imposters++;
+		}
+		if (expected_peers != table.num_peers || expected_imposters != table.num_imposters ||
+			expected_badge_makers != table.num_badge_makers) {
+			if (count_errors++ < 10)
+				printf("t=%d s: expected %d/%d/%d peers/imposters/badge makers, got %d/%d/%d\n", sec + 1,
+					expected_peers, expected_imposters, expected_badge_makers,
+					table.num_peers, table.num_imposters, table.num_badge_makers);
+		}
+	}
+
+	printf("%d devices present (", num_devices);
+	for (int k = 0; k < NUM_KINDS; k++)
+		printf("%s%d%% %s", k ? ", " : "", mix[k], kind_names[k]);
+	printf("), %d joining/leaving per s, %d seen in total\n", churn, total_devices);
+	printf("%ld adverts over %d s, ", num_events, seconds);
+	if (refresh_ms)
+		printf("%ld (%.1f%%) reported with duplicates filtered every %d ms, ",
+			num_reported, 100.0 * num_reported / num_events, refresh_ms);
+	printf("%ld from badges, %d peers at the end, %u evictions\n", ours, table.num_peers, table.num_evictions);
+	printf("%.1f ns per advert heard, %.0f adverts/s sustainable, %.1f us of CPU per second (on this host)\n",
+		ingest_ns / num_events, num_events / ingest_ns * 1e9, ingest_ns / seconds / 1e3);
+	printf("%ld misclassified, %d count mismatches%s\n", misclassified, count_errors,
+		table.num_evictions ? " (not checked, table overflowed)" : "");
+
+	return misclassified || count_errors;
+}
@@ -0,0 +1,148 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// Host benchmark for color.c against the divide-based math it replaced (the hue
+// switch from sound.c and the c * step / num_steps fades from main.c), and a check
+// that the hue table stays within 1 of the old result
+// cc -O2 -o bench_color bench_color.c color.c
+// ./bench_color [-n calls]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "color.h"
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// as sound.c had it
+__attribute__((noinline)) static void old_hue_to_rgb(int h, int v, int *r, int *g, int *b) {
+	// awkward HSV-ish --> RGB, except S = 1 always
+	int huebin = h / 256;
+	int hue_in_bin = h % 256;
+
+	switch (huebin) {
+		case 0:
+			*r = v;
+			*g = v * hue_in_bin / 255;
+			*b = 0;
+			break;
+		case 1:
+			*r = v * (255 - hue_in_bin) / 255;
+			*g = v;
+			*b = 0;
+			break;
+		case 2:
+			*r = 0;
+			*g = v;
+			*b = v * hue_in_bin / 255;
+			break;
+		case 3:
+			*r = 0;
+			*g = v * (255 - hue_in_bin) / 255;
+			*b = v;
+			break;
+		case 4:
+			*r = v * hue_in_bin / 255;
+			*g = 0;
+			*b = v;
+			break;
+		case 5:
+		default:
+			*r = v;
+			*g = 0;
+			*b = v * (255 - hue_in_bin) / 255;
+			break;
+	}
+}
+
+// one pixel of a fade, as main.c had it and as it is now
+__attribute__((noinline)) static int old_fade(const int *color, int step, int num_steps) {
+	return color[0] * step / num_steps + color[1] * step / num_steps + color[2] * step / num_steps;
+}
+
+__attribute__((noinline)) static int new_fade(const int *color, int step, int num_steps) {
+	int level = color_fade_level(step, num_steps);
+	return color_scale(color[0], level) + color_scale(color[1], level) + color_scale(color[2], level);
+}
+
+int main(int argc, char **argv) {
+	int num_calls = 10000000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': num_calls = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n calls]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	// every hue at every value
+	int max_diff = 0;
+	for (int h = 0; h < COLOR_HUE_STEPS; h++) {
+		for (int v = 0; v <= 1024; v++) {
+			int r0, g0, b0, r1, g1, b1;
+			old_hue_to_rgb(h, v, &r0, &g0, &b0);
+			color_hue_to_rgb(h, v, &r1, &g1, &b1);
+			int d[3] = { abs(r1 - r0), abs(g1 - g0), abs(b1 - b0) };
+			for (int c = 0; c < 3; c++)
+				if (d[c] > max_diff)
+					max_diff = d[c];
+		}
+	}
+	printf("hue table differs from the old divide by at most %d\n", max_diff);
+
+	// the same random inputs for both, so only the math differs
+	int *hues = malloc(num_calls * sizeof(*hues));
+	int *vals = malloc(num_calls * sizeof(*vals));
+	int *steps = malloc(num_calls * sizeof(*steps));
+	int *lens = malloc(num_calls * sizeof(*lens));
+	srand(1);
+	for (int i = 0; i < num_calls; i++) {
+		hues[i] = rand() % COLOR_HUE_STEPS;
+		vals[i] = rand() % 1025;
+		lens[i] = 1 + rand() % COLOR_RECIP_MAX;
+		steps[i] = rand() % (lens[i] + 1);
+	}
+	int color[3] = { 255, 99, 0 };
+	long sink = 0;
+
+	double t0 = now_ns();
+	for (int i = 0; i < num_calls; i++) {
+		int r, g, b;
+		old_hue_to_rgb(hues[i], vals[i], &r, &g, &b);
+		sink += r + g + b;
+	}
+	double t1 = now_ns();
+	for (int i = 0; i < num_calls; i++) {
+		int r, g, b;
+		color_hue_to_rgb(hues[i], vals[i], &r, &g, &b);
+		sink += r + g + b;
+	}
+	double t2 = now_ns();
+	printf("hue->RGB: %.1f ns -> %.1f ns per call\n", (t1 - t0) / num_calls, (t2 - t1) / num_calls);
+
+	t0 = now_ns();
+	for (int i = 0; i < num_calls; i++)
+		sink += old_fade(color, steps[i], lens[i]);
+	t1 = now_ns();
+	for (int i = 0; i < num_calls; i++)
+		sink += new_fade(color, steps[i], lens[i]);
+	t2 = now_ns();
+	printf("fade step: %.1f ns -> %.1f ns per pixel\n", (t1 - t0) / num_calls, (t2 - t1) / num_calls);
+
+	// (so the loops aren't optimized away)
+	fprintf(stderr, "%ld\n", sink);
+	free(hues);
+	free(vals);
+	free(steps);
+	free(lens);
+	return 0;
+}
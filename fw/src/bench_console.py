@@ -0,0 +1,56 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Measures how many console commands per second the badge gets through over USB,
+# sent one at a time (waiting for each prompt) and all at once (like a pasted script)
+# python3 bench_console.py <port> [commands]
+
+import sys
+import time
+
+import serial
+
+PROMPT = b'\x1b[0md!> '
+# prints one short line
+COMMAND = b'debug radio level auto\r\n'
+
+def wait_prompts(ser, n):
+	got = 0
+	buf = b''
+	while got < n:
+		data = ser.read(max(1, ser.in_waiting))
+		if not data:
+			raise TimeoutError(f'only {got} of {n} prompts')
+		buf += data
+		got += buf.count(PROMPT)
+		buf = buf[buf.rfind(PROMPT) + len(PROMPT):] if PROMPT in buf else buf[-len(PROMPT):]
+
+def main(argv):
+	if len(argv) < 2:
+		sys.exit('usage: bench_console.py <port> [commands]')
+	n = int(argv[2]) if len(argv) > 2 else 500
+	ser = serial.Serial(argv[1], timeout=2)
+	ser.reset_input_buffer()
+	ser.write(b'\r\n')
+	wait_prompts(ser, 1)
+
+	start = time.monotonic()
+	for _ in range(n):
+		ser.write(COMMAND)
+		wait_prompts(ser, 1)
+	elapsed = time.monotonic() - start
+	print(f'one at a time: {n / elapsed:.0f} commands/s')
+
+	start = time.monotonic()
+	ser.write(COMMAND * n)
+	wait_prompts(ser, n)
+	elapsed = time.monotonic() - start
+	print(f'all at once: {n / elapsed:.0f} commands/s')
+	# (a prompt each, so an extra prompt per line ending shows up as too many here)
+	time.sleep(0.5)
+	extra = ser.read(ser.in_waiting).count(PROMPT)
+	if extra:
+		print(f'{extra} extra prompts')
+
+if __name__ == '__main__':
+	main(sys.argv)
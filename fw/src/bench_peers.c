@@ -0,0 +1,123 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// Host stress test for the peer counts seqlock (peers_publish()/peers_read()):
+// a writer thread publishes new counts in a tight loop while the main thread reads
+// them, checking every copy is consistent and timing each read. The same is then
+// done with a mutex around the copy (what get_peer_infos() used to take) to compare.
+// cc -O2 -pthread -o bench_peers bench_peers.c peers.c
+// ./bench_peers [-n reads]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "peers.h"
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct peer_table table;
+static struct peer_counts_snapshot snap;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct peer_counts locked_counts;
+static volatile int use_mutex;
+static volatile int stop;
+static long publishes;
+
+// every published set of counts is k, 3k, 7k, so a torn copy shows
+static void *writer(void *arg) {
+	(void)arg;
+	uint32_t k = 0;
+	while (!stop) {
+		k = (k + 1) & 0xfffff;
+		table.num_peers = k;
+		table.num_imposters = 3 * k;
+		table.num_badge_makers = 7 * k;
+		if (use_mutex) {
+			pthread_mutex_lock(&mutex);
+			locked_counts.num_peers = table.num_peers;
+			locked_counts.num_imposters = table.num_imposters;
+			locked_counts.num_badge_makers = table.num_badge_makers;
+			pthread_mutex_unlock(&mutex);
+		} else {
+			peers_publish(&table, &snap);
+		}
+		publishes++;
+	}
+	return NULL;
+}
+
+static int compare_floats(const void *a, const void *b) {
+	float x = *(const float *)a, y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+static void run(const char *name, int mutex_reads, float *lat, long num_reads) {
+	use_mutex = mutex_reads;
+	stop = 0;
+	publishes = 0;
+	pthread_t thread;
+	pthread_create(&thread, NULL, writer, NULL);
+
+	long torn = 0;
+	double start = now_ns();
+	for (long i = 0; i < num_reads; i++) {
+		struct peer_counts c;
+		double t0 = now_ns();
+		if (mutex_reads) {
+			pthread_mutex_lock(&mutex);
+			c = locked_counts;
+			pthread_mutex_unlock(&mutex);
+		} else {
+			peers_read(&snap, &c);
+		}
+		lat[i] = now_ns() - t0;
+		if (c.num_imposters != 3 * c.num_peers || c.num_badge_makers != 7 * c.num_peers)
+			torn++;
+	}
+	double elapsed = now_ns() - start;
+	stop = 1;
+	pthread_join(thread, NULL);
+
+	qsort(lat, num_reads, sizeof(*lat), compare_floats);
+	printf("%-8s %ld torn reads, p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, p99.99 %.0f ns, max %.0f ns, "
+		"%.1f M publishes/s during %.2f s\n", name, torn,
+		lat[num_reads / 2], lat[num_reads * 99 / 100], lat[num_reads * 999 / 1000],
+		lat[num_reads * 9999 / 10000], lat[num_reads - 1], publishes / elapsed * 1e3, elapsed / 1e9);
+}
+
+int main(int argc, char **argv) {
+	long num_reads = 5000000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': num_reads = atol(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n reads]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	float *lat = calloc(num_reads, sizeof(*lat));
+	// what timing a read costs on its own
+	for (long i = 0; i < num_reads; i++) {
+		double t0 = now_ns();
+		lat[i] = now_ns() - t0;
+	}
+	qsort(lat, num_reads, sizeof(*lat), compare_floats);
+	printf("%ld reads per run, %ld CPUs, timer overhead p50 %.0f ns (included below)\n",
+		num_reads, sysconf(_SC_NPROCESSORS_ONLN), lat[num_reads / 2]);
+
+	run("seqlock:", 0, lat, num_reads);
+	run("mutex:", 1, lat, num_reads);
+	free(lat);
+	return 0;
+}
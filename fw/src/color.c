@@ -0,0 +1,14 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include "color.h"
+
+#include "color_lut.h"
+
+void color_hue_to_rgb(int h, int v, int *r, int *g, int *b) {
+	const uint8_t *c = color_hue_lut[h];
+
+	*r = color_scale255(c[0], v);
+	*g = color_scale255(c[1], v);
+	*b = color_scale255(c[2], v);
+}
@@ -0,0 +1,46 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-point color math shared by the LEDs and the eyes
+// Everything here is multiplies, shifts and table lookups (no divides)
+
+// Hue wheel is 6 sextants of 256 steps each
+#define COLOR_HUE_STEPS		(6 * 256)
+
+// Brightness fractions are in [0, COLOR_FRAC_ONE]
+#define COLOR_FRAC_SHIFT	8
+#define COLOR_FRAC_ONE		(1 << COLOR_FRAC_SHIFT)
+
+// Largest denominator that color_frac() can handle
+#define COLOR_RECIP_MAX		64
+
+extern const uint8_t color_hue_lut[COLOR_HUE_STEPS][3];
+extern const uint16_t color_gamma_lut[COLOR_FRAC_ONE + 1];
+extern const uint32_t color_recip_lut[COLOR_RECIP_MAX + 1];
+
+// num / den as a fraction, for 0 <= num <= den <= COLOR_RECIP_MAX
+static inline int color_frac(int num, int den) {
+	return (num * color_recip_lut[den]) >> (16 - COLOR_FRAC_SHIFT);
+}
+
+// c * frac
+static inline int color_scale(int c, int frac) {
+	return (c * frac) >> COLOR_FRAC_SHIFT;
+}
+
+// c * v / 255 (rounded), for c in [0, 255] and v in [0, 1024]
+static inline int color_scale255(int c, int v) {
+	return (c * v * 257 + 0x8000) >> 16;
+}
+
+// Fade level for step out of num_steps, corrected so that equal steps look equally bright
+static inline int color_fade_level(int step, int num_steps) {
+	return color_gamma_lut[color_frac(step, num_steps)];
+}
+
+// Hue in [0, COLOR_HUE_STEPS) and value in [0, 1024] --> RGB in [0, v] (S = 1 always)
+void color_hue_to_rgb(int h, int v, int *r, int *g, int *b);
@@ -0,0 +1,106 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <stdlib.h>
+#include <random/rand32.h>
+
+#include "color.h"
+#include "effects.h"
+#include "misc.h"
+
+#include "led_geometry.h"
+
+// 1 for d == 0 fading to 0 for |d| >= width, as a color_scale() fraction
+static inline int falloff(int d, int width) {
+	d = abs(d);
+	if (d >= width)
+		return 0;
+	return color_frac(width - d, width);
+}
+
+void effect_ripple(enum led_origin origin, int phase, int r, int g, int b) {
+	const uint8_t *dist = led_dist[origin];
+
+	for (int i = 0; i < NLEDS; i++) {
+		// triangle wave with a period of 64
+		int d = (dist[i] - phase) & 63;
+		int level = (d < 32 ? d : 63 - d) * 8;
+		set_led(i, color_scale(r, level), color_scale(g, level), color_scale(b, level));
+	}
+}
+
+void effect_sweep(int axis, int pos, int width, int r, int g, int b) {
+	if (width > COLOR_RECIP_MAX)
+		width = COLOR_RECIP_MAX;
+
+	for (int i = 0; i < NLEDS; i++) {
+		int coord = axis ? led_geometry[i].y : led_geometry[i].x;
+		int level = falloff(coord - pos, width);
+		set_led(i, color_scale(r, level), color_scale(g, level), color_scale(b, level));
+	}
+}
+
+#define NUM_RIPPLES		4
+#define RIPPLE_SPEED	12
+#define RIPPLE_WIDTH	32
+// after this many ticks a new ripple may be launched
+#define RIPPLE_HOLDOFF	3
+#define RIPPLE_LOUD		160
+
+struct ripple {
+	// < 0 --> not active
+	int radius;
+	int hue;
+	int value;
+};
+
+void effect_sound_ripples(int sound_level) {
+	static struct ripple ripples[NUM_RIPPLES] = {
+		{ .radius = -1 }, { .radius = -1 }, { .radius = -1 }, { .radius = -1 },
+	};
+	static int holdoff;
+
+	for (int j = 0; j < NUM_RIPPLES; j++) {
+		if (ripples[j].radius >= 0) {
+			ripples[j].radius += RIPPLE_SPEED;
+			if (ripples[j].radius > 255 + RIPPLE_WIDTH)
+				ripples[j].radius = -1;
+		}
+	}
+
+	if (holdoff)
+		holdoff--;
+
+	if (!holdoff && sound_level >= RIPPLE_LOUD) {
+		for (int j = 0; j < NUM_RIPPLES; j++) {
+			if (ripples[j].radius < 0) {
+				ripples[j].radius = 0;
+				ripples[j].hue = sys_rand32_get() % COLOR_HUE_STEPS;
+				ripples[j].value = sound_level;
+				holdoff = RIPPLE_HOLDOFF;
+				break;
+			}
+		}
+	}
+
+	const uint8_t *dist = led_dist[LED_ORIGIN_MOUTH];
+
+	for (int i = 0; i < NLEDS; i++) {
+		// the brightest ripple going over this LED wins
+		int best_v = 0;
+		int best_hue = 0;
+		for (int j = 0; j < NUM_RIPPLES; j++) {
+			if (ripples[j].radius < 0)
+				continue;
+			int v = color_scale(ripples[j].value, falloff(dist[i] - ripples[j].radius, RIPPLE_WIDTH));
+			if (v > best_v) {
+				best_v = v;
+				best_hue = ripples[j].hue;
+			}
+		}
+
+		int r, g, b;
+		color_hue_to_rgb(best_hue, best_v, &r, &g, &b);
+		set_led(i, r, g, b);
+	}
+}
@@ -0,0 +1,42 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "misc.h"
+
+// Where the badge's own LEDs are, generated from the PCB by gen_led_geometry.py
+// x/y are in [0, 255] with y growing downwards
+struct led_geometry {
+	uint8_t x;
+	uint8_t y;
+};
+
+enum led_origin {
+	LED_ORIGIN_CENTER,
+	LED_ORIGIN_MOUTH,
+	LED_ORIGIN_EYES,
+	LED_NUM_ORIGINS,
+};
+
+#define LED_BOTTOM_ROW_LEN 5
+
+extern const struct led_geometry led_geometry[NLEDS];
+extern const uint8_t led_dist[LED_NUM_ORIGINS][NLEDS];
+extern const uint8_t led_bottom_row[LED_BOTTOM_ROW_LEN];
+
+// Spatial effects on the badge's own LEDs (any chained LEDs are left alone)
+// These cost a table lookup per LED, there is no trigonometry at runtime
+
+// Bands of color moving away from the origin, one every 64 units
+// phase is in the same units as the distances
+void effect_ripple(enum led_origin origin, int phase, int r, int g, int b);
+
+// A bar across the axis (0 = x, 1 = y) centered on pos, fading out over width
+void effect_sweep(int axis, int pos, int width, int r, int g, int b);
+
+// Rings launched from the mouth by loud sounds, call once per tick
+// sound_level is from sound_get_level()
+void effect_sound_ripples(int sound_level);
@@ -0,0 +1,313 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <zephyr.h>
+#include <storage/flash_map.h>
+#include <string.h>
+
+#include "enclog.h"
+
+// Records are queued in RAM and written out this many at a time
+#define ENCLOG_BATCH		32
+// Queued records are written out at the latest this long after the first one (in ms)
+#define ENCLOG_FLUSH_INTERVAL	(10 * 60 * 1000)
+// Flash writes are made in aligned pieces of this size (or less at the end of a flush),
+// so a flush of a full batch costs one or two writes
+#define ENCLOG_CHUNK		256
+// Flushes run on a work queue of their own at a low priority, since starting a new
+// page erases it (~85 ms) and enclog_add() is called from the system workqueue
+#define ENCLOG_STACK_SIZE	1024
+#define ENCLOG_PRIORITY		14
+
+BUILD_ASSERT(ENCLOG_PAGE_SIZE % ENCLOG_CHUNK == 0, "chunks must not cross pages");
+BUILD_ASSERT(ENCLOG_CHUNK % ENCLOG_RECORD_LEN == 0, "records must not cross chunks");
+
+struct enclog_entry {
+	uint32_t last_seen_s;
+	uint32_t hash;
+	uint16_t duration_s;
+	uint8_t type;
+	int8_t rssi;
+};
+
+static const struct flash_area *fa;
+static int num_pages;
+
+K_THREAD_STACK_DEFINE(enclog_stack, ENCLOG_STACK_SIZE);
+static struct k_work_q enclog_work_q;
+
+// Records waiting for the next flush, enclog_add() only ever takes queue_lock
+static struct k_spinlock queue_lock;
+static struct enclog_entry queue[ENCLOG_BATCH];
+static int num_queued;
+// if the flush fell behind and the queue was full
+static uint32_t num_dropped;
+
+// All of the below is protected by enclog_lock
+K_MUTEX_DEFINE(enclog_lock);
+// what the flush took out of the queue
+static struct enclog_entry batch[ENCLOG_BATCH];
+
+// page being written, its sequence number, and where the next record goes in it
+static int cur_page;
+static uint32_t cur_seq;
+static uint32_t write_off;
+static uint16_t boot;
+// time of the last record written, for the deltas, and if it's valid for this boot yet
+static uint32_t last_time_s;
+static int time_valid;
+
+// records not written to flash yet, they end at write_off
+static uint8_t chunk[ENCLOG_CHUNK];
+static uint32_t chunk_len;
+
+static uint32_t addr_hash(const uint8_t *addr) {
+	// FNV-1a, folded to 24 bits
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < PEER_ADDR_LEN; i++)
+		h = (h ^ addr[i]) * 16777619u;
+	return (h ^ (h >> 24)) & 0xffffff;
+}
+
+// Exact up to a minute and within 3% up to ~2 hours
+static uint8_t duration_encode(uint32_t duration_s) {
+	uint32_t u = duration_s / 2;
+	if (u < 32)
+		return u;
+	for (int e = 1; e < 8; e++) {
+		if ((u >> (e - 1)) < 64)
+			return (e << 5) | ((u >> (e - 1)) - 32);
+	}
+	return 0xff;
+}
+
+static void write_chunk() {
+	if (!chunk_len)
+		return;
+	int ret = flash_area_write(fa, cur_page * ENCLOG_PAGE_SIZE + write_off - chunk_len, chunk, chunk_len);
+	if (ret)
+		printk("Encounter log write failed: %d\n", ret);
+	chunk_len = 0;
+}
+
+static void emit(const uint8_t *rec);
+
+static void emit_time(uint32_t time_s) {
+	uint8_t rec[ENCLOG_RECORD_LEN] = {
+		ENCLOG_KIND_TIME, boot, boot >> 8,
+		time_s, time_s >> 8, time_s >> 16, time_s >> 24, 0xff,
+	};
+	last_time_s = time_s;
+	emit(rec);
+}
+
+// Erases the oldest page and starts writing there
+static void new_page() {
+	cur_page = (cur_page + 1) % num_pages;
+	cur_seq++;
+	write_off = 0;
+	int ret = flash_area_erase(fa, cur_page * ENCLOG_PAGE_SIZE, ENCLOG_PAGE_SIZE);
+	if (ret)
+		printk("Encounter log erase failed: %d\n", ret);
+
+	uint8_t rec[ENCLOG_RECORD_LEN] = {
+		ENCLOG_KIND_PAGE, cur_seq, cur_seq >> 8, cur_seq >> 16, cur_seq >> 24, 0xff, 0xff, 0xff,
+	};
+	emit(rec);
+	// so that the page can be decoded without the ones before it
+	if (time_valid)
+		emit_time(last_time_s);
+}
+
+static void emit(const uint8_t *rec) {
+	if (write_off == ENCLOG_PAGE_SIZE) {
+		write_chunk();
+		new_page();
+	}
+	memcpy(chunk + chunk_len, rec, ENCLOG_RECORD_LEN);
+	chunk_len += ENCLOG_RECORD_LEN;
+	write_off += ENCLOG_RECORD_LEN;
+	if (write_off % ENCLOG_CHUNK == 0)
+		write_chunk();
+}
+
+static void flush_locked() {
+	k_spinlock_key_t key = k_spin_lock(&queue_lock);
+	int n = num_queued;
+	uint32_t dropped = num_dropped;
+	memcpy(batch, queue, n * sizeof(*queue));
+	num_queued = 0;
+	num_dropped = 0;
+	k_spin_unlock(&queue_lock, key);
+	if (dropped)
+		printk("Encounter log dropped %u records\n", dropped);
+
+	for (int i = 0; i < n; i++) {
+		const struct enclog_entry *e = &batch[i];
+		int32_t delta = e->last_seen_s - last_time_s;
+		if (!time_valid || delta < INT16_MIN || delta > INT16_MAX) {
+			time_valid = 1;
+			emit_time(e->last_seen_s);
+			delta = 0;
+		}
+		uint8_t rec[ENCLOG_RECORD_LEN] = {
+			ENCLOG_KIND_ENCOUNTER | e->type, delta, delta >> 8,
+			e->hash, e->hash >> 8, e->hash >> 16,
+			duration_encode(e->duration_s), e->rssi,
+		};
+		// (if this starts a new page, its time record has to be the previous time)
+		emit(rec);
+		last_time_s = e->last_seen_s;
+	}
+	write_chunk();
+}
+
+static void enclog_flush_handler(struct k_work *work) {
+	k_mutex_lock(&enclog_lock, K_FOREVER);
+	flush_locked();
+	k_mutex_unlock(&enclog_lock);
+}
+
+K_WORK_DELAYABLE_DEFINE(enclog_flush_work, enclog_flush_handler);
+
+static uint32_t read_u32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int enclog_setup() {
+	// (before fa is set, enclog_add() may be called as soon as it is)
+	k_work_queue_init(&enclog_work_q);
+	k_work_queue_start(&enclog_work_q, enclog_stack, K_THREAD_STACK_SIZEOF(enclog_stack),
+		ENCLOG_PRIORITY, NULL);
+
+	int ret = flash_area_open(FLASH_AREA_ID(encounters), &fa);
+	if (ret)
+		return ret;
+	num_pages = fa->fa_size / ENCLOG_PAGE_SIZE;
+	// the first record of this boot needs a time record before it
+	time_valid = 0;
+
+	// find the newest page
+	int found = 0;
+	for (int i = 0; i < num_pages; i++) {
+		uint8_t rec[ENCLOG_RECORD_LEN];
+		if ((ret = flash_area_read(fa, i * ENCLOG_PAGE_SIZE, rec, sizeof(rec))))
+			return ret;
+		uint32_t seq = read_u32(rec + 1);
+		if (rec[0] == ENCLOG_KIND_PAGE && (!found || seq > cur_seq)) {
+			found = 1;
+			cur_page = i;
+			cur_seq = seq;
+		}
+	}
+
+	if (!found) {
+		// blank, the first record starts page 0
+		cur_page = num_pages - 1;
+		cur_seq = 0;
+		write_off = ENCLOG_PAGE_SIZE;
+		printk("Encounter log empty, %d pages\n", num_pages);
+		return 0;
+	}
+
+	// carry on after the last record in it, and count this boot
+	for (write_off = ENCLOG_RECORD_LEN; write_off < ENCLOG_PAGE_SIZE; write_off += ENCLOG_RECORD_LEN) {
+		uint8_t rec[ENCLOG_RECORD_LEN];
+		if ((ret = flash_area_read(fa, cur_page * ENCLOG_PAGE_SIZE + write_off, rec, sizeof(rec))))
+			return ret;
+		if (rec[0] == 0xff)
+			break;
+		if (rec[0] == ENCLOG_KIND_TIME)
+			boot = (rec[1] | (rec[2] << 8)) + 1;
+	}
+	printk("Encounter log at page %d (seq %u) offset %u, boot %u\n", cur_page, cur_seq, write_off, boot);
+	return 0;
+}
+
+void enclog_add(const struct peer_entry *e) {
+	if (!fa)
+		return;
+
+	k_spinlock_key_t key = k_spin_lock(&queue_lock);
+	if (num_queued == ENCLOG_BATCH) {
+		num_dropped++;
+		k_spin_unlock(&queue_lock, key);
+		return;
+	}
+	struct enclog_entry *q = &queue[num_queued++];
+	q->last_seen_s = e->last_seen / 1000;
+	q->hash = addr_hash(e->addr);
+	// (PEER_DURATION_MAX or more means at least that long, see peers.h)
+	uint32_t duration_s = (uint16_t)(q->last_seen_s - e->first_seen_s);
+	q->duration_s = duration_s >= PEER_DURATION_MAX ? UINT16_MAX : duration_s;
+	q->type = e->type;
+	q->rssi = e->rssi_max;
+	int full = num_queued == ENCLOG_BATCH;
+	k_spin_unlock(&queue_lock, key);
+
+	if (full)
+		k_work_reschedule_for_queue(&enclog_work_q, &enclog_flush_work, K_NO_WAIT);
+	else
+		// does nothing if a flush is already coming up
+		k_work_schedule_for_queue(&enclog_work_q, &enclog_flush_work, K_MSEC(ENCLOG_FLUSH_INTERVAL));
+}
+
+void enclog_flush() {
+	if (!fa)
+		return;
+	enclog_flush_handler(NULL);
+}
+
+// Length of the k-th page from the oldest one, 0 if it hasn't been written yet
+static uint32_t page_len_locked(int k) {
+	if (k == num_pages - 1)
+		return write_off == ENCLOG_PAGE_SIZE && !cur_seq ? 0 : write_off;
+
+	uint8_t rec[ENCLOG_RECORD_LEN];
+	int page = (cur_page + 1 + k) % num_pages;
+	if (flash_area_read(fa, page * ENCLOG_PAGE_SIZE, rec, sizeof(rec)))
+		return 0;
+	// full, but only if it's from before the current one (and not an old one left over)
+	if (rec[0] != ENCLOG_KIND_PAGE || read_u32(rec + 1) != cur_seq - (num_pages - 1 - k))
+		return 0;
+	return ENCLOG_PAGE_SIZE;
+}
+
+uint32_t enclog_size() {
+	if (!fa)
+		return 0;
+
+	uint32_t size = 0;
+	k_mutex_lock(&enclog_lock, K_FOREVER);
+	for (int k = 0; k < num_pages; k++)
+		size += page_len_locked(k);
+	k_mutex_unlock(&enclog_lock);
+	return size;
+}
+
+uint32_t enclog_export(void (*write)(const uint8_t *data, uint32_t len), uint32_t max_len) {
+	if (!fa)
+		return 0;
+
+	uint32_t sent = 0;
+	for (int k = 0; k < num_pages && sent < max_len; k++) {
+		k_mutex_lock(&enclog_lock, K_FOREVER);
+		int page = (cur_page + 1 + k) % num_pages;
+		uint32_t len = page_len_locked(k);
+		k_mutex_unlock(&enclog_lock);
+
+		// a chunk at a time, so that flushes aren't held up by the USB side
+		for (uint32_t off = 0; off < len && sent < max_len; off += ENCLOG_CHUNK) {
+			uint8_t buf[ENCLOG_CHUNK];
+			uint32_t n = MIN(MIN(len - off, ENCLOG_CHUNK), max_len - sent);
+			k_mutex_lock(&enclog_lock, K_FOREVER);
+			int ret = flash_area_read(fa, page * ENCLOG_PAGE_SIZE + off, buf, n);
+			k_mutex_unlock(&enclog_lock);
+			if (ret)
+				return sent;
+			write(buf, n);
+			sent += n;
+		}
+	}
+	return sent;
+}
@@ -0,0 +1,42 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "peers.h"
+
+// Append-only log of encounters (everyone who drops out of the peer table) in its own
+// flash partition, used as a ring of 4 KB pages
+// Every record is 8 bytes, first byte is the kind in the top 4 bits (0xFF = erased):
+//  page	0x10, 4-byte sequence number (LE), 3 bytes unused
+//		first record of every page, the page with the highest one is the newest
+//  time	0x20, 2-byte boot count, 4-byte seconds since boot, 1 byte unused
+//		sets the time base, at the start of every page, after boot and after big gaps
+//  encounter	0x30 | enum peer_type, 2-byte signed seconds from the previous record's time
+//		to when it was last seen, 3-byte hash of the address, duration, strongest RSSI in dBm
+//		duration is in 2 s units as a tiny float, exponent e in the top 3 bits and
+//		mantissa m in the bottom 5: e ? (32 + m) << (e - 1) : m
+// See enclog.py for a decoder
+#define ENCLOG_PAGE_SIZE	0x1000
+#define ENCLOG_RECORD_LEN	8
+
+#define ENCLOG_KIND_PAGE	0x10
+#define ENCLOG_KIND_TIME	0x20
+#define ENCLOG_KIND_ENCOUNTER	0x30
+
+int enclog_setup();
+
+// Queues a record for e, only from the system workqueue, never waits for flash
+// Records are written out from a work queue of enclog's own, a batch at a time or
+// 10 minutes after the first one
+void enclog_add(const struct peer_entry *e);
+
+// Writes out everything queued right away (blocks for the flash)
+void enclog_flush();
+// Total bytes enclog_export() would send
+uint32_t enclog_size();
+// Streams the log through write, oldest page first, up to max_len bytes
+// Returns the number of bytes written, which may be less if the log wrapped in the meantime
+uint32_t enclog_export(void (*write)(const uint8_t *data, uint32_t len), uint32_t max_len);
@@ -0,0 +1,102 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Pulls the encounter log (see enclog.h) off a badge with the "log dump" console command
+# and prints it as CSV, one encounter per line
+# python3 enclog.py /dev/ttyACM0 [-o raw.bin]
+# python3 enclog.py -f raw.bin
+
+import argparse
+import os
+import struct
+import sys
+import termios
+import tty
+
+RECORD_LEN = 8
+KIND_PAGE = 0x10
+KIND_TIME = 0x20
+KIND_ENCOUNTER = 0x30
+
+PEER_TYPES = {1: 'no_appearance', 2: 'badge', 3: 'easteregg', 4: 'spoofed'}
+
+def duration_decode(code):
+	e, m = code >> 5, code & 0x1f
+	return 2 * ((32 + m) << (e - 1) if e else m)
+
+def decode(data):
+	boot = None
+	time_s = None
+	seq = None
+	for off in range(0, len(data) - RECORD_LEN + 1, RECORD_LEN):
+		rec = data[off:off + RECORD_LEN]
+		kind = rec[0] & 0xf0
+		if rec[0] == 0xff:
+			continue
+		if kind == KIND_PAGE:
+			page_seq = struct.unpack_from('<I', rec, 1)[0]
+			if seq is not None and page_seq != seq + 1:
+				print(f"# pages {seq + 1}-{page_seq - 1} missing", file=sys.stderr)
+			seq = page_seq
+			# the page's time record comes next
+			time_s = None
+		elif kind == KIND_TIME:
+			boot, time_s = struct.unpack_from('<HI', rec, 1)
+		elif kind == KIND_ENCOUNTER:
+			if time_s is None:
+				continue
+			delta, hash_lo, hash_hi, duration, rssi = struct.unpack_from('<hHBBb', rec, 1)
+			time_s += delta
+			yield boot, time_s, duration_decode(duration), hash_lo | (hash_hi << 16), PEER_TYPES.get(rec[0] & 0x0f, '?'), rssi
+
+def read_exactly(fd, n):
+	buf = b''
+	while len(buf) < n:
+		chunk = os.read(fd, n - len(buf))
+		if not chunk:
+			raise EOFError
+		buf += chunk
+	return buf
+
+def dump(port):
+	fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+	try:
+		tty.setraw(fd)
+		termios.tcflush(fd, termios.TCIFLUSH)
+		os.write(fd, b'log dump\r')
+		# skip the echo, up to the header line
+		line = b''
+		while not line.startswith(b'ENCLOG '):
+			line = b''
+			while not line.endswith(b'\n'):
+				line += read_exactly(fd, 1)
+			line = line.strip()
+		size = int(line.split()[1])
+		return read_exactly(fd, size)
+	finally:
+		os.close(fd)
+
+parser = argparse.ArgumentParser()
+parser.add_argument('port', nargs='?', help='badge USB serial port')
+parser.add_argument('-f', '--file', help='decode a raw dump saved with -o instead')
+parser.add_argument('-o', '--output', help='also save the raw dump')
+args = parser.parse_args()
+
+if args.file:
+	with open(args.file, 'rb') as f:
+		data = f.read()
+elif args.port:
+	data = dump(args.port)
+else:
+	parser.error('need a port or -f')
+
+if args.output:
+	with open(args.output, 'wb') as f:
+		f.write(data)
+
+print('boot,last_seen_s,duration_s,addr_hash,type,rssi_max')
+count = 0
+for boot, time_s, duration, addr_hash, peer_type, rssi in decode(data):
+	print(f'{boot},{time_s},{duration},{addr_hash:06x},{peer_type},{rssi}')
+	count += 1
+print(f"# {count} encounters in {len(data)} bytes", file=sys.stderr)
@@ -0,0 +1,43 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Accuracy vs. memory of hll.c on random BLE addresses, builds it with the system compiler
+# python3 eval_hll.py
+
+import ctypes
+import math
+import os
+import random
+import subprocess
+import tempfile
+
+PS = [4, 6, 8, 10, 12]
+COUNTS = [10, 100, 1000, 10000]
+TRIALS = 20
+
+src = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'hll.c')
+tmpdir = tempfile.mkdtemp()
+
+random.seed(1)
+
+print("    p  bytes    count  mean err  rms err  (theory 1.04/sqrt(m))")
+for p in PS:
+	lib_file = os.path.join(tmpdir, f'hll{p}.so')
+	subprocess.check_call(['cc', '-O2', '-shared', '-fPIC', f'-DHLL_P={p}', '-o', lib_file, src, '-lm'])
+	lib = ctypes.CDLL(lib_file)
+	lib.hll_add.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int]
+	lib.hll_estimate.argtypes = [ctypes.c_void_p]
+	sketch = ctypes.create_string_buffer(1 << p)
+
+	for count in COUNTS:
+		errs = []
+		for _ in range(TRIALS):
+			lib.hll_init(sketch)
+			for _ in range(count):
+				# random static address, same layout as bt_addr_le_t
+				addr = bytes([1]) + random.randbytes(6)
+				lib.hll_add(sketch, addr, len(addr))
+			errs.append(lib.hll_estimate(sketch) / count - 1)
+		mean = sum(errs) / len(errs)
+		rms = math.sqrt(sum(e * e for e in errs) / len(errs))
+		print(f"{p:5} {1 << p:6} {count:8} {mean * 100:8.1f}% {rms * 100:7.1f}%  ({104 / math.sqrt(1 << p):.1f}%)")
@@ -0,0 +1,364 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr.h>
+
+#include "factory.h"
+#include "misc.h"
+#include "nvs.h"
+#include "sound.h"
+
+// The stages run on the main loop, which owns the LEDs, eyes and mic; the USB
+// thread asks for one and waits for the result here
+
+static const char *const stage_names[FACTORY_NUM_STAGES] = {
+	[FACTORY_STAGE_NONE] = "none",
+	[FACTORY_STAGE_LEDS] = "leds",
+	[FACTORY_STAGE_EYES] = "eyes",
+	[FACTORY_STAGE_BUTTONS] = "buttons",
+	[FACTORY_STAGE_MIC] = "mic",
+	[FACTORY_STAGE_COMPLETE] = "complete",
+};
+
+// all of these have to pass before "complete" does
+#define REQUIRED_STAGES	((1 << FACTORY_STAGE_LEDS) | (1 << FACTORY_STAGE_EYES) | \
+	(1 << FACTORY_STAGE_BUTTONS) | (1 << FACTORY_STAGE_MIC))
+
+// 1 while the main loop is in factory mode and calling factory_poll()
+static atomic_t polling;
+// stage in the low byte, the request's number above it, so that a result that
+// comes in after its request timed out isn't taken for the next one's
+static atomic_t requested;
+static atomic_t next_request;
+static int request_arg;
+
+K_MUTEX_DEFINE(factory_run_lock);
+K_SEM_DEFINE(factory_done_sem, 0, 1);
+static atomic_t result_for;
+static int result_passed;
+static char result[FACTORY_RESULT_MAX];
+
+enum factory_stage factory_stage_from_name(const char *name) {
+	for (int i = FACTORY_STAGE_NONE + 1; i < FACTORY_NUM_STAGES; i++)
+		if (!strcmp(name, stage_names[i]))
+			return i;
+	return FACTORY_STAGE_NONE;
+}
+
+// "23.4" from 234
+static void format_tenths(char *out, int out_len, int tenths) {
+	snprintf(out, out_len, "%s%d.%d", tenths < 0 ? "-" : "", abs(tenths) / 10, abs(tenths) % 10);
+}
+
+static void format_stages(char *out, int out_len, uint32_t mask) {
+	int n = snprintf(out, out_len, "%s", mask ? "" : "none");
+	for (int i = FACTORY_STAGE_NONE + 1; i < FACTORY_NUM_STAGES && n < out_len; i++)
+		if (mask & (1 << i))
+			n += snprintf(out + n, out_len - n, "%s%s", n ? "," : "", stage_names[i]);
+}
+
+// SW1..SW4 as 1/0
+static void format_buttons(char *out, int mask) {
+	for (int b = 0; b < 4; b++)
+		out[b] = mask & (0b1000 >> b) ? '1' : '0';
+	out[4] = 0;
+}
+
+static int run_leds(char *out, int out_len) {
+	// so that every frame counted is one of this stage's (the refresh thread
+	// could otherwise still be resending the frame from before)
+	int dither = get_led_dither();
+	set_led_dither(0);
+
+	struct led_stats stats;
+	// (only count from here)
+	get_led_stats(&stats);
+
+	// the same chaser as factory_before_sw1, just faster
+	for (int step = 0; step < FACTORY_LED_ROUNDS * NLEDS; step++) {
+		int idx = step % NLEDS;
+		for (int i = 0; i < NLEDS; i++) {
+			if (i == idx)
+				set_led(i, 255, 0, 0);
+			else if (i == (idx + 1) % NLEDS)
+				set_led(i, 0, 255, 0);
+			else if (i == (idx + 2) % NLEDS)
+				set_led(i, 0, 0, 255);
+			else
+				set_led(i, 0, 0, 0);
+		}
+		update_leds();
+		k_msleep(FACTORY_LED_STEP_MS);
+	}
+
+	// and everything at once, which is what shows up a weak supply
+	for (int i = 0; i < NLEDS; i++)
+		set_led(i, 255, 255, 255);
+	update_leds();
+	k_msleep(FACTORY_EYE_STEP_MS);
+
+	get_led_stats(&stats);
+	set_led_dither(dither);
+	snprintf(out, out_len, "frames=%u errors=%u frame_us=%u", stats.frames, stats.errors,
+		stats.frames ? (uint32_t)k_cyc_to_us_floor64(stats.frame_cycles / stats.frames) : 0);
+
+	return stats.frames == FACTORY_LED_ROUNDS * NLEDS + 1 && !stats.errors;
+}
+
+static int run_eyes(char *out, int out_len) {
+	static const uint16_t colors[][3] = {
+		{ EYE_MAX_VAL - 1, 0, 0 },
+		{ 0, EYE_MAX_VAL - 1, 0 },
+		{ 0, 0, EYE_MAX_VAL - 1 },
+		{ EYE_MAX_VAL - 1, EYE_MAX_VAL - 1, EYE_MAX_VAL - 1 },
+	};
+
+	int stopped = 0;
+	for (int i = 0; i < ARRAY_SIZE(colors); i++) {
+		set_left_eye(colors[i][0], colors[i][1], colors[i][2]);
+		set_right_eye(colors[i][0], colors[i][1], colors[i][2]);
+		k_msleep(FACTORY_EYE_STEP_MS);
+		stopped |= ~eyes_running() & 3;
+	}
+	set_left_eye(0, 0, 0);
+	set_right_eye(0, 0, 0);
+
+	snprintf(out, out_len, "stopped=%d", stopped);
+	return !stopped;
+}
+
+static int run_buttons(int timeout_ms, char *out, int out_len) {
+	if (timeout_ms <= 0)
+		timeout_ms = FACTORY_BUTTONS_TIMEOUT_MS;
+
+	for (int i = 0; i < NLEDS; i++)
+		set_led(i, 0, 0, 0);
+	update_leds();
+
+	// polled much faster than the main loop, so that bounces show up
+	int stuck = read_all_buttons();
+	int last = stuck;
+	int pressed = 0;
+	int edges[4] = { 0 };
+	int first_ms[4] = { -1, -1, -1, -1 };
+	int64_t start = k_uptime_get();
+	int64_t elapsed;
+
+	while ((elapsed = k_uptime_get() - start) < timeout_ms) {
+		int now = read_all_buttons();
+		int down = now & ~last;
+		last = now;
+
+		for (int b = 0; b < 4; b++) {
+			if (!(down & (0b1000 >> b)))
+				continue;
+			edges[b]++;
+			if (first_ms[b] < 0) {
+				first_ms[b] = elapsed;
+				// an LED per button, for whoever's pressing them
+				set_led(b, 0, 255, 0);
+				update_leds();
+			}
+			pressed |= 0b1000 >> b;
+		}
+
+		// and all let go again
+		if (pressed == 0b1111 && !now)
+			break;
+		k_msleep(FACTORY_BUTTONS_POLL_MS);
+	}
+
+	char pressed_str[5], stuck_str[5];
+	format_buttons(pressed_str, pressed);
+	format_buttons(stuck_str, stuck);
+	snprintf(out, out_len, "pressed=%s stuck=%s edges=%d,%d,%d,%d ms=%d,%d,%d,%d",
+		pressed_str, stuck_str, edges[0], edges[1], edges[2], edges[3],
+		first_ms[0], first_ms[1], first_ms[2], first_ms[3]);
+	return pressed == 0b1111;
+}
+
+static int run_mic(struct factory_results *results, char *out, int out_len) {
+	int ret = start_sound();
+	if (ret) {
+		snprintf(out, out_len, "reason=start_failed err=%d", ret);
+		return 0;
+	}
+
+	float tone = 0, noise = 0, dc = 0;
+	// (the skipped blocks also cover any that queued up while nothing was reading them)
+	for (int i = 0; i < FACTORY_MIC_SKIP_BLOCKS + FACTORY_MIC_BLOCKS; i++) {
+		struct sound_tone m;
+		if ((ret = sound_measure_tone(&m))) {
+			snprintf(out, out_len, "reason=read_failed err=%d", ret);
+			return 0;
+		}
+		if (i < FACTORY_MIC_SKIP_BLOCKS)
+			continue;
+		tone += m.tone;
+		noise += m.noise;
+		if (m.dc > dc)
+			dc = m.dc;
+	}
+
+	int snr;
+	if (!tone)
+		snr = -999;
+	else if (!noise)
+		snr = 999;
+	else
+		snr = lroundf(100 * log10f(tone / noise));
+	results->mic_snr = snr;
+
+	char snr_str[16];
+	format_tenths(snr_str, sizeof(snr_str), snr);
+	snprintf(out, out_len, "snr_db=%s tone=%u noise=%u dc=%u", snr_str,
+		(uint32_t)(tone / FACTORY_MIC_BLOCKS), (uint32_t)(noise / FACTORY_MIC_BLOCKS), (uint32_t)dc);
+	return snr >= FACTORY_MIC_MIN_SNR && dc < FACTORY_MIC_MAX_DC;
+}
+
+static int run_complete(const struct factory_results *results, char *out, int out_len) {
+	uint32_t missing = REQUIRED_STAGES & ~results->passed;
+	if (missing) {
+		char names[64];
+		format_stages(names, sizeof(names), missing);
+		snprintf(out, out_len, "missing=%s", names);
+		return 0;
+	}
+
+	// game_loop() needs the mic going
+	int ret = start_sound();
+	if (ret) {
+		snprintf(out, out_len, "reason=start_failed err=%d", ret);
+		return 0;
+	}
+
+	nvs_set_factory(factory_completed);
+	// main.c goes on to game_loop() from here
+	atomic_set(&polling, 0);
+	snprintf(out, out_len, "passed=all");
+	return 1;
+}
+
+int factory_poll() {
+	atomic_set(&polling, 1);
+
+	atomic_val_t request = atomic_set(&requested, 0);
+	enum factory_stage stage = request & 0xff;
+	if (stage == FACTORY_STAGE_NONE)
+		return 0;
+
+	struct factory_results results;
+	nvs_get_factory_results(&results);
+
+	char detail[FACTORY_RESULT_MAX - 32];
+	int passed = 0;
+	switch (stage) {
+		case FACTORY_STAGE_LEDS:
+			passed = run_leds(detail, sizeof(detail));
+			break;
+		case FACTORY_STAGE_EYES:
+			passed = run_eyes(detail, sizeof(detail));
+			break;
+		case FACTORY_STAGE_BUTTONS:
+			passed = run_buttons(request_arg, detail, sizeof(detail));
+			break;
+		case FACTORY_STAGE_MIC:
+			passed = run_mic(&results, detail, sizeof(detail));
+			break;
+		case FACTORY_STAGE_COMPLETE:
+			passed = run_complete(&results, detail, sizeof(detail));
+			break;
+		default:
+			snprintf(detail, sizeof(detail), "reason=unknown_stage");
+			break;
+	}
+
+	// a stage that fails on a retest doesn't count any more
+	if (passed)
+		results.passed |= 1 << stage;
+	else
+		results.passed &= ~(1 << stage);
+	nvs_set_factory_results(&results);
+
+	snprintf(result, sizeof(result), "FACTORY %s %s %s", stage_names[stage],
+		passed ? "PASS" : "FAIL", detail);
+	printk("%s\n", result);
+
+	result_passed = passed;
+	atomic_set(&result_for, request);
+	k_sem_give(&factory_done_sem);
+	return 1;
+}
+
+static int stage_timeout_ms(enum factory_stage stage, int arg) {
+	// on top of the stage itself: the main loop finishing whatever it's in the
+	// middle of, and the mic start
+	const int margin_ms = 5000;
+
+	switch (stage) {
+		case FACTORY_STAGE_LEDS:
+			return FACTORY_LED_ROUNDS * NLEDS * FACTORY_LED_STEP_MS + FACTORY_EYE_STEP_MS + margin_ms;
+		case FACTORY_STAGE_EYES:
+			return 4 * FACTORY_EYE_STEP_MS + margin_ms;
+		case FACTORY_STAGE_BUTTONS:
+			return (arg > 0 ? arg : FACTORY_BUTTONS_TIMEOUT_MS) + margin_ms;
+		default:
+			return margin_ms;
+	}
+}
+
+int factory_run(enum factory_stage stage, int arg, char *out, int out_len) {
+	const char *name = stage_names[stage];
+
+	k_mutex_lock(&factory_run_lock, K_FOREVER);
+
+	if (!atomic_get(&polling)) {
+		snprintf(out, out_len, "FACTORY %s FAIL reason=not_in_factory_mode", name);
+		k_mutex_unlock(&factory_run_lock);
+		return 1;
+	}
+
+	atomic_val_t request = stage | (atomic_inc(&next_request) << 8);
+	request_arg = arg;
+	k_sem_reset(&factory_done_sem);
+	atomic_set(&requested, request);
+
+	int64_t deadline = k_uptime_get() + stage_timeout_ms(stage, arg);
+	int ret = 1;
+	while (1) {
+		int64_t left = deadline - k_uptime_get();
+		if (left <= 0 || k_sem_take(&factory_done_sem, K_MSEC(left))) {
+			// (unless the main loop has just taken it)
+			atomic_cas(&requested, request, 0);
+			snprintf(out, out_len, "FACTORY %s FAIL reason=timeout", name);
+			break;
+		}
+		if (atomic_get(&result_for) == request) {
+			snprintf(out, out_len, "%s", result);
+			ret = !result_passed;
+			break;
+		}
+	}
+
+	k_mutex_unlock(&factory_run_lock);
+	return ret;
+}
+
+void factory_status(char *out, int out_len) {
+	struct factory_results results;
+	nvs_get_factory_results(&results);
+
+	char passed[64], snr[16];
+	format_stages(passed, sizeof(passed), results.passed);
+	format_tenths(snr, sizeof(snr), results.mic_snr);
+	snprintf(out, out_len, "FACTORY status mode=%d passed=%s snr_db=%s", nvs_get_factory(), passed, snr);
+}
+
+void factory_reset() {
+	struct factory_results results = { 0 };
+	nvs_set_factory_results(&results);
+}
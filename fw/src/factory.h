@@ -0,0 +1,65 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+// Production test driven over USB, one stage at a time as the host asks for it
+// ("factory run <stage>" on the console, see factory_jig.py), instead of the
+// buttons stepping through the factory modes in main.c. Each stage ends with
+// one line of results:
+//  FACTORY <stage> PASS|FAIL key=value ...
+// The stages that passed are kept in NVS (see nvs.h), and once they all have,
+// "complete" takes the badge out of factory mode.
+enum factory_stage {
+	FACTORY_STAGE_NONE,
+	// R/G/B chaser around the ring, then all white
+	//  frames=<sent> errors=<SPI errors> frame_us=<time to send one>
+	FACTORY_STAGE_LEDS,
+	// both eyes red, green, blue then white
+	//  stopped=<eyes whose PWM wasn't running, 1 left, 2 right>
+	FACTORY_STAGE_EYES,
+	// waits for all four buttons to be pressed, in any order, for up to the
+	// argument in ms (FACTORY_BUTTONS_TIMEOUT_MS by default), lighting an LED for each
+	//  pressed=<SW1..SW4 as 1/0> stuck=<held from the start> edges=<presses seen,
+	//  more than 1 is a bouncy switch> ms=<time to the first press>
+	FACTORY_STAGE_BUTTONS,
+	// measures a 440 Hz tone played to the mic (see sound_measure_tone())
+	//  snr_db=<tone over noise> tone=<power> noise=<power> dc=<highest DC power>
+	FACTORY_STAGE_MIC,
+	// records that the badge passed in NVS, and leaves factory mode
+	//  missing=<stages that haven't passed>
+	FACTORY_STAGE_COMPLETE,
+	FACTORY_NUM_STAGES,
+};
+
+#define FACTORY_LED_ROUNDS			2
+#define FACTORY_LED_STEP_MS			40
+#define FACTORY_EYE_STEP_MS			250
+#define FACTORY_BUTTONS_TIMEOUT_MS	20000
+#define FACTORY_BUTTONS_POLL_MS		5
+// the first blocks after the mic starts can be garbage
+#define FACTORY_MIC_SKIP_BLOCKS		4
+#define FACTORY_MIC_BLOCKS			8
+// in 0.1 dB
+#define FACTORY_MIC_MIN_SNR			200
+#define FACTORY_MIC_MAX_DC			25
+// longest a result line gets
+#define FACTORY_RESULT_MAX			128
+
+// FACTORY_STAGE_NONE if there's no stage with that name
+enum factory_stage factory_stage_from_name(const char *name);
+
+// Has the main loop run the stage and writes its result line into out.
+// Called from the USB thread, and blocks until the stage is over.
+// Returns 0 if it passed
+int factory_run(enum factory_stage stage, int arg, char *out, int out_len);
+
+// The stored results as a line, "FACTORY status mode=<factory mode> passed=... snr_db=..."
+void factory_status(char *out, int out_len);
+
+// Forgets the stored results (when going back into factory mode)
+void factory_reset();
+
+// Called by the main loop on each pass while in factory mode, runs the stage
+// the host asked for if there's one. Returns 1 if it did
+int factory_poll();
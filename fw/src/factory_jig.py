@@ -0,0 +1,185 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Runs the production test (see factory.h) on every badge plugged into this computer
+# at once, over the binary protocol (see badge_rpc.py). Each stage runs on all the
+# badges together, so one pass of pressing buttons and one 440 Hz tone covers a whole
+# hub of them. Badges that fail a stage are left out of the rest, and only the ones
+# that pass everything are taken out of factory mode.
+# Prints a table at the end, and can append each stage's results as JSON lines.
+# python3 factory_jig.py [-o factory.jsonl] [--ports '/dev/ttyACM*'] [--confirm]
+#   [--tone-cmd 'play -qn synth 3 sine 440'] [--no-complete]
+
+import argparse
+import concurrent.futures
+import glob
+import json
+import os
+import subprocess
+import sys
+import time
+
+from badge_rpc import BadgeRPC
+from fleet import discover
+
+STAGES = ['leds', 'eyes', 'buttons', 'mic', 'complete']
+# what the operator checks by eye with --confirm
+VISUAL = {
+	'leds': 'showed the R/G/B chaser all the way around and then all white',
+	'eyes': 'had both eyes go red, green, blue and white',
+}
+# on top of the stage itself (see stage_timeout_ms() in factory.c)
+TIMEOUT_S = 10
+
+def parse_result(text):
+	# "FACTORY <stage> PASS|FAIL key=value ..." -> (passed, {key: value})
+	for line in text.splitlines():
+		words = line.split()
+		if len(words) >= 3 and words[0] == 'FACTORY':
+			return words[2] == 'PASS', dict(w.split('=', 1) for w in words[3:] if '=' in w)
+	return False, {'reason': 'no_result', 'output': text.strip()}
+
+class Board:
+	def __init__(self, n, port, name):
+		self.n = n
+		self.port = port
+		self.name = name
+		self.badge = None
+		# stage -> (passed, fields)
+		self.results = {}
+		self.failed = None
+
+	def open(self):
+		try:
+			self.badge = BadgeRPC(self.port)
+			mode = self.badge.get('factory')
+			# (5 is factory_completed, see nvs.h)
+			if mode == 5:
+				self.failed = 'not in factory mode'
+		except (OSError, TimeoutError, RuntimeError) as e:
+			self.failed = f'no answer ({e or type(e).__name__})'
+
+	def run(self, stage, buttons_ms):
+		line = f'factory run {stage}'
+		timeout = TIMEOUT_S
+		if stage == 'buttons':
+			line += f' {buttons_ms}'
+			timeout += buttons_ms / 1000
+		try:
+			passed, fields = parse_result(self.badge.command(line, timeout=timeout))
+		except (OSError, TimeoutError, RuntimeError) as e:
+			passed, fields = False, {'reason': f'no answer ({e or type(e).__name__})'}
+		self.results[stage] = (passed, fields)
+		if not passed:
+			self.failed = stage
+		return passed, fields
+
+	def close(self):
+		if self.badge:
+			try:
+				self.badge.close()
+			except OSError:
+				pass
+
+def ask_failed(boards, stage):
+	# the operator's list of boards that didn't look right
+	answer = input(f'Numbers of the badges that NOT {VISUAL[stage]} (blank if they all did): ')
+	bad = {int(n) for n in answer.replace(',', ' ').split() if n.isdigit()}
+	for board in boards:
+		if board.n in bad and board.results[stage][0]:
+			board.results[stage] = (False, {'reason': 'operator'})
+			board.failed = stage
+
+def summary(boards):
+	print()
+	print(f"{'#':>3} {'port':16} {'badge':20} " + ' '.join(f'{s:8}' for s in STAGES) + ' details')
+	for board in boards:
+		cols = []
+		for stage in STAGES:
+			if stage in board.results:
+				cols.append('PASS' if board.results[stage][0] else 'FAIL')
+			else:
+				cols.append('-')
+		details = ''
+		if board.failed in board.results:
+			fields = board.results[board.failed][1]
+			details = f'{board.failed}: ' + ' '.join(f'{k}={v}' for k, v in fields.items())
+		elif board.failed:
+			details = board.failed
+		elif 'mic' in board.results:
+			details = f"snr {board.results['mic'][1].get('snr_db')} dB"
+		print(f'{board.n:3} {board.port:16} {board.name:20} ' + ' '.join(f'{c:8}' for c in cols) + ' ' + details)
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('-o', '--output', help='JSON lines file to append the results to')
+	parser.add_argument('--ports', help='glob of ports to use instead of looking for badges')
+	parser.add_argument('--confirm', action='store_true', help='ask which badges looked wrong after the LED and eye stages')
+	parser.add_argument('--tone-cmd', help='command that plays the 440 Hz tone during the mic stage '
+		'(otherwise the operator is asked to)')
+	parser.add_argument('--buttons-ms', type=int, default=20000, help='how long to wait for the buttons')
+	parser.add_argument('--no-complete', action='store_true', help="test, but don't take the badges out of factory mode")
+	args = parser.parse_args()
+
+	if args.ports:
+		ports = {port: os.path.basename(port) for port in sorted(glob.glob(args.ports))}
+	else:
+		ports = discover()
+	if not ports:
+		sys.exit('no badges found')
+	boards = [Board(n + 1, port, name) for n, (port, name) in enumerate(sorted(ports.items()))]
+	out = open(args.output, 'a') if args.output else None
+
+	start = time.monotonic()
+	# one thread per badge, the waiting is all on the badges
+	with concurrent.futures.ThreadPoolExecutor(max_workers=len(boards)) as pool:
+		list(pool.map(Board.open, boards))
+		for board in boards:
+			print(f'{board.n:3} {board.port} {board.name}' + (f' -- {board.failed}' if board.failed else ''))
+
+		stages = STAGES[:-1] if args.no_complete else STAGES
+		for stage in stages:
+			active = [b for b in boards if not b.failed]
+			if not active:
+				break
+			tone = None
+			if stage == 'buttons':
+				print(f'Press all four buttons on each badge (an LED lights for each), {args.buttons_ms // 1000} s...')
+			elif stage == 'mic':
+				if args.tone_cmd:
+					tone = subprocess.Popen(args.tone_cmd, shell=True)
+				else:
+					input('Play the 440 Hz tone, then press enter: ')
+			print(f'{stage} on {len(active)} badges...')
+
+			stage_start = time.monotonic()
+			list(pool.map(lambda b: b.run(stage, args.buttons_ms), active))
+			stage_s = time.monotonic() - stage_start
+			if tone:
+				tone.terminate()
+				tone.wait()
+
+			if args.confirm and stage in VISUAL:
+				ask_failed(active, stage)
+			passed = sum(1 for b in active if b.results[stage][0])
+			print(f'{stage}: {passed}/{len(active)} passed in {stage_s:.1f} s')
+
+			if out:
+				for board in active:
+					ok, fields = board.results[stage]
+					out.write(json.dumps({'time': time.time(), 'port': board.port, 'badge': board.name,
+						'stage': stage, 'passed': ok, **fields}) + '\n')
+				out.flush()
+
+		list(pool.map(Board.close, boards))
+
+	elapsed = time.monotonic() - start
+	summary(boards)
+	good = sum(1 for b in boards if not b.failed)
+	print(f'\n{good}/{len(boards)} badges passed in {elapsed:.1f} s ({elapsed / len(boards):.1f} s per badge)')
+	if out:
+		out.close()
+	sys.exit(0 if good == len(boards) else 1)
+
+if __name__ == '__main__':
+	main()
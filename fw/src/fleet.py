@@ -0,0 +1,436 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Collects telemetry from every badge plugged into this computer at once, over the
+# binary protocol (see badge_rpc.py): their counters every few seconds and the band
+# data stream (see sound.h) continuously, optionally the raw sound too. Writes it all
+# as JSON lines, and/or serves the latest values for Prometheus to scrape.
+# All badges are handled from one thread with a selector (epoll on Linux, kqueue on
+# macOS), and new ones are picked up as they're plugged in.
+# python3 fleet.py [-o fleet.jsonl] [-p 9100] [--sound] [--ports '/dev/ttyACM*']
+# python3 fleet.py --fake 32 --sound -d 30     (stand-in badges on ptys, for testing)
+
+import argparse
+import errno
+import glob
+import json
+import multiprocessing
+import os
+import random
+import selectors
+import socket
+import struct
+import sys
+import termios
+import time
+import tty
+
+import bands
+from badge_rpc import (PARAMS, RPC_GET, RPC_REPLY, RPC_SET, RPC_STREAM, STREAMS, decode_frame,
+	encode_frame)
+
+PRODUCT = 'Paranoids Blinky Badge'
+# read every --interval seconds
+POLL_PARAMS = ['peers', 'crowd_size', 'badges_met', 'sound_level', 'adverts', 'badge_adverts',
+	'ring_overflows']
+RESCAN_S = 5
+REPORT_S = 10
+
+def discover():
+	# port -> name (the USB serial number where there's one)
+	ports = {}
+	for tty_dir in glob.glob('/sys/class/tty/ttyACM*'):
+		usb_dir = os.path.realpath(os.path.join(tty_dir, 'device', '..'))
+		try:
+			with open(os.path.join(usb_dir, 'product')) as f:
+				if f.read().strip() != PRODUCT:
+					continue
+		except OSError:
+			continue
+		name = os.path.basename(tty_dir)
+		try:
+			with open(os.path.join(usb_dir, 'serial')) as f:
+				name = f.read().strip()
+		except OSError:
+			pass
+		ports['/dev/' + os.path.basename(tty_dir)] = name
+	# macOS, where the product can't be checked without IOKit
+	for port in glob.glob('/dev/cu.usbmodem*'):
+		ports[port] = os.path.basename(port)
+	return ports
+
+class Badge:
+	def __init__(self, port, name, sound):
+		self.port = port
+		self.name = name
+		self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+		tty.setraw(self.fd)
+		termios.tcflush(self.fd, termios.TCIOFLUSH)
+		self.rx = bytearray()
+		self.tx = bytearray()
+		self.seq = 0
+		# sequence number -> parameter being read
+		self.pending = {}
+		self.values = {}
+		self.bands = None
+		self.bands_decoder = bands.Decoder()
+		# stream -> next sequence number expected
+		self.stream_seq = {}
+		self.frames = 0
+		self.bytes = 0
+		self.lost = 0
+		self.bad_frames = 0
+		# a 0 switches the console over (see usb.c)
+		self.tx += b'\0'
+		self.request(RPC_SET, struct.pack('<Hi', PARAMS['bands_stream'], 1))
+		if sound:
+			self.request(RPC_SET, struct.pack('<Hi', PARAMS['sound_stream'], 1))
+
+	def request(self, msg_type, payload, param=None):
+		self.seq = (self.seq + 1) & 0xff
+		if param:
+			self.pending[self.seq] = param
+		self.tx += encode_frame(msg_type, self.seq, payload)
+
+	def poll(self):
+		for param in POLL_PARAMS:
+			self.request(RPC_GET, struct.pack('<H', PARAMS[param]), param)
+
+	def close(self):
+		try:
+			os.write(self.fd, encode_frame(RPC_SET, 0, struct.pack('<Hi', PARAMS['bands_stream'], 0)) +
+				encode_frame(RPC_SET, 0, struct.pack('<Hi', PARAMS['sound_stream'], 0)) +
+				encode_frame(0x05, 0))
+		except OSError:
+			pass
+		os.close(self.fd)
+
+	def flush(self):
+		# returns whether there's still something to write
+		while self.tx:
+			try:
+				n = os.write(self.fd, self.tx)
+			except BlockingIOError:
+				return True
+			del self.tx[:n]
+		return False
+
+	def read(self, emit):
+		# raises OSError once the badge is gone
+		while True:
+			try:
+				data = os.read(self.fd, 65536)
+			except BlockingIOError:
+				return
+			if not data:
+				raise OSError(errno.EIO, 'unplugged')
+			self.bytes += len(data)
+			self.rx += data
+			start = 0
+			while True:
+				end = self.rx.find(b'\0', start)
+				if end < 0:
+					break
+				if end > start:
+					try:
+						self.handle(*decode_frame(bytes(self.rx[start:end])), emit)
+					except ValueError:
+						# (also the text console's output from before the switch)
+						self.bad_frames += 1
+				start = end + 1
+			del self.rx[:start]
+
+	def handle(self, msg_type, seq, data, emit):
+		self.frames += 1
+		if msg_type == RPC_REPLY:
+			param = self.pending.pop(seq, None)
+			if param and len(data) == 5 and data[0] == 0:
+				self.values[param] = struct.unpack_from('<i', data, 1)[0]
+				if param == POLL_PARAMS[-1]:
+					emit(dict(badge=self.name, type='counters', **self.values))
+		elif msg_type == RPC_STREAM and data:
+			stream = STREAMS.get(data[0], data[0])
+			expected = self.stream_seq.get(stream)
+			if expected is not None and seq != expected:
+				self.lost += (seq - expected) & 0xff
+			self.stream_seq[stream] = (seq + 1) & 0xff
+			if stream == 'bands':
+				for t, level, energy, history, hue in self.bands_decoder.feed(data[1:]):
+					self.bands = dict(uptime_ms=t, level=level,
+						energy=[round(e * bands.DB_PER_STEP, 1) for e in energy],
+						history=[round(h * bands.DB_PER_STEP, 1) for h in history], hue=hue)
+					emit(dict(badge=self.name, type='bands', **self.bands))
+
+class Collector:
+	def __init__(self, args):
+		self.args = args
+		self.sel = selectors.DefaultSelector()
+		self.badges = {}
+		self.out = open(args.output, 'a') if args.output else None
+		self.server = None
+		self.clients = {}
+		if args.prometheus:
+			self.server = socket.create_server(('', args.prometheus), reuse_port=True)
+			self.server.setblocking(False)
+			self.sel.register(self.server, selectors.EVENT_READ)
+		self.records = 0
+
+	def emit(self, record):
+		self.records += 1
+		if self.out:
+			record['t'] = round(time.time(), 3)
+			self.out.write(json.dumps(record) + '\n')
+
+	def scan(self, ports):
+		known = {b.port for b in self.badges.values()}
+		for port, name in ports.items():
+			if port in known:
+				continue
+			try:
+				badge = Badge(port, name, self.args.sound)
+			except OSError as e:
+				print(f'# {port}: {e}', file=sys.stderr)
+				continue
+			self.badges[badge.fd] = badge
+			self.sel.register(badge.fd, selectors.EVENT_READ | selectors.EVENT_WRITE)
+			print(f'# found {name} on {port}', file=sys.stderr)
+
+	def drop(self, badge, reason):
+		print(f'# lost {badge.name}: {reason}', file=sys.stderr)
+		self.sel.unregister(badge.fd)
+		del self.badges[badge.fd]
+		try:
+			os.close(badge.fd)
+		except OSError:
+			pass
+
+	def metrics(self):
+		lines = []
+		for badge in self.badges.values():
+			label = f'badge="{badge.name}"'
+			for param, value in badge.values.items():
+				lines.append(f'badge_{param}{{{label}}} {value}')
+			lines.append(f'badge_frames_total{{{label}}} {badge.frames}')
+			lines.append(f'badge_bytes_total{{{label}}} {badge.bytes}')
+			lines.append(f'badge_stream_lost_total{{{label}}} {badge.lost}')
+			lines.append(f'badge_bad_frames_total{{{label}}} {badge.bad_frames}')
+			if badge.bands:
+				for i, e in enumerate(badge.bands['energy']):
+					lines.append(f'badge_band_energy_db{{{label},band="{i}"}} {e}')
+		return ('\n'.join(lines) + '\n').encode()
+
+	def serve(self, fd):
+		if fd == self.server.fileno():
+			try:
+				conn, _ = self.server.accept()
+			except BlockingIOError:
+				return
+			conn.setblocking(False)
+			self.clients[conn.fileno()] = [conn, b'']
+			self.sel.register(conn, selectors.EVENT_READ)
+			return
+		conn, buf = self.clients[fd]
+		try:
+			data = conn.recv(4096)
+		except BlockingIOError:
+			return
+		buf += data
+		if data and b'\r\n\r\n' not in buf:
+			self.clients[fd][1] = buf
+			return
+		if data:
+			body = self.metrics()
+			# (small enough to go in one send)
+			conn.setblocking(True)
+			conn.sendall(b'HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n'
+				b'Content-Length: %d\r\n\r\n' % len(body) + body)
+		self.sel.unregister(fd)
+		conn.close()
+		del self.clients[fd]
+
+	def report(self, elapsed, last):
+		frames = sum(b.frames for b in self.badges.values())
+		nbytes = sum(b.bytes for b in self.badges.values())
+		lost = sum(b.lost for b in self.badges.values())
+		bad = sum(b.bad_frames for b in self.badges.values())
+		print(f'# {len(self.badges)} badges, {(frames - last[0]) / elapsed:.0f} frames/s, '
+			f'{(nbytes - last[1]) / elapsed / 1024:.0f} KB/s, {lost} stream frames lost, '
+			f'{bad} bad frames', file=sys.stderr)
+		return frames, nbytes
+
+	def run(self, find_ports):
+		start = time.monotonic()
+		next_poll = next_scan = start
+		next_report = start + REPORT_S
+		last = (0, 0)
+		try:
+			self.loop(find_ports, start, next_poll, next_scan, next_report, last)
+		except KeyboardInterrupt:
+			pass
+		for badge in list(self.badges.values()):
+			badge.close()
+		if self.out:
+			self.out.close()
+
+	def loop(self, find_ports, start, next_poll, next_scan, next_report, last):
+		while not self.args.duration or time.monotonic() - start < self.args.duration:
+			now = time.monotonic()
+			if now >= next_scan:
+				self.scan(find_ports())
+				next_scan = now + RESCAN_S
+			if now >= next_poll:
+				for badge in self.badges.values():
+					badge.poll()
+					self.sel.modify(badge.fd, selectors.EVENT_READ | selectors.EVENT_WRITE)
+				next_poll = now + self.args.interval
+			if now >= next_report:
+				last = self.report(now - (next_report - REPORT_S), last)
+				next_report = now + REPORT_S
+
+			for key, events in self.sel.select(max(0, min(next_poll, next_scan, next_report) - now)):
+				fd = key.fd
+				badge = self.badges.get(fd)
+				if not badge:
+					self.serve(fd)
+					continue
+				try:
+					# (a hung up port shows up as readable, and reading it raises)
+					if events & selectors.EVENT_READ:
+						badge.read(self.emit)
+					if events & selectors.EVENT_WRITE and not badge.flush():
+						self.sel.modify(fd, selectors.EVENT_READ)
+				except OSError as e:
+					self.drop(badge, e)
+
+		self.report(time.monotonic() - (next_report - REPORT_S), last)
+
+# Stand-in badges, each on the master side of a pty: they answer gets and sets,
+# and send the streams that are turned on every 64 ms. Like the firmware (see
+# usb.c), stream frames are dropped rather than queued when the 4 KB TX buffer
+# doesn't have room, so any lost frames are the collector not keeping up
+class FakeBadge:
+	TX_MAX = 4096
+
+	def __init__(self, fd, n):
+		self.fd = fd
+		self.rx = bytearray()
+		self.tx = bytearray()
+		self.streams = set()
+		self.stream_seq = {}
+		self.values = {param: 0 for param in PARAMS}
+		self.values['peers'] = n % 7
+		self.values['crowd_size'] = 10 + n
+		self.dropped = 0
+
+	def read(self):
+		try:
+			self.rx += os.read(self.fd, 4096)
+		except (BlockingIOError, OSError):
+			return
+		while b'\0' in self.rx:
+			end = self.rx.find(b'\0')
+			raw = bytes(self.rx[:end])
+			del self.rx[:end + 1]
+			if not raw:
+				continue
+			try:
+				msg_type, seq, payload = decode_frame(raw)
+			except ValueError:
+				continue
+			if msg_type == RPC_GET and len(payload) == 2:
+				param = {v: k for k, v in PARAMS.items()}.get(struct.unpack('<H', payload)[0])
+				self.tx += encode_frame(RPC_REPLY, seq, struct.pack('<bi', 0, self.values.get(param, 0)))
+			elif msg_type == RPC_SET and len(payload) == 6:
+				param_id, value = struct.unpack('<Hi', payload)
+				stream = {PARAMS['bands_stream']: 5, PARAMS['sound_stream']: 1}.get(param_id)
+				if stream and value:
+					self.streams.add(stream)
+				elif stream:
+					self.streams.discard(stream)
+				self.tx += encode_frame(RPC_REPLY, seq, b'\0')
+			else:
+				self.tx += encode_frame(RPC_REPLY, seq, b'\0')
+
+	def block(self, uptime_ms):
+		self.values['adverts'] += random.randint(20, 60)
+		self.values['badge_adverts'] += random.randint(0, 20)
+		self.values['sound_level'] = random.randint(64, 192)
+		for stream in sorted(self.streams):
+			if stream == 5:
+				data = (b'BK' + struct.pack('<BBI', self.stream_seq.get(stream, 0), self.values['sound_level'],
+					uptime_ms) + bytes(random.randint(60, 200) for _ in range(2 * bands.NUM_BANDS)) +
+					bytes(random.randint(0, 255) for _ in range(bands.NUM_BANDS)))
+			else:
+				data = os.urandom(2048)
+			frame = encode_frame(RPC_STREAM, self.stream_seq.get(stream, 0), bytes([stream]) + data)
+			self.stream_seq[stream] = (self.stream_seq.get(stream, 0) + 1) & 0xff
+			if len(self.tx) + len(frame) > self.TX_MAX:
+				self.dropped += 1
+			else:
+				self.tx += frame
+
+	def flush(self):
+		try:
+			n = os.write(self.fd, self.tx)
+			del self.tx[:n]
+		except (BlockingIOError, OSError):
+			pass
+
+def run_fakes(fds):
+	fakes = {fd: FakeBadge(fd, n) for n, fd in enumerate(fds)}
+	sel = selectors.DefaultSelector()
+	for fd in fds:
+		os.set_blocking(fd, False)
+		sel.register(fd, selectors.EVENT_READ)
+	start = time.monotonic()
+	next_block = start
+	while True:
+		now = time.monotonic()
+		if now >= next_block:
+			for fake in fakes.values():
+				fake.block(int((now - start) * 1000))
+			next_block += 0.064
+		for fake in fakes.values():
+			if fake.tx:
+				fake.flush()
+		for key, events in sel.select(max(0, next_block - time.monotonic())):
+			fakes[key.fd].read()
+
+def start_fakes(n):
+	# port -> name, and the slave fds to keep open until the collector has them
+	masters, slaves, ports = [], [], {}
+	for i in range(n):
+		master, slave = os.openpty()
+		tty.setraw(slave)
+		masters.append(master)
+		slaves.append(slave)
+		ports[os.ttyname(slave)] = f'fake{i:02}'
+	process = multiprocessing.Process(target=run_fakes, args=(masters,), daemon=True)
+	process.start()
+	for master in masters:
+		os.close(master)
+	return ports, slaves
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('-o', '--output', help='JSON lines file to append to')
+	parser.add_argument('-p', '--prometheus', type=int, help='serve /metrics on this port')
+	parser.add_argument('-i', '--interval', type=float, default=5, help='seconds between counter reads')
+	parser.add_argument('-d', '--duration', type=float, default=0, help='seconds to run (0: until stopped)')
+	parser.add_argument('--sound', action='store_true', help='also stream the raw sound (32 KB/s per badge)')
+	parser.add_argument('--ports', help='glob of ports to use instead of looking for badges')
+	parser.add_argument('--fake', type=int, default=0, help='use this many stand-in badges on ptys')
+	args = parser.parse_args()
+
+	if args.fake:
+		fake_ports, _slaves = start_fakes(args.fake)
+		find_ports = lambda: fake_ports
+	elif args.ports:
+		find_ports = lambda: {port: os.path.basename(port) for port in glob.glob(args.ports)}
+	else:
+		find_ports = discover
+
+	Collector(args).run(find_ports)
+
+if __name__ == '__main__':
+	main()
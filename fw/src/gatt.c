@@ -0,0 +1,389 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <zephyr.h>
+#include <math.h>
+#include <sys/byteorder.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/uuid.h>
+
+#include "gatt.h"
+#include "radio.h"
+
+// Friendly name, in the scan response
+#define DEVICE_NAME "Paranoids Badge"
+#define DEVICE_NAME_LEN (sizeof(DEVICE_NAME) - 1)
+
+#define GATT_UUID_BASE(n)	BT_UUID_128_ENCODE(0x9e5c0000 + (n), 0x5061, 0x7261, 0x6e6f, 0x696473626467)
+static struct bt_uuid_128 service_uuid = BT_UUID_INIT_128(GATT_UUID_BASE(1));
+static struct bt_uuid_128 stream_uuid = BT_UUID_INIT_128(GATT_UUID_BASE(2));
+static struct bt_uuid_128 control_uuid = BT_UUID_INIT_128(GATT_UUID_BASE(3));
+
+// Advertised slowly, only for clients to find us (everything else is in the beacon)
+// All in 0.625 ms units
+#define GATT_ADV_INTERVAL_MIN	1600
+#define GATT_ADV_INTERVAL_MAX	1760
+
+static const struct bt_data gatt_ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR),
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL, GATT_UUID_BASE(1)),
+};
+
+static const struct bt_data gatt_sd[] = {
+	BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
+};
+
+// Records are handed from the producers to gatt_tx_handler() through this ring
+// process_sound() and the system workqueue both produce, so putting takes gatt_ring_lock,
+// taking them out is only done from the system workqueue
+#define GATT_RECORD_MAX		56
+struct gatt_record {
+	uint8_t len;
+	uint8_t data[GATT_RECORD_MAX];
+};
+// must be a power of 2, ~1 s of band records
+#define GATT_RING_SIZE		16
+static struct gatt_record gatt_ring[GATT_RING_SIZE];
+static atomic_t gatt_ring_head;
+static atomic_t gatt_ring_tail;
+static struct k_spinlock gatt_ring_lock;
+
+// Notifications queued in the stack at once, so that allocating one never blocks,
+// and enough of them to fill a connection event
+// (CONFIG_BT_L2CAP_TX_BUF_COUNT has to be at least this)
+#define GATT_TX_MAX		6
+// Biggest notification, with data length extension and the MTU at CONFIG_BT_L2CAP_TX_MTU
+#define GATT_TX_LEN_MAX		244
+
+#define GATT_STATS_INTERVAL	1000
+
+// Set and cleared by the BT callbacks, used from the system workqueue, so it's only
+// read or written under gatt_conn_lock and users take a reference (gatt_get_conn())
+static struct bt_conn *gatt_conn;
+static struct k_spinlock gatt_conn_lock;
+static atomic_t gatt_subscribed;
+static atomic_t gatt_streams = ATOMIC_INIT(GATT_STREAM_BANDS | GATT_STREAM_PEERS | GATT_STREAM_COUNTERS);
+static atomic_t gatt_tx_in_flight;
+static struct bt_le_ext_adv *gatt_adv;
+// identity the set advertises from, only connections to it are the service's
+static int gatt_id = -1;
+// off until gatt_set_enabled(), the advertising set follows it from gatt_adv_handler()
+static atomic_t gatt_enabled;
+static atomic_t gatt_advertising;
+
+// for the counters record
+static atomic_t gatt_dropped;
+static atomic_t gatt_notifications;
+
+static void gatt_put(uint8_t type, const uint8_t *data, uint8_t len) {
+	k_spinlock_key_t key = k_spin_lock(&gatt_ring_lock);
+	atomic_val_t head = atomic_get(&gatt_ring_head);
+	if (head - atomic_get(&gatt_ring_tail) >= GATT_RING_SIZE) {
+		k_spin_unlock(&gatt_ring_lock, key);
+		atomic_inc(&gatt_dropped);
+		return;
+	}
+
+	struct gatt_record *rec = &gatt_ring[head & (GATT_RING_SIZE - 1)];
+	rec->data[0] = type;
+	rec->data[1] = 4 + len;
+	sys_put_le32(k_uptime_get_32(), &rec->data[2]);
+	memcpy(&rec->data[6], data, len);
+	rec->len = 6 + len;
+	atomic_set(&gatt_ring_head, head + 1);
+	k_spin_unlock(&gatt_ring_lock, key);
+}
+
+// NULL if nobody's connected, otherwise a reference to unref when done
+static struct bt_conn *gatt_get_conn() {
+	k_spinlock_key_t key = k_spin_lock(&gatt_conn_lock);
+	struct bt_conn *conn = gatt_conn ? bt_conn_ref(gatt_conn) : NULL;
+	k_spin_unlock(&gatt_conn_lock, key);
+	return conn;
+}
+
+static int gatt_wants(uint8_t stream) {
+	return atomic_get(&gatt_subscribed) && (atomic_get(&gatt_streams) & stream);
+}
+
+static void gatt_tx_handler(struct k_work *work);
+K_WORK_DEFINE(gatt_tx_work, gatt_tx_handler);
+
+static void gatt_tx_done(struct bt_conn *conn, void *user_data) {
+	// (a new connection starts counting from 0, only the pointers are compared)
+	k_spinlock_key_t key = k_spin_lock(&gatt_conn_lock);
+	int current = conn == gatt_conn;
+	k_spin_unlock(&gatt_conn_lock, key);
+	if (!current)
+		return;
+	atomic_dec(&gatt_tx_in_flight);
+	atomic_inc(&gatt_notifications);
+	k_work_submit(&gatt_tx_work);
+}
+
+static void gatt_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value);
+static ssize_t gatt_control_read(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+	void *buf, uint16_t len, uint16_t offset);
+static ssize_t gatt_control_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+	const void *buf, uint16_t len, uint16_t offset, uint8_t flags);
+
+BT_GATT_SERVICE_DEFINE(badge_svc,
+	BT_GATT_PRIMARY_SERVICE(&service_uuid),
+	BT_GATT_CHARACTERISTIC(&stream_uuid.uuid, BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(gatt_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(&control_uuid.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+		BT_GATT_PERM_READ | BT_GATT_PERM_WRITE, gatt_control_read, gatt_control_write, NULL),
+);
+
+// Sends as many notifications as the stack takes, each packed with as many whole
+// records as fit, so that a connection event carries several full packets
+static void gatt_tx_handler(struct k_work *work) {
+	struct bt_conn *conn = gatt_get_conn();
+	if (!conn || !atomic_get(&gatt_subscribed)) {
+		// nobody to send them to
+		atomic_set(&gatt_ring_tail, atomic_get(&gatt_ring_head));
+		if (conn)
+			bt_conn_unref(conn);
+		return;
+	}
+
+	uint16_t mtu = bt_gatt_get_mtu(conn);
+	if (mtu <= 3) {
+		bt_conn_unref(conn);
+		return;
+	}
+	uint32_t max_len = MIN(mtu - 3, GATT_TX_LEN_MAX);
+	atomic_val_t tail = atomic_get(&gatt_ring_tail);
+	while (atomic_get(&gatt_tx_in_flight) < GATT_TX_MAX) {
+		atomic_val_t head = atomic_get(&gatt_ring_head);
+		uint8_t buf[GATT_TX_LEN_MAX];
+		uint32_t len = 0;
+		while (tail != head) {
+			const struct gatt_record *rec = &gatt_ring[tail & (GATT_RING_SIZE - 1)];
+			if (rec->len > max_len) {
+				// it would never fit at this MTU (such as the default 23 before the
+				// exchange), so skip it rather than hold up everything behind it
+				atomic_inc(&gatt_dropped);
+				tail++;
+				continue;
+			}
+			if (len + rec->len > max_len)
+				break;
+			memcpy(buf + len, rec->data, rec->len);
+			len += rec->len;
+			tail++;
+		}
+		// hands the slots back to gatt_put()
+		atomic_set(&gatt_ring_tail, tail);
+		if (!len)
+			break;
+
+		struct bt_gatt_notify_params params = {
+			.attr = &badge_svc.attrs[1],
+			.data = buf,
+			.len = len,
+			.func = gatt_tx_done,
+		};
+		atomic_inc(&gatt_tx_in_flight);
+		int err = bt_gatt_notify_cb(conn, &params);
+		if (err) {
+			atomic_dec(&gatt_tx_in_flight);
+			atomic_inc(&gatt_dropped);
+			break;
+		}
+	}
+
+	bt_conn_unref(conn);
+}
+
+static void gatt_stats_handler(struct k_work *work) {
+	if (!atomic_get(&gatt_subscribed))
+		return;
+
+	if (gatt_wants(GATT_STREAM_PEERS)) {
+		int peers, imposters, badge_makers;
+		get_peer_infos(&peers, &imposters, &badge_makers);
+		uint8_t data[10];
+		sys_put_le16(peers, &data[0]);
+		sys_put_le16(imposters, &data[2]);
+		sys_put_le16(badge_makers, &data[4]);
+		sys_put_le16(get_crowd_size(), &data[6]);
+		sys_put_le16(get_badges_met(), &data[8]);
+		gatt_put(GATT_STREAM_PEERS, data, sizeof(data));
+	}
+
+	if (gatt_wants(GATT_STREAM_COUNTERS)) {
+		struct radio_counters counters;
+		get_radio_counters(&counters);
+		uint8_t data[20];
+		sys_put_le32(counters.adverts, &data[0]);
+		sys_put_le32(counters.badge_adverts, &data[4]);
+		sys_put_le32(counters.ring_overflows, &data[8]);
+		sys_put_le32(atomic_get(&gatt_dropped), &data[12]);
+		sys_put_le32(atomic_get(&gatt_notifications), &data[16]);
+		gatt_put(GATT_STREAM_COUNTERS, data, sizeof(data));
+	}
+
+	k_work_submit(&gatt_tx_work);
+	k_work_schedule(k_work_delayable_from_work(work), K_MSEC(GATT_STATS_INTERVAL));
+}
+
+K_WORK_DELAYABLE_DEFINE(gatt_stats_work, gatt_stats_handler);
+
+static void gatt_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value) {
+	atomic_set(&gatt_subscribed, value == BT_GATT_CCC_NOTIFY);
+	if (value == BT_GATT_CCC_NOTIFY)
+		k_work_schedule(&gatt_stats_work, K_NO_WAIT);
+}
+
+static ssize_t gatt_control_read(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+	void *buf, uint16_t len, uint16_t offset) {
+	uint8_t streams = atomic_get(&gatt_streams);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &streams, sizeof(streams));
+}
+
+static ssize_t gatt_control_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+	const void *buf, uint16_t len, uint16_t offset, uint8_t flags) {
+	if (offset)
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	if (len != 1)
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	atomic_set(&gatt_streams, *(const uint8_t *)buf);
+	return len;
+}
+
+// Brings the advertising set and the connection in line with gatt_enabled
+static void gatt_adv_handler(struct k_work *work) {
+	struct bt_conn *conn = gatt_get_conn();
+
+	if (atomic_get(&gatt_enabled)) {
+		// (the set stops by itself when a client connects, and there's only room for one)
+		if (!conn && !atomic_get(&gatt_advertising)) {
+			int err = bt_le_ext_adv_start(gatt_adv, BT_LE_EXT_ADV_START_DEFAULT);
+			if (err)
+				printk("GATT advertising failed to start (err %d)\n", err);
+			else
+				atomic_set(&gatt_advertising, 1);
+		}
+	} else {
+		if (atomic_get(&gatt_advertising)) {
+			bt_le_ext_adv_stop(gatt_adv);
+			atomic_set(&gatt_advertising, 0);
+		}
+		if (conn)
+			bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	}
+
+	if (conn)
+		bt_conn_unref(conn);
+}
+
+K_WORK_DEFINE(gatt_adv_work, gatt_adv_handler);
+
+static struct bt_gatt_exchange_params mtu_params;
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err, struct bt_gatt_exchange_params *params) {
+	printk("GATT MTU %u\n", bt_gatt_get_mtu(conn));
+}
+
+static void connected(struct bt_conn *conn, uint8_t err) {
+	struct bt_conn_info info;
+	if (err || bt_conn_get_info(conn, &info) || info.id != gatt_id)
+		return;
+	k_spinlock_key_t key = k_spin_lock(&gatt_conn_lock);
+	if (gatt_conn) {
+		k_spin_unlock(&gatt_conn_lock, key);
+		return;
+	}
+	gatt_conn = bt_conn_ref(conn);
+	atomic_set(&gatt_tx_in_flight, 0);
+	k_spin_unlock(&gatt_conn_lock, key);
+	atomic_set(&gatt_advertising, 0);
+	printk("GATT client connected\n");
+	// (drops it again if the service was turned off just now)
+	k_work_submit(&gatt_adv_work);
+
+	// the most data per connection event: 2M PHY, the longest packets and an MTU to match,
+	// a short connection interval (the client has the last word on all of these)
+	if ((err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M)))
+		printk("PHY update failed (err %d)\n", err);
+	if ((err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX)))
+		printk("Data length update failed (err %d)\n", err);
+	mtu_params.func = mtu_exchanged;
+	if ((err = bt_gatt_exchange_mtu(conn, &mtu_params)))
+		printk("MTU exchange failed (err %d)\n", err);
+	// 15-30 ms
+	if ((err = bt_conn_le_param_update(conn, BT_LE_CONN_PARAM(12, 24, 0, 400))))
+		printk("Connection parameter update failed (err %d)\n", err);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason) {
+	k_spinlock_key_t key = k_spin_lock(&gatt_conn_lock);
+	if (conn != gatt_conn) {
+		k_spin_unlock(&gatt_conn_lock, key);
+		return;
+	}
+	gatt_conn = NULL;
+	atomic_set(&gatt_subscribed, 0);
+	k_spin_unlock(&gatt_conn_lock, key);
+
+	printk("GATT client disconnected (reason %u)\n", reason);
+	// (gatt_tx_handler() may still hold a reference of its own, the connection
+	// goes once that's dropped too)
+	bt_conn_unref(conn);
+	// the set stopped when the client connected, and the connection is only
+	// freed after this returns, so start it again (if still on) from the workqueue
+	k_work_submit(&gatt_adv_work);
+}
+
+BT_CONN_CB_DEFINE(gatt_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+int gatt_start() {
+	// from an address of its own, so that neighbors scanning with duplicate filtering
+	// don't take it for the beacon and drop the beacon's adverts instead
+	int id = bt_id_create(NULL, NULL);
+	if (id < 0)
+		return id;
+
+	struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_IDENTITY,
+		GATT_ADV_INTERVAL_MIN, GATT_ADV_INTERVAL_MAX, NULL);
+	param.id = id;
+	int err = bt_le_ext_adv_create(&param, NULL, &gatt_adv);
+	if (err)
+		return err;
+	gatt_id = id;
+	return bt_le_ext_adv_set_data(gatt_adv, gatt_ad, ARRAY_SIZE(gatt_ad), gatt_sd, ARRAY_SIZE(gatt_sd));
+}
+
+int gatt_set_enabled(int enable) {
+	if (!gatt_adv)
+		return -EAGAIN;
+	atomic_set(&gatt_enabled, enable);
+	k_work_submit(&gatt_adv_work);
+	return 0;
+}
+
+int gatt_get_enabled() {
+	return atomic_get(&gatt_enabled);
+}
+
+void gatt_send_bands(int level, const float *bands, int num_bands) {
+	if (!gatt_wants(GATT_STREAM_BANDS))
+		return;
+
+	uint8_t data[GATT_RECORD_MAX - 6];
+	int n = MIN(num_bands, (int)(sizeof(data) - 1) / 2);
+	data[0] = level;
+	for (int i = 0; i < n; i++) {
+		float v = log2f(1 + bands[i]) * 256;
+		sys_put_le16(v < 65535 ? (uint16_t)v : 65535, &data[1 + 2 * i]);
+	}
+	gatt_put(GATT_STREAM_BANDS, data, 1 + 2 * n);
+	k_work_submit(&gatt_tx_work);
+}
@@ -0,0 +1,49 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+
+// Telemetry over a connectable GATT service, advertised from its own advertising set
+// next to the badge beacon, so that spectra and stats can be collected wirelessly
+// A client subscribes to notifications on the stream characteristic and writes a
+// bitmask of GATT_STREAM_* to the control characteristic (all of them by default)
+// Each notification is a batch of whole records, each one is
+//  type (GATT_STREAM_*), length of the rest, k_uptime_get_32() (LE), then by type:
+//  bands	sound level (0-255, see sound_get_level()), then for each band its energy
+//		as log2(1 + energy) in 8.8 fixed point (LE), once per sound block (64 ms)
+//  peers	peers, imposters, badge makers, crowd size, badges met (2 bytes each, LE), every second
+//  counters	adverts heard, badge adverts, ring overflows, records dropped, notifications
+//		sent (4 bytes each, LE, since boot), every second
+// A record never spans notifications, so ones longer than the MTU allows are
+// dropped (and counted): bands records need an MTU of at least 52, counters 29
+// See gatt_stream.py for a client
+#define GATT_STREAM_BANDS	0x01
+#define GATT_STREAM_PEERS	0x02
+#define GATT_STREAM_COUNTERS	0x04
+
+#ifdef CONFIG_BADGE_GATT
+
+// Once Bluetooth is up, sets the service up but doesn't advertise it
+int gatt_start();
+// The service has no pairing, so anyone in range who connects gets the stream from
+// the mic, and advertising it costs power. It's off after every boot until this turns
+// it on ("debug gatt on" on the USB console). Turning it off drops the client.
+// -EAGAIN before Bluetooth is up
+int gatt_set_enabled(int enable);
+int gatt_get_enabled();
+
+// From process_sound(), does nothing unless someone is listening
+void gatt_send_bands(int level, const float *bands, int num_bands);
+
+#else
+
+// Built without it (see overlay-gatt.conf)
+static inline int gatt_start() { return 0; }
+static inline int gatt_set_enabled(int enable) { return -ENOTSUP; }
+static inline int gatt_get_enabled() { return 0; }
+static inline void gatt_send_bands(int level, const float *bands, int num_bands) {}
+
+#endif
@@ -0,0 +1,83 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Connects to a badge over BLE, subscribes to its telemetry stream (see gatt.h) and
+# prints the records as they come in, plus the throughput every 10 s
+# The badge only advertises the service after "debug gatt on" on its USB console
+# Needs bleak (pip install bleak)
+# python3 gatt_stream.py [address] [-s bands,peers,counters]
+
+import argparse
+import asyncio
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+SERVICE_UUID = '9e5c0001-5061-7261-6e6f-696473626467'
+STREAM_UUID = '9e5c0002-5061-7261-6e6f-696473626467'
+CONTROL_UUID = '9e5c0003-5061-7261-6e6f-696473626467'
+
+STREAMS = {'bands': 0x01, 'peers': 0x02, 'counters': 0x04}
+
+stats = {'bytes': 0, 'notifications': 0, 'records': 0, 'since': time.monotonic()}
+
+def decode(data):
+	off = 0
+	while off + 2 <= len(data):
+		rtype, rlen = data[off], data[off + 1]
+		body = data[off + 2:off + 2 + rlen]
+		off += 2 + rlen
+		if len(body) != rlen or rlen < 4:
+			print(f'# truncated record {rtype:#x}', file=sys.stderr)
+			return
+		t = struct.unpack_from('<I', body)[0] / 1000
+		if rtype == STREAMS['bands']:
+			bands = struct.unpack_from(f'<{(rlen - 5) // 2}H', body, 5)
+			print(f'{t:10.3f} bands level {body[4]:3} ' + ' '.join(f'{b / 256:5.1f}' for b in bands))
+		elif rtype == STREAMS['peers']:
+			peers, imposters, makers, crowd, met = struct.unpack_from('<5H', body, 4)
+			print(f'{t:10.3f} peers {peers} imposters {imposters} badge makers {makers} crowd {crowd} met {met}')
+		elif rtype == STREAMS['counters']:
+			adverts, badge_adverts, overflows, dropped, notifications = struct.unpack_from('<5I', body, 4)
+			print(f'{t:10.3f} counters adverts {adverts} badge adverts {badge_adverts} ring overflows {overflows}'
+				f' records dropped {dropped} notifications {notifications}')
+		else:
+			print(f'{t:10.3f} unknown record {rtype:#x}')
+		stats['records'] += 1
+
+def on_notify(_, data):
+	stats['bytes'] += len(data)
+	stats['notifications'] += 1
+	decode(data)
+	elapsed = time.monotonic() - stats['since']
+	if elapsed >= 10:
+		print(f"# {stats['bytes'] / elapsed:.0f} B/s, {stats['notifications'] / elapsed:.1f} notifications/s, "
+			f"{stats['records'] / elapsed:.1f} records/s", file=sys.stderr)
+		stats.update(bytes=0, notifications=0, records=0, since=time.monotonic())
+
+async def main(args):
+	address = args.address
+	if not address:
+		print('# scanning...', file=sys.stderr)
+		device = await BleakScanner.find_device_by_filter(
+			lambda d, ad: SERVICE_UUID in [u.lower() for u in ad.service_uuids], timeout=20)
+		if not device:
+			sys.exit('no badge found')
+		address = device.address
+
+	async with BleakClient(address) as client:
+		print(f'# connected to {address}, MTU {client.mtu_size}', file=sys.stderr)
+		mask = 0
+		for name in args.streams.split(','):
+			mask |= STREAMS[name]
+		await client.write_gatt_char(CONTROL_UUID, bytes([mask]), response=True)
+		await client.start_notify(STREAM_UUID, on_notify)
+		while client.is_connected:
+			await asyncio.sleep(1)
+
+parser = argparse.ArgumentParser()
+parser.add_argument('address', nargs='?', help='badge address (scans for the first one otherwise)')
+parser.add_argument('-s', '--streams', default='bands,peers,counters', help='which streams to turn on')
+asyncio.run(main(parser.parse_args()))
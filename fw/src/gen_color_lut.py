@@ -0,0 +1,58 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Generates color_lut.h
+# python3 gen_color_lut.py > color_lut.h
+
+HUE_STEPS_PER_BIN = 256
+RECIP_MAX = 64
+
+print("// Autogenerated by gen_color_lut.py")
+print()
+
+# Same sextants as the old HSV-ish code, at full value
+print(f"// Hue wheel at full value, {6 * HUE_STEPS_PER_BIN} elems of R, G, B")
+print("const uint8_t color_hue_lut[COLOR_HUE_STEPS][3] = {")
+vals = []
+for huebin in range(6):
+	for hue_in_bin in range(HUE_STEPS_PER_BIN):
+		up = hue_in_bin
+		down = 255 - hue_in_bin
+		rgb = [
+			(255, up, 0),
+			(down, 255, 0),
+			(0, 255, up),
+			(0, down, 255),
+			(up, 0, 255),
+			(255, 0, down),
+		][huebin]
+		vals.append(f"{{{rgb[0]}, {rgb[1]}, {rgb[2]}}},")
+for j in range(0, len(vals), 8):
+	print("\t" + " ".join(vals[j:j+8]))
+print("};")
+print()
+
+# Perceptual fade level --> linear LED level, both in [0, 256]
+print("// Perceived brightness (as sRGB) --> linear LED level, both in [0, COLOR_FRAC_ONE]")
+print("const uint16_t color_gamma_lut[COLOR_FRAC_ONE + 1] = {")
+vals = []
+for i in range(257):
+	# same as srgb_to_linear in color_convert.py
+	s = i / 256
+	if s <= 0.04045:
+		lin = s / 12.92
+	else:
+		lin = ((s + 0.055) / 1.055) ** 2.4
+	vals.append(round(lin * 256))
+for j in range(0, 257, 8):
+	print("\t" + " ".join(f"{v}," for v in vals[j:j+8]))
+print("};")
+print()
+
+# x / d == (x * recip[d]) >> 16 (rounded up so that x == d gives exactly 1.0)
+print("// 0x10000 / d, rounded up")
+print("const uint32_t color_recip_lut[COLOR_RECIP_MAX + 1] = {")
+vals = [0] + [(0x10000 + d - 1) // d for d in range(1, RECIP_MAX + 1)]
+for j in range(0, RECIP_MAX + 1, 8):
+	print("\t" + " ".join(f"{v}," for v in vals[j:j+8]))
+print("};")
@@ -0,0 +1,66 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Generates led_geometry.h from the LED footprint positions on the PCB
+# (which were placed according to eda/notes.slvs)
+# python3 gen_led_geometry.py > led_geometry.h
+
+import math
+import os
+import re
+
+NLEDS = 21
+
+pcb_file = os.path.join(os.path.dirname(__file__), '..', '..', 'eda', 'badge_eda.kicad_pcb')
+pcb = open(pcb_file).read()
+
+# reference --> (x, y) in mm, y grows downwards
+positions = {}
+for m in re.finditer(r'\(footprint "([^"]+)"', pcb):
+	footprint = pcb[m.start():m.start() + 3000]
+	at = re.search(r'\(at ([-\d.]+) ([-\d.]+)', footprint)
+	ref = re.search(r'\(fp_text reference "([^"]+)"', footprint)
+	positions[ref.group(1)] = (float(at.group(1)), float(at.group(2)))
+
+# LED index i is D(i + 1) along the data chain
+leds = [positions[f"D{i + 1}"] for i in range(NLEDS)]
+
+# the microphone is about where the mouth is, and the eyes are D22/D23
+origins = {
+	'LED_ORIGIN_CENTER': (sum(x for x, _ in leds) / NLEDS, sum(y for _, y in leds) / NLEDS),
+	'LED_ORIGIN_MOUTH': positions['MK1'],
+	'LED_ORIGIN_EYES': ((positions['D22'][0] + positions['D23'][0]) / 2, positions['D22'][1]),
+}
+
+min_x = min(x for x, _ in leds)
+min_y = min(y for _, y in leds)
+max_x = max(x for x, _ in leds)
+max_y = max(y for _, y in leds)
+
+# keep the aspect ratio, the longer side spans [0, 255]
+scale = 255 / max(max_x - min_x, max_y - min_y)
+
+def clamp8(v):
+	return max(0, min(255, round(v)))
+
+print("// Autogenerated by gen_led_geometry.py")
+print()
+print(f"// {scale:.3f} units per mm")
+print("const struct led_geometry led_geometry[NLEDS] = {")
+for i, (x, y) in enumerate(leds):
+	print(f"\t{{{clamp8((x - min_x) * scale)}, {clamp8((y - min_y) * scale)}}},\t// D{i + 1}")
+print("};")
+print()
+
+print("// Distance of each LED from each origin, same units as above")
+print("const uint8_t led_dist[LED_NUM_ORIGINS][NLEDS] = {")
+for name, (ox, oy) in origins.items():
+	dists = [clamp8(math.hypot(x - ox, y - oy) * scale) for x, y in leds]
+	print(f"\t[{name}] = {{" + ", ".join(str(d) for d in dists) + "},")
+print("};")
+print()
+
+# LEDs along the flat bottom edge of the mascot, left to right
+bottom = sorted((i for i, (_, y) in enumerate(leds) if max_y - y < 1), key=lambda i: leds[i][0])
+print("// LEDs along the bottom edge, left to right")
+print("const uint8_t led_bottom_row[LED_BOTTOM_ROW_LEN] = {" + ", ".join(str(i) for i in bottom) + "};")
@@ -0,0 +1,71 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <math.h>
+#include <string.h>
+
+#include "hll.h"
+
+// FNV-1a followed by the murmur3 finalizer, the addresses are short so this is cheap
+static uint64_t hll_hash(const uint8_t *data, int len) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (int i = 0; i < len; i++) {
+		h ^= data[i];
+		h *= 0x100000001b3ull;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+void hll_init(struct hll *hll) {
+	memset(hll, 0, sizeof(*hll));
+}
+
+int hll_add(struct hll *hll, const uint8_t *data, int len) {
+	uint64_t h = hll_hash(data, len);
+	unsigned int idx = h >> (64 - HLL_P);
+	// the rest of the bits, with a 1 at the bottom so that there's a limit
+	uint64_t rest = (h << HLL_P) | (1ull << (HLL_P - 1));
+	uint8_t rank = __builtin_clzll(rest) + 1;
+
+	if (rank > hll->regs[idx]) {
+		hll->regs[idx] = rank;
+		return 1;
+	}
+	return 0;
+}
+
+int hll_merge(struct hll *hll, const struct hll *other) {
+	int changed = 0;
+	for (int i = 0; i < HLL_NUM_REGS; i++) {
+		if (other->regs[i] > hll->regs[i]) {
+			hll->regs[i] = other->regs[i];
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+int hll_estimate(const struct hll *hll) {
+	const float m = HLL_NUM_REGS;
+	const float alpha = 0.7213f / (1 + 1.079f / m);
+
+	float sum = 0;
+	int zeros = 0;
+	for (int i = 0; i < HLL_NUM_REGS; i++) {
+		sum += ldexpf(1, -hll->regs[i]);
+		if (!hll->regs[i])
+			zeros++;
+	}
+
+	float estimate = alpha * m * m / sum;
+	// the raw estimate is biased for small counts, linear counting is better there
+	if (estimate <= 2.5f * m && zeros)
+		estimate = m * logf(m / zeros);
+
+	return estimate + 0.5f;
+}
@@ -0,0 +1,31 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+// HyperLogLog sketch for counting distinct addresses without remembering them
+// Standard error is about 1.04 / sqrt(HLL_NUM_REGS), i.e. 6.5% with 256 registers
+// This doesn't depend on Zephyr so that it can be built on the host (see eval_hll.py)
+
+#ifndef HLL_P
+#define HLL_P		8
+#endif
+#define HLL_NUM_REGS	(1 << HLL_P)
+
+struct hll {
+	// number of leading zeros + 1 of the hashes that land in each register
+	uint8_t regs[HLL_NUM_REGS];
+};
+
+void hll_init(struct hll *hll);
+
+// Returns 1 if the sketch changed
+int hll_add(struct hll *hll, const uint8_t *data, int len);
+
+// Registers only ever grow, so merging is a max
+// Returns 1 if the sketch changed
+int hll_merge(struct hll *hll, const struct hll *other);
+
+int hll_estimate(const struct hll *hll);
@@ -0,0 +1,36 @@
+// Autogenerated by gen_led_geometry.py
+
+// 2.159 units per mm
+const struct led_geometry led_geometry[NLEDS] = {
+	{110, 80},	// D1
+	{89, 101},	// D2
+	{95, 132},	// D3
+	{101, 163},	// D4
+	{107, 193},	// D5
+	{113, 224},	// D6
+	{119, 255},	// D7
+	{89, 255},	// D8
+	{60, 255},	// D9
+	{30, 255},	// D10
+	{0, 255},	// D11
+	{6, 224},	// D12
+	{12, 193},	// D13
+	{18, 163},	// D14
+	{25, 132},	// D15
+	{31, 101},	// D16
+	{9, 80},	// D17
+	{1, 50},	// D18
+	{9, 21},	// D19
+	{31, 0},	// D20
+	{89, 0},	// D21
+};
+
+// Distance of each LED from each origin, same units as above
+const uint8_t led_dist[LED_NUM_ORIGINS][NLEDS] = {
+	[LED_ORIGIN_CENTER] = {89, 59, 44, 48, 69, 95, 124, 111, 106, 109, 119, 89, 61, 38, 35, 54, 83, 112, 136, 151, 153},
+	[LED_ORIGIN_MOUTH] = {93, 70, 39, 11, 26, 56, 88, 84, 91, 106, 126, 103, 85, 76, 80, 95, 125, 152, 172, 183, 171},
+	[LED_ORIGIN_EYES] = {44, 62, 92, 123, 155, 186, 217, 216, 218, 224, 234, 204, 173, 143, 114, 87, 92, 91, 85, 73, 40},
+};
+
+// LEDs along the bottom edge, left to right
+const uint8_t led_bottom_row[LED_BOTTOM_ROW_LEN] = {10, 9, 8, 7, 6};
@@ -6,6 +6,10 @@
 #include <devicetree.h>
 #include <random/rand32.h>
 
+#include "color.h"
+#include "effects.h"
+#include "enclog.h"
+#include "factory.h"
 #include "misc.h"
 #include "nfc.h"
 #include "nvs.h"
@@ -70,6 +74,15 @@ const uint16_t eye_colors_5[] = {
 	214, 14, 1024	// Hulk pants
 };
 
+// Eye fades, same timing as stepping 16 steps per 64 ms tick, but twice as smooth
+#define EYE_FADE_STEPS		32
+#define EYE_FADE_STEP_MS	32
+
+// so fade_*_eye() never turns the fades below down
+BUILD_ASSERT(EYE_FADE_STEPS <= EYE_FADE_MAX_STEPS, "eye fade too long");
+BUILD_ASSERT(ARRAY_SIZE(eye_colors_4) <= 3 * EYE_FADE_MAX_COLORS, "eye fade too long");
+BUILD_ASSERT(ARRAY_SIZE(eye_colors_5) <= 3 * EYE_FADE_MAX_COLORS, "eye fade too long");
+
 const uint8_t sparkle_colors_11[] = {
 	COLOR_MALIBU,
 	COLOR_TURMERIC_YELLOW,
@@ -101,20 +114,20 @@ const uint8_t rainbow_cycle_colors[] = {
 };
 
 static void random_twinkle_loop(int num_colors, const uint8_t *colors, int delay) {
-	const int max_leds = NLEDS;
+	const int nleds = get_num_leds();
 
 	static int delay_remaining = 0;
 	static int num_leds_lit = 0;
 
 	if (delay_remaining-- >= 0) {} else {
-		if (num_leds_lit == max_leds) {
-			for (int i = 0; i < NLEDS; i++) {
+		if (num_leds_lit >= nleds) {
+			for (int i = 0; i < nleds; i++) {
 				set_led(i, 0, 0, 0);
 			}
 			num_leds_lit = 0;
 			delay_remaining = delay;
 		} else {
-			int led = rand_choice(NLEDS);
+			int led = rand_choice(nleds);
 			const uint8_t *color = &colors[3 * rand_choice(num_colors)];
 			set_led(led, color[0], color[1], color[2]);
 			num_leds_lit++;
@@ -124,29 +137,31 @@ static void random_twinkle_loop(int num_colors, const uint8_t *colors, int delay
 }
 
 static void sparkle_loop(int num_colors, const uint8_t *colors, int use_eyes) {
+	const int nleds = get_num_leds();
+
 	static int last_led_lit = -1;
 
 	if (last_led_lit == -1) {
 		// turn one on
 		int led;
 		if (use_eyes)
-			led = rand_choice(NLEDS + 2);
+			led = rand_choice(nleds + 2);
 		else
-			led = rand_choice(NLEDS);
+			led = rand_choice(nleds);
 		const uint8_t *color = &colors[3 * rand_choice(num_colors)];
 
-		if (led == NLEDS)
+		if (led == nleds)
 			set_left_eye(color[0] * 4, color[1] * 4, color[2] * 4);
-		else if (led == NLEDS + 1)
+		else if (led == nleds + 1)
 			set_right_eye(color[0] * 4, color[1] * 4, color[2] * 4);
 		else
 			set_led(led, color[0], color[1], color[2]);
 		last_led_lit = led;
 	} else {
 		// turn it off
-		if (last_led_lit == NLEDS)
+		if (last_led_lit == nleds)
 			set_left_eye(0, 0, 0);
-		else if (last_led_lit == NLEDS + 1)
+		else if (last_led_lit == nleds + 1)
 				set_right_eye(0, 0, 0);
 		else
 			set_led(last_led_lit, 0, 0, 0);
@@ -154,127 +169,86 @@ static void sparkle_loop(int num_colors, const uint8_t *colors, int use_eyes) {
 	}
 }
 
-static void color_wipe_loop() {
-	// negative --> on the left
-	// positive --> on the right
-	static int num_not_lit = -NLEDS;
+// The patterns below are all drawn from the animation clock, which nearby badges keep
+// in step (see radio.c), so that a group of badges in the same mode blinks together
+#define ANIM_TICK_MS	64
 
-	if (num_not_lit <= 0) {
-		for (int i = 0; i < -num_not_lit; i++) {
+static void color_wipe_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
+
+	// lights fill in from the left, then go out from the right
+	int phase = tick % (2 * nleds);
+
+	if (phase < nleds) {
+		int num_not_lit = nleds - phase;
+		for (int i = 0; i < num_not_lit; i++) {
 			set_led(i, 0, 0, 0);
 		}
-		for (int i = -num_not_lit; i < NLEDS; i++) {
+		for (int i = num_not_lit; i < nleds; i++) {
 			set_led(i, COLOR_GRAPE_JELLY);
 		}
-
-		num_not_lit++;
-	}
-
-	if (num_not_lit > 0) {
-		for (int i = 0; i < NLEDS - num_not_lit; i++) {
+	} else {
+		int num_not_lit = phase - nleds + 1;
+		for (int i = 0; i < nleds - num_not_lit; i++) {
 			set_led(i, COLOR_GRAPE_JELLY);
 		}
-		for (int i = NLEDS - num_not_lit; i < NLEDS; i++) {
+		for (int i = nleds - num_not_lit; i < nleds; i++) {
 			set_led(i, 0, 0, 0);
 		}
-
-		if (num_not_lit == NLEDS)
-			num_not_lit = -NLEDS;
-		else
-			num_not_lit++;
 	}
 }
 
 static void eye_fade_loop(int num_colors, const uint16_t *colors, int reset) {
-	const int num_steps = 16;
-
-	// 0 = blank
-	// 1 = up
-	// 2 = down
-	static int direction = 0;
-	static int step = 0;
-	static int color_idx = 0;
-
-	if (reset) {
-		direction = 0;
-		step = 0;
-		color_idx = 0;
-	}
-
-	const uint16_t *color = &colors[color_idx * 3];
-
-	switch (direction) {
-		case 0:
-			set_left_eye(0, 0, 0);
-			set_right_eye(0, 0, 0);
-			if (++step == num_steps) {
-				step = 0;
-				direction = 1;
-			}
-			break;
-
-		case 1:
-			step++;
-			set_left_eye(color[0] * step / num_steps, color[1] * step / num_steps, color[2] * step / num_steps);
-			set_right_eye(color[0] * step / num_steps, color[1] * step / num_steps, color[2] * step / num_steps);
-			if (step == num_steps) {
-				direction = 2;
-			}
-			break;
-
-		case 2:
-			step--;
-			set_left_eye(color[0] * step / num_steps, color[1] * step / num_steps, color[2] * step / num_steps);
-			set_right_eye(color[0] * step / num_steps, color[1] * step / num_steps, color[2] * step / num_steps);
-			if (step == 0) {
-				direction = 0;
-				color_idx = (color_idx + 1) % num_colors;
-			}
-			break;
+	// the whole fade is handed to the PWM peripherals, which loop it on their own
+	static const uint16_t *playing_colors = 0;
+
+	if (reset || colors != playing_colors) {
+		// (if it's refused, hold the first color rather than what the last mode left)
+		if (fade_left_eye(num_colors, colors, EYE_FADE_STEPS, EYE_FADE_STEP_MS, 1))
+			set_left_eye(colors[0], colors[1], colors[2]);
+		if (fade_right_eye(num_colors, colors, EYE_FADE_STEPS, EYE_FADE_STEP_MS, 1))
+			set_right_eye(colors[0], colors[1], colors[2]);
+		playing_colors = colors;
 	}
 }
 
-static void cylon_loop() {
-	// 0 = right
-	// 1 = left
-	static int direction = 0;
-	static int end_wait = 0;
-	static int cylon_pos = 0;
-
-	if (end_wait-- >= 0) {} else {
-		for (int i = 0; i < NLEDS; i++)
-			set_led(i, COLOR_GRAPE_JELLY);
-		for (int i = 6; i <= 10; i++)
-			set_led(i, 0, 0, 0);
-		set_led(10 - cylon_pos, 163, 0, 4 /* cylon bar color */);
-
-		if (direction == 0) {
-			if (cylon_pos == 4) {
-				direction = 1;
-				end_wait = 1;
-			} else
-				cylon_pos++;
-		} else {
-			if (cylon_pos == 0) {
-				direction = 0;
-				end_wait = 1;
-			} else
-				cylon_pos--;
-		}
-	}
+static void cylon_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
+
+	// right, wait 2 ticks, left, wait 2 ticks
+	const int end_wait = 2;
+	int phase = tick % (2 * (LED_BOTTOM_ROW_LEN + end_wait));
+	int cylon_pos;
+
+	if (phase < LED_BOTTOM_ROW_LEN)
+		cylon_pos = phase;
+	else if (phase < LED_BOTTOM_ROW_LEN + end_wait)
+		cylon_pos = LED_BOTTOM_ROW_LEN - 1;
+	else if (phase < 2 * LED_BOTTOM_ROW_LEN + end_wait)
+		cylon_pos = 2 * LED_BOTTOM_ROW_LEN + end_wait - 1 - phase;
+	else
+		cylon_pos = 0;
+
+	for (int i = 0; i < nleds; i++)
+		set_led(i, COLOR_GRAPE_JELLY);
+	for (int i = 0; i < LED_BOTTOM_ROW_LEN; i++)
+		set_led(led_bottom_row[i], 0, 0, 0);
+	set_led(led_bottom_row[cylon_pos], 163, 0, 4 /* cylon bar color */);
 }
 
 static void snow_sparkle_loop() {
+	const int nleds = get_num_leds();
+
 	static int last_led_lit = -1;
 	static int delay_remaining = 0;
 
 	if (delay_remaining-- >= 0) {} else {
-		for (int i = 0; i < NLEDS; i++)
+		for (int i = 0; i < nleds; i++)
 			set_led(i, COLOR_GRAPE_JELLY);
 
 		if (last_led_lit == -1) {
 			// turn one on
-			int led = rand_choice(NLEDS);
+			int led = rand_choice(nleds);
 			set_led(led, 255, 255, 255);
 			last_led_lit = led;
 		} else {
@@ -285,133 +259,68 @@ static void snow_sparkle_loop() {
 	}
 }
 
-// fixme code duplication
-static void fade_purples_loop() {
+// Where a fade is at, num_steps ticks blank, then num_steps up and num_steps down
+// Returns the step (0 = off), cycle counts the fades
+static int fade_step(uint32_t tick, int num_steps, uint32_t *cycle) {
+	int phase = tick % (3 * num_steps);
+	*cycle = tick / (3 * num_steps);
+
+	if (phase < num_steps)
+		return 0;
+	else if (phase < 2 * num_steps)
+		return phase - num_steps + 1;
+	else
+		return 3 * num_steps - 1 - phase;
+}
+
+static void fade_purples_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
+
 	const int num_steps = 16;
 
-	// 0 = blank
-	// 1 = up
-	// 2 = down
-	static int direction = 0;
-	static int step = 0;
-	static int color_idx = 0;
+	uint32_t cycle;
+	int step = fade_step(tick, num_steps, &cycle);
+	// the dim half of this is where 8-bit steps used to band, so use the fine levels
+	int level = color_fade_level(step, num_steps);
+	// every other fade at a quarter of the brightness
+	int shift = cycle % 2 ? 2 : 0;
 
-	switch (direction) {
-		case 0:
-			for (int i = 0; i < NLEDS; i++)
-				set_led(i, 0, 0, 0);
-			if (++step == num_steps) {
-				step = 0;
-				direction = 1;
-			}
-			break;
-
-		case 1:
-			step++;
-			for (int i = 0; i < NLEDS; i++)
-				// COLOR_GRAPE_JELLY
-				set_led(i,
-					45 * step / num_steps / (color_idx ? 4 : 1),
-					0 * step / num_steps / (color_idx ? 4 : 1),
-					164 * step / num_steps / (color_idx ? 4 : 1));
-			if (step == num_steps) {
-				direction = 2;
-			}
-			break;
-
-		case 2:
-			step--;
-			for (int i = 0; i < NLEDS; i++)
-				// COLOR_GRAPE_JELLY
-				set_led(i,
-					45 * step / num_steps / (color_idx ? 4 : 1),
-					0 * step / num_steps / (color_idx ? 4 : 1),
-					164 * step / num_steps / (color_idx ? 4 : 1));
-			if (step == 0) {
-				direction = 0;
-				color_idx = (color_idx + 1) % 2;
-			}
-			break;
-	}
+	for (int i = 0; i < nleds; i++)
+		// COLOR_GRAPE_JELLY
+		set_led_fine(i, (45 * level) >> shift, 0, (164 * level) >> shift);
 }
 
-static void fade_ukraine_loop() {
+static void fade_ukraine_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
+
 	const int num_steps = 16;
 
-	// 0 = blank
-	// 1 = up
-	// 2 = down
-	static int direction = 0;
-	static int step = 0;
+	uint32_t cycle;
+	int level = color_fade_level(fade_step(tick, num_steps, &cycle), num_steps);
 
-	switch (direction) {
-		case 0:
-			for (int i = 0; i < NLEDS; i++)
-				set_led(i, 0, 0, 0);
-			if (++step == num_steps) {
-				step = 0;
-				direction = 1;
-			}
-			break;
-
-		case 1:
-			step++;
-			for (int i = 0; i < NLEDS; i++)
-				if (i % 2 == 0)
-					// COLOR_TURMERIC_YELLOW
-					set_led(i,
-						255 * step / num_steps,
-						99 * step / num_steps,
-						0 * step / num_steps);
-				else
-					// COLOR_DORY_BLUE
-					set_led(i,
-						1 * step / num_steps,
-						36 * step / num_steps,
-						255 * step / num_steps);
-			if (step == num_steps) {
-				direction = 2;
-			}
-			break;
-
-		case 2:
-			step--;
-			for (int i = 0; i < NLEDS; i++)
-				if (i % 2 == 0)
-					// COLOR_TURMERIC_YELLOW
-					set_led(i,
-						255 * step / num_steps,
-						99 * step / num_steps,
-						0 * step / num_steps);
-				else
-					// COLOR_DORY_BLUE
-					set_led(i,
-						1 * step / num_steps,
-						36 * step / num_steps,
-						255 * step / num_steps);
-			if (step == 0) {
-				direction = 0;
-			}
-			break;
-	}
+	for (int i = 0; i < nleds; i++)
+		if (i % 2 == 0)
+			// COLOR_TURMERIC_YELLOW
+			set_led_fine(i, 255 * level, 99 * level, 0);
+		else
+			// COLOR_DORY_BLUE
+			set_led_fine(i, 1 * level, 36 * level, 255 * level);
 }
 
-static void rainbow_cycle_loop() {
-	static int offset = 0;
-	static int delay_remaining = 0;
+static void rainbow_cycle_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
 
-	if (delay_remaining-- >= 0) {} else {
-		for (int i = 0; i < NLEDS; i++) {
-			const uint8_t *color = &rainbow_cycle_colors[((i + offset) % NLEDS) * 3];
-			set_led(i, color[0], color[1], color[2]);
-		}
-		const uint8_t *color = &rainbow_cycle_colors[offset * 3];
-		set_left_eye(color[0] * 4, color[1] * 4, color[2] * 4);
-		set_right_eye(color[0] * 4, color[1] * 4, color[2] * 4);
+	// one step every 3 ticks
+	int offset = (tick / 3) % NLEDS;
 
-		delay_remaining = 1;
-		offset = (offset + 1) % NLEDS;
+	for (int i = 0; i < nleds; i++) {
+		// the rainbow repeats every NLEDS along longer chains
+		const uint8_t *color = &rainbow_cycle_colors[((i + offset) % NLEDS) * 3];
+		set_led(i, color[0], color[1], color[2]);
 	}
+	const uint8_t *color = &rainbow_cycle_colors[offset * 3];
+	set_left_eye(color[0] * 4, color[1] * 4, color[2] * 4);
+	set_right_eye(color[0] * 4, color[1] * 4, color[2] * 4);
 }
 
 static void radio_neighbor_eye_loop() {
@@ -421,120 +330,103 @@ static void radio_neighbor_eye_loop() {
 	// if there are *any* imposters, right eye fades to red instead
 	// if there are *any* easter egg badges, left eye fades to gold instead
 
-	const int num_steps = 16;
-
-	// 0 = blank
-	// 1 = up
-	// 2 = down
-	static int direction = 2;
-	static int step = 1;
-
-	static int r, g, b;
+	// each fade is played by the PWM peripherals, we only pick the next one
+	if (eye_fade_busy())
+		return;
 
-	static int num_peers;
-	static int num_imposters;
-	static int num_badge_makers;
+	// only update this between fades (no sudden changes)
+	int num_peers, num_imposters, num_badge_makers;
+	get_peer_infos(&num_peers, &num_imposters, &num_badge_makers);
 
-	int brightness_scale;
+	// brightness is 1 / (1 << brightness_shift)
+	int brightness_shift;
 	if (num_peers == 0) {
-		brightness_scale = 64;
+		brightness_shift = 6;
 	} else if (num_peers == 1) {
-		brightness_scale = 8;
+		brightness_shift = 3;
 	} else if (num_peers == 2) {
-		brightness_scale = 4;
+		brightness_shift = 2;
 	} else if (num_peers <= 5) {
-		brightness_scale = 2;
+		brightness_shift = 1;
 	} else {
-		brightness_scale = 1;
+		brightness_shift = 0;
 	}
 
-	switch (direction) {
-		case 0:
-			set_left_eye(0, 0, 0);
-			set_right_eye(0, 0, 0);
-			if (++step == num_steps) {
-				step = 0;
-				direction = 1;
-			}
-			break;
-
-		case 1:
-			step++;
-			set_left_eye(
-				(num_badge_makers ? 1024 : r) * step / num_steps / brightness_scale,
-				(num_badge_makers ? 696 : g) * step / num_steps / brightness_scale,
-				(num_badge_makers ? 0 : b) * step / num_steps / brightness_scale);
-			set_right_eye(
-				(num_imposters ? 1024 : r) * step / num_steps / brightness_scale,
-				(num_imposters ? 0 : g) * step / num_steps / brightness_scale,
-				(num_imposters ? 0 : b) * step / num_steps / brightness_scale);
-			if (step == num_steps) {
-				direction = 2;
-			}
-			break;
-
-		case 2:
-			step--;
-			set_left_eye(
-				(num_badge_makers ? 1024 : r) * step / num_steps / brightness_scale,
-				(num_badge_makers ? 696 : g) * step / num_steps / brightness_scale,
-				(num_badge_makers ? 0 : b) * step / num_steps / brightness_scale);
-			set_right_eye(
-				(num_imposters ? 1024 : r) * step / num_steps / brightness_scale,
-				(num_imposters ? 0 : g) * step / num_steps / brightness_scale,
-				(num_imposters ? 0 : b) * step / num_steps / brightness_scale);
-			if (step == 0) {
-				direction = 0;
-
-				// pick a new color
-				int hue = rand_choice(6 * 1025);
-
-				// awkward HSV-ish --> RGB, except S = 1 always
-				int huebin = hue / 1025;
-				int hue_in_bin = hue % 1025;
-
-				switch (huebin) {
-					case 0:
-						r = 1024;
-						g = hue_in_bin;
-						b = 0;
-						break;
-					case 1:
-						r = 1024 - hue_in_bin;
-						g = 1024;
-						b = 0;
-						break;
-					case 2:
-						r = 0;
-						g = 1024;
-						b = hue_in_bin;
-						break;
-					case 3:
-						r = 0;
-						g = 1024 - hue_in_bin;
-						b = 1024;
-						break;
-					case 4:
-						r = hue_in_bin;
-						g = 0;
-						b = 1024;
-						break;
-					case 5:
-					default:
-						r = 1024;
-						g = 0;
-						b = 1024 - hue_in_bin;
-						break;
-				}
+	// pick a new color
+	int r, g, b;
+	color_hue_to_rgb(rand_choice(COLOR_HUE_STEPS), EYE_MAX_VAL, &r, &g, &b);
+
+	uint16_t left_color[3] = {
+		(num_badge_makers ? 1024 : r) >> brightness_shift,
+		(num_badge_makers ? 696 : g) >> brightness_shift,
+		(num_badge_makers ? 0 : b) >> brightness_shift,
+	};
+	uint16_t right_color[3] = {
+		(num_imposters ? 1024 : r) >> brightness_shift,
+		(num_imposters ? 0 : g) >> brightness_shift,
+		(num_imposters ? 0 : b) >> brightness_shift,
+	};
+
+	// (if it's refused, show the color without the fade)
+	if (fade_left_eye(1, left_color, EYE_FADE_STEPS, EYE_FADE_STEP_MS, 0))
+		set_left_eye(left_color[0], left_color[1], left_color[2]);
+	if (fade_right_eye(1, right_color, EYE_FADE_STEPS, EYE_FADE_STEP_MS, 0))
+		set_right_eye(right_color[0], right_color[1], right_color[2]);
+}
 
-				// only update this when the leds fade out (no sudden changes)
-				get_peer_infos(&num_peers, &num_imposters, &num_badge_makers);
-			}
-			break;
+static void badges_met_loop() {
+	const int nleds = get_num_leds();
+	int met = get_badges_met();
+
+	// one LED per doubling around the ring (so 21 of them go up to a million),
+	// the last one lit partially by how far along to the next doubling it is
+	int lit = met ? 32 - __builtin_clz(met) : 0;
+	int partial = met ? ((met - (1 << (lit - 1))) << COLOR_FRAC_SHIFT) >> (lit - 1) : 0;
+
+	for (int i = 0; i < nleds; i++) {
+		int r = 0, g = 0, b = 0;
+		if (i < NLEDS && i < lit) {
+			int v = i == lit - 1 ? color_scale(0xFF, COLOR_FRAC_ONE / 4 + partial * 3 / 4) : 0xFF;
+			color_hue_to_rgb(i * COLOR_HUE_STEPS / NLEDS, v, &r, &g, &b);
+		}
+		set_led(i, r, g, b);
 	}
 }
 
-#define NUM_PUZZLE_CODES	12
+static void ripple_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
+
+	// a band a second out from the eyes, slowly going around the hues
+	int r, g, b;
+	color_hue_to_rgb(tick % COLOR_HUE_STEPS, 0xFF, &r, &g, &b);
+	effect_ripple(LED_ORIGIN_EYES, tick * 4, r, g, b);
+
+	for (int i = NLEDS; i < nleds; i++)
+		set_led(i, 0, 0, 0);
+}
+
+static void sweep_loop(uint32_t tick) {
+	const int nleds = get_num_leds();
+
+	// across and back in 4 s, then down and back up
+	int phase = (tick * 8) % 512;
+	int axis = (tick * 8 / 512) % 2;
+	int pos = phase < 256 ? phase : 511 - phase;
+
+	// the mascot is narrower than it is tall, only go as far as it does
+	int extent = 0;
+	for (int i = 0; i < NLEDS; i++) {
+		int coord = axis ? led_geometry[i].y : led_geometry[i].x;
+		if (coord > extent)
+			extent = coord;
+	}
+	effect_sweep(axis, pos * extent / 255, 48, COLOR_MALIBU);
+
+	for (int i = NLEDS; i < nleds; i++)
+		set_led(i, 0, 0, 0);
+}
+
+#define NUM_PUZZLE_CODES	13
 static const uint8_t PUZZLE_CODES[] = {
 	2, 1, 1, 8,
 	1, 5, 2, 5,
@@ -548,9 +440,14 @@ static const uint8_t PUZZLE_CODES[] = {
 	1, 2, 3, 4,
 	6, 5, 4, 3,
 	1, 1, 1, 1,
+	2, 7, 1, 8,
 };
 _Static_assert(sizeof(PUZZLE_CODES) == NUM_PUZZLE_CODES * 4, "Wrong NUM_PUZZLE_CODES");
-_Static_assert(NUM_PUZZLE_CODES <= 32, "Too many codes");
+
+// Modes after the puzzle ones show off the LED effects (see effects.h). They have no
+// code and aren't part of the game, only "debug __unlock_patterns" unlocks them
+#define NUM_BLINKY_MODES	(NUM_PUZZLE_CODES + 3)
+_Static_assert(NUM_BLINKY_MODES <= 32, "Too many modes");
 
 // buttons from the *FRONT*
 //   /      \
@@ -558,7 +455,7 @@ _Static_assert(NUM_PUZZLE_CODES <= 32, "Too many codes");
 // / 4      2 \
 // ------------
 
-// should run at every 64 ms as long as we didn't take too long
+// should run at every ANIM_TICK_MS as long as we didn't take too long
 static void game_loop(void) {
 	// mode -1	==> puzzle code input
 	// mode 0	==> sound/neighbor reactive mode
@@ -573,6 +470,9 @@ static void game_loop(void) {
 		did_init_unlocked_blinky_patterns = 1;
 	}
 
+	const int nleds = get_num_leds();
+	const uint32_t anim_tick = get_anim_clock_ms() / ANIM_TICK_MS;
+
 	static int last_buttons = 0;
 	int this_buttons = read_all_buttons();
 
@@ -617,7 +517,7 @@ static void game_loop(void) {
 
 				}
 
-				for (int i = 0; i < NLEDS; i++)
+				for (int i = 0; i < nleds; i++)
 					set_led(i, 0, 0, 0);
 				mode_changed = 1;
 				printk("badge mode is now %d\n", badge_main_mode);
@@ -627,17 +527,17 @@ static void game_loop(void) {
 				// go up and find the next unlocked pattern
 				// if there isn't one, go to mode 0
 				int i;
-				for (i = badge_main_mode + 1; i <= NUM_PUZZLE_CODES; i++) {
+				for (i = badge_main_mode + 1; i <= NUM_BLINKY_MODES; i++) {
 					if (unlocked_blinky_patterns & (1 << (i - 1)))
 						break;
 				}
 
-				if (i == NUM_PUZZLE_CODES + 1)
+				if (i == NUM_BLINKY_MODES + 1)
 					badge_main_mode = 0;
 				else
 					badge_main_mode = i;
 
-				for (int i = 0; i < NLEDS; i++)
+				for (int i = 0; i < nleds; i++)
 					set_led(i, 0, 0, 0);
 				mode_changed = 1;
 				printk("badge mode is now %d\n", badge_main_mode);
@@ -753,6 +653,9 @@ static void game_loop(void) {
 		set_led(19, 0, 0, 0);
 		set_led(20, 0, 0, 0);
 
+		for (int i = NLEDS; i < nleds; i++)
+			set_led(i, 0, 0, 0);
+
 		int matched_code = -1;
 		for (int i = 0; i < NUM_PUZZLE_CODES; i++) {
 			if (code0 == PUZZLE_CODES[i*4+0] &&
@@ -770,10 +673,11 @@ static void game_loop(void) {
 
 			unlocked_blinky_patterns |= (1 << matched_code);
 			badge_main_mode = matched_code + 1;
+			mode_changed = 1;
 			nvs_set_unlocked_blinky_patterns(unlocked_blinky_patterns);
 			badge_nfc_set_msg_puzzle(unlocked_blinky_patterns);
 			printk("unlocked patterns are now %08X\n", unlocked_blinky_patterns);
-			for (int i = 0; i < NLEDS; i++)
+			for (int i = 0; i < nleds; i++)
 				set_led(i, 0, 0, 0);
 			printk("badge mode is now %d\n", badge_main_mode);
 		}
@@ -809,22 +713,22 @@ static void game_loop(void) {
 				//  Grape Jelly
 				// with Dory Tint and Malibu Tint fading to black and then to the next color for eyes
 				random_twinkle_loop(5, twinkle_colors_4, 4);
-				eye_fade_loop(2, eye_colors_4, mode_changed);
+				eye_fade_loop(ARRAY_SIZE(eye_colors_4) / 3, eye_colors_4, mode_changed);
 				break;
 			case 5:
 				// Color Wipe Grape Jelly
 				// hulk pants eyes (slow fades)
-				color_wipe_loop();
-				eye_fade_loop(1, eye_colors_5, mode_changed);
+				color_wipe_loop(anim_tick);
+				eye_fade_loop(ARRAY_SIZE(eye_colors_5) / 3, eye_colors_5, mode_changed);
 				break;
 			case 6:
 				// Rainbow cycle
-				rainbow_cycle_loop();
+				rainbow_cycle_loop(anim_tick);
 				break;
 			case 7:
 				// Cylon on bottom of the mascot with the rest of the logo lit Grape Jelly
 				// and red eyes
-				cylon_loop();
+				cylon_loop(anim_tick);
 				set_left_eye(1024, 0, 0);
 				set_right_eye(1024, 0, 0);
 				break;
@@ -836,13 +740,13 @@ static void game_loop(void) {
 				break;
 			case 9:
 				// Fading in and out Grape Jelly at a full (reasonable) brightness and the next one half that, slowly
-				fade_purples_loop();
+				fade_purples_loop(anim_tick);
 				radio_neighbor_eye_loop();
 				break;
 			case 10:
 				// Ukraine Support mode
 				// Alternate Tumeric and Dory every other light and fade them in and out slowly
-				fade_ukraine_loop();
+				fade_ukraine_loop(anim_tick);
 				radio_neighbor_eye_loop();
 				break;
 			case 11:
@@ -856,11 +760,33 @@ static void game_loop(void) {
 				break;
 			case 12:
 				// Plain black mascot (no light) with dim white eyes
-				for (int i = 0; i < NLEDS; i++)
+				for (int i = 0; i < nleds; i++)
 					set_led(i, 0, 0, 0);
 				set_left_eye(64, 64, 64);
 				set_right_eye(64, 64, 64);
 				break;
+			case 13:
+				// How many different badges have been met, on a log scale around the ring
+				badges_met_loop();
+				radio_neighbor_eye_loop();
+				break;
+			case 14:
+				// Ripples from the mouth on loud sounds
+				effect_sound_ripples(sound_get_level());
+				for (int i = NLEDS; i < nleds; i++)
+					set_led(i, 0, 0, 0);
+				radio_neighbor_eye_loop();
+				break;
+			case 15:
+				// Bands of color rippling out from the eyes
+				ripple_loop(anim_tick);
+				radio_neighbor_eye_loop();
+				break;
+			case 16:
+				// A Malibu bar sweeping across the mascot and back, then down and up
+				sweep_loop(anim_tick);
+				radio_neighbor_eye_loop();
+				break;
 		}
 	}
 
@@ -877,6 +803,9 @@ void main(void)
 		printk("NVS setup failed: %d\n", ret);
 		return;
 	}
+	// the badge works fine without it
+	if ((ret = enclog_setup()))
+		printk("Encounter log setup failed: %d\n", ret);
 
 	if ((ret = badge_usb_setup())) {
 		printk("USB setup failed: %d\n", ret);
@@ -892,6 +821,7 @@ void main(void)
 		printk("LED setup failed: %d\n", ret);
 		return;
 	}
+	set_num_leds(nvs_get_num_leds());
 
 	if ((ret = setup_buttons())) {
 		printk("Button setup failed: %d\n", ret);
@@ -925,6 +855,12 @@ void main(void)
 	int factory_chaser_idx = 0;
 
 	while (1) {
+		// a host running the test over USB (see factory.h) goes ahead of the buttons
+		if (factory_mode_ != factory_completed && factory_poll()) {
+			factory_mode_ = nvs_get_factory();
+			continue;
+		}
+
 		switch (factory_mode_) {
 			case factory_before_sw1:
 			default:
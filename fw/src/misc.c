@@ -1,11 +1,16 @@
 // Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
 // See LICENSE file in project root for terms.
 
+#include <errno.h>
+#include <string.h>
+#include <zephyr.h>
 #include <devicetree.h>
 #include <drivers/gpio.h>
-#include <drivers/pwm.h>
 #include <drivers/spi.h>
+#include <nrfx_pwm.h>
+#include <sys/util.h>
 
+#include "color.h"
 #include "misc.h"
 
 ////////// BUTTONS //////////
@@ -41,82 +46,434 @@ int read_all_buttons() {
 
 ////////// EYES //////////
 
+// The eye PWMs are driven through nrfx rather than the Zephyr PWM driver
+// so that whole fade curves can be handed to the peripheral and played back
+// by EasyDMA, without the CPU touching every step
+
 #define LEFT_EYE_PWM_NODE DT_NODELABEL(left_eye_pwm)
 #define LEFT_R_PWM_PIN DT_PROP(LEFT_EYE_PWM_NODE, ch0_pin)
-#define LEFT_R_PWM_FLAGS DT_PWMS_FLAGS(LEFT_EYE_PWM_NODE)
 #define LEFT_G_PWM_PIN DT_PROP(LEFT_EYE_PWM_NODE, ch1_pin)
-#define LEFT_G_PWM_FLAGS DT_PWMS_FLAGS(LEFT_EYE_PWM_NODE)
 #define LEFT_B_PWM_PIN DT_PROP(LEFT_EYE_PWM_NODE, ch2_pin)
-#define LEFT_B_PWM_FLAGS DT_PWMS_FLAGS(LEFT_EYE_PWM_NODE)
 
 #define RIGHT_EYE_PWM_NODE DT_NODELABEL(right_eye_pwm)
 #define RIGHT_R_PWM_PIN DT_PROP(RIGHT_EYE_PWM_NODE, ch0_pin)
-#define RIGHT_R_PWM_FLAGS DT_PWMS_FLAGS(RIGHT_EYE_PWM_NODE)
 #define RIGHT_G_PWM_PIN DT_PROP(RIGHT_EYE_PWM_NODE, ch1_pin)
-#define RIGHT_G_PWM_FLAGS DT_PWMS_FLAGS(RIGHT_EYE_PWM_NODE)
 #define RIGHT_B_PWM_PIN DT_PROP(RIGHT_EYE_PWM_NODE, ch2_pin)
-#define RIGHT_B_PWM_FLAGS DT_PWMS_FLAGS(LEFT_EYE_PWM_NODE)
 
-static const struct device *const left_pwm_dev = DEVICE_DT_GET(LEFT_EYE_PWM_NODE);
-static const struct device *const right_pwm_dev = DEVICE_DT_GET(RIGHT_EYE_PWM_NODE);
+// left_eye_pwm is pwm0, right_eye_pwm is pwm1
+static const nrfx_pwm_t left_pwm = NRFX_PWM_INSTANCE(0);
+static const nrfx_pwm_t right_pwm = NRFX_PWM_INSTANCE(1);
+
+// The LEDs are active low, so the pin is high for the "off" part of the period
+// (same waveform as the old pwm_pin_set_usec(EYE_MAX_VAL - x) calls)
+#define EYE_PWM_VALUE(x)	((EYE_MAX_VAL - (x)) | 0x8000)
+
+struct eye {
+	const nrfx_pwm_t *pwm;
+	// value used for set_*_eye()
+	nrf_pwm_values_individual_t static_val;
+	int static_playing;
+	// curve used for fade_*_eye()
+	nrf_pwm_values_individual_t seq[EYE_SEQ_MAX_LEN];
+	int fade_playing;
+	int fade_loops;
+};
+
+static struct eye left_eye = { .pwm = &left_pwm };
+static struct eye right_eye = { .pwm = &right_pwm };
+
+static int setup_eye(struct eye *eye, uint8_t r_pin, uint8_t g_pin, uint8_t b_pin) {
+	// pins idle high (LED off) whenever the PWM is stopped
+	nrfx_pwm_config_t config = NRFX_PWM_DEFAULT_CONFIG(
+		r_pin | NRFX_PWM_PIN_INVERTED,
+		g_pin | NRFX_PWM_PIN_INVERTED,
+		b_pin | NRFX_PWM_PIN_INVERTED,
+		NRFX_PWM_PIN_NOT_USED);
+	// 1 us per count, so one period is EYE_MAX_VAL us
+	config.base_clock = NRF_PWM_CLK_1MHz;
+	config.count_mode = NRF_PWM_MODE_UP;
+	config.top_value = EYE_MAX_VAL;
+	config.load_mode = NRF_PWM_LOAD_INDIVIDUAL;
+	config.step_mode = NRF_PWM_STEP_AUTO;
+
+	// no handler, we poll for the end of a fade instead
+	if (nrfx_pwm_init(eye->pwm, &config, NULL, NULL) != NRFX_SUCCESS) return -1;
+
+	return 0;
+}
 
 int setup_eyes() {
-	if (!device_is_ready(left_pwm_dev)) return -1;
-	if (!device_is_ready(right_pwm_dev)) return -1;
+	int ret;
+
+	ret = setup_eye(&left_eye, LEFT_R_PWM_PIN, LEFT_G_PWM_PIN, LEFT_B_PWM_PIN);
+	if (ret) return ret;
+	ret = setup_eye(&right_eye, RIGHT_R_PWM_PIN, RIGHT_G_PWM_PIN, RIGHT_B_PWM_PIN);
+	if (ret) return ret;
 
 	return 0;
 }
 
+static void set_eye(struct eye *eye, int r, int g, int b) {
+	uint16_t r_ = EYE_PWM_VALUE(r);
+	uint16_t g_ = EYE_PWM_VALUE(g);
+	uint16_t b_ = EYE_PWM_VALUE(b);
+
+	// most patterns set the same color every tick, don't restart the PWM for that
+	if (eye->static_playing &&
+		eye->static_val.channel_0 == r_ &&
+		eye->static_val.channel_1 == g_ &&
+		eye->static_val.channel_2 == b_)
+		return;
+
+	eye->static_val.channel_0 = r_;
+	eye->static_val.channel_1 = g_;
+	eye->static_val.channel_2 = b_;
+	eye->static_val.channel_3 = 0;
+
+	nrf_pwm_sequence_t seq = {
+		.values.p_individual = &eye->static_val,
+		.length = NRF_PWM_VALUES_LENGTH(eye->static_val),
+		.repeats = 0,
+		.end_delay = 0,
+	};
+
+	// the last value keeps being output once the sequence ends
+	nrfx_pwm_simple_playback(eye->pwm, &seq, 1, 0);
+	eye->static_playing = 1;
+	eye->fade_playing = 0;
+}
+
 void set_left_eye(int r, int g, int b) {
-	pwm_pin_set_usec(left_pwm_dev, LEFT_R_PWM_PIN, EYE_MAX_VAL, EYE_MAX_VAL - r, LEFT_R_PWM_FLAGS);
-	pwm_pin_set_usec(left_pwm_dev, LEFT_G_PWM_PIN, EYE_MAX_VAL, EYE_MAX_VAL - g, LEFT_G_PWM_FLAGS);
-	pwm_pin_set_usec(left_pwm_dev, LEFT_B_PWM_PIN, EYE_MAX_VAL, EYE_MAX_VAL - b, LEFT_B_PWM_FLAGS);
+	set_eye(&left_eye, r, g, b);
 }
 
 void set_right_eye(int r, int g, int b) {
-	pwm_pin_set_usec(right_pwm_dev, RIGHT_R_PWM_PIN, EYE_MAX_VAL, EYE_MAX_VAL - r, RIGHT_R_PWM_FLAGS);
-	pwm_pin_set_usec(right_pwm_dev, RIGHT_G_PWM_PIN, EYE_MAX_VAL, EYE_MAX_VAL - g, RIGHT_G_PWM_FLAGS);
-	pwm_pin_set_usec(right_pwm_dev, RIGHT_B_PWM_PIN, EYE_MAX_VAL, EYE_MAX_VAL - b, RIGHT_B_PWM_FLAGS);
+	set_eye(&right_eye, r, g, b);
+}
+
+static inline void set_eye_seq(nrf_pwm_values_individual_t *val, const uint16_t *color, int level) {
+	val->channel_0 = EYE_PWM_VALUE(color_scale(color[0], level));
+	val->channel_1 = EYE_PWM_VALUE(color_scale(color[1], level));
+	val->channel_2 = EYE_PWM_VALUE(color_scale(color[2], level));
+	val->channel_3 = 0;
+}
+
+static int fade_eye(struct eye *eye, int num_colors, const uint16_t *colors, int num_steps, int step_ms, int loop) {
+	int len = num_colors * num_steps * 3;
+	if (num_colors < 1 || num_steps < 1 || num_steps > COLOR_RECIP_MAX || len > EYE_SEQ_MAX_LEN) {
+		printk("Eye fade of %d colors x %d steps doesn't fit (at most %d x %d)\n",
+			num_colors, num_steps, EYE_FADE_MAX_COLORS, EYE_FADE_MAX_STEPS);
+		return -EINVAL;
+	}
+
+	// each entry is held for this many PWM periods
+	int periods = step_ms * 1000 / EYE_MAX_VAL;
+	if (periods < 1) periods = 1;
+
+	nrfx_pwm_stop(eye->pwm, true);
+
+	nrf_pwm_values_individual_t *val = eye->seq;
+	for (int i = 0; i < num_colors; i++) {
+		const uint16_t *color = &colors[i * 3];
+
+		// dark
+		for (int step = 0; step < num_steps; step++)
+			set_eye_seq(val++, color, 0);
+		// up
+		for (int step = 1; step <= num_steps; step++)
+			set_eye_seq(val++, color, color_fade_level(step, num_steps));
+		// down
+		for (int step = num_steps - 1; step >= 0; step--)
+			set_eye_seq(val++, color, color_fade_level(step, num_steps));
+	}
+
+	nrf_pwm_sequence_t seq = {
+		.values.p_individual = eye->seq,
+		.length = len * NRF_PWM_VALUES_LENGTH(eye->seq[0]),
+		.repeats = periods - 1,
+		.end_delay = 0,
+	};
+
+	nrfx_pwm_simple_playback(eye->pwm, &seq, 1, loop ? NRFX_PWM_FLAG_LOOP : NRFX_PWM_FLAG_STOP);
+	eye->static_playing = 0;
+	eye->fade_playing = 1;
+	eye->fade_loops = loop;
+
+	return 0;
+}
+
+int fade_left_eye(int num_colors, const uint16_t *colors, int num_steps, int step_ms, int loop) {
+	return fade_eye(&left_eye, num_colors, colors, num_steps, step_ms, loop);
+}
+
+int fade_right_eye(int num_colors, const uint16_t *colors, int num_steps, int step_ms, int loop) {
+	return fade_eye(&right_eye, num_colors, colors, num_steps, step_ms, loop);
+}
+
+static int eye_fade_busy_(struct eye *eye) {
+	if (!eye->fade_playing || eye->fade_loops)
+		return 0;
+
+	if (nrfx_pwm_is_stopped(eye->pwm)) {
+		eye->fade_playing = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+int eyes_running() {
+	return (nrfx_pwm_is_stopped(left_eye.pwm) ? 0 : 1) | (nrfx_pwm_is_stopped(right_eye.pwm) ? 0 : 2);
+}
+
+int eye_fade_busy() {
+	// evaluate both, so that both get their state updated
+	int left_busy = eye_fade_busy_(&left_eye);
+	int right_busy = eye_fade_busy_(&right_eye);
+	return left_busy || right_busy;
 }
 
 ////////// MAIN LEDS //////////
 
-#define LED_BUF_SZ	(NLEDS * 4 + 12)
-static uint8_t led_buf[LED_BUF_SZ];
+// Pixels are kept in 8.8 fixed point (of the usual 8-bit color at LED_BRIGHTNESS)
+// and only turned into APA102 frames LED_CHUNK_LEDS at a time while sending,
+// so that long chains don't need the whole frame in one DMA buffer
+// The render loop draws into led_pixels, update_leds() copies the finished frame
+// to led_front, which is what gets sent, so a resend never shows half a frame
+static uint16_t led_pixels[NLEDS_MAX][3];
+static uint16_t led_front[NLEDS_MAX][3];
+static int num_leds = NLEDS;
+static int num_front_leds;
+
+#define LED_CHUNK_LEDS	64
+static uint8_t led_chunk[LED_CHUNK_LEDS * 4];
+
+// APA102 needs half a clock per LED after the last pixel to push the data
+// all the way down the chain, SK9822 additionally needs 32 bits to latch
+#define LED_END_FRAME_SZ(n)	(4 + DIV_ROUND_UP(n, 16))
+static const uint8_t led_start_frame[4];
+static const uint8_t led_end_frame[LED_END_FRAME_SZ(NLEDS_MAX)];
 
 // [0-31]
 #define LED_BRIGHTNESS	2
 
+// Dithered rendering: each pixel gets the smallest 5-bit global brightness
+// that fits it (up to LED_BRIGHTNESS) so that dim colors keep more PWM steps,
+// and the leftover fraction is carried over to the next frame.
+// This needs frames much faster than the render loop, so a separate thread
+// keeps resending the current frame, but only while it has fractions in it
+// (set_led_fine()), otherwise update_leds() sends each frame once as usual.
+#define LED_DITHER_PERIOD_MS	5
+#define LED_SPI_FREQ			1000000
+#define LED_SPI_FREQ_DITHER		4000000
+static uint8_t led_dither_err[NLEDS_MAX][3];
+static int led_dither = 1;
+// if the current frame has fine levels in it
+static int led_front_fine;
+K_SEM_DEFINE(led_dither_sem, 0, 1);
+
+// a frame goes out in several transfers, don't let the two senders interleave,
+// also guards led_front
+K_MUTEX_DEFINE(led_spi_mutex);
+
+static struct led_stats led_stats;
+static uint32_t led_last_frame_start;
+
 static const struct device *const spi_leds = DEVICE_DT_GET(DT_NODELABEL(spi_leds));
 
-int setup_leds() {
-	if (!device_is_ready(spi_leds)) return -1;
-	return 0;
+int get_num_leds() {
+	return num_leds;
+}
+
+void set_num_leds(int n) {
+	if (n < NLEDS) n = NLEDS;
+	if (n > NLEDS_MAX) n = NLEDS_MAX;
+
+	// don't show stale data on newly added LEDs
+	for (int i = num_leds; i < n; i++) {
+		led_pixels[i][0] = 0;
+		led_pixels[i][1] = 0;
+		led_pixels[i][2] = 0;
+	}
+
+	num_leds = n;
 }
 
 void set_led(int idx, int r, int g, int b) {
-	led_buf[4 + idx*4 + 0] = 0xE0 | LED_BRIGHTNESS;
-	led_buf[4 + idx*4 + 1] = b;
-	led_buf[4 + idx*4 + 2] = g;
-	led_buf[4 + idx*4 + 3] = r;
+	led_pixels[idx][0] = r << 8;
+	led_pixels[idx][1] = g << 8;
+	led_pixels[idx][2] = b << 8;
 }
 
-void update_leds() {
+void set_led_fine(int idx, int r, int g, int b) {
+	led_pixels[idx][0] = r;
+	led_pixels[idx][1] = g;
+	led_pixels[idx][2] = b;
+}
+
+static void encode_leds(uint8_t *out, int first, int count) {
+	for (int i = first; i < first + count; i++) {
+		*out++ = 0xE0 | LED_BRIGHTNESS;
+		*out++ = led_front[i][2] >> 8;
+		*out++ = led_front[i][1] >> 8;
+		*out++ = led_front[i][0] >> 8;
+	}
+}
+
+static inline uint8_t dither_channel(uint32_t t, uint32_t recip, uint8_t *err) {
+	// t / global brightness, in 8.8 fixed point, plus what was left over last frame
+	uint32_t c = (uint32_t)(((uint64_t)t * recip) >> 16) + *err;
+	if (c >= 0xFF00) {
+		*err = 0;
+		return 0xFF;
+	}
+	*err = c & 0xFF;
+	return c >> 8;
+}
+
+static void encode_leds_dither(uint8_t *out, int first, int count) {
+	for (int i = first; i < first + count; i++) {
+		// intensity in units of (8-bit color * global brightness), 8.8 fixed point
+		uint32_t r = led_front[i][0] * LED_BRIGHTNESS;
+		uint32_t g = led_front[i][1] * LED_BRIGHTNESS;
+		uint32_t b = led_front[i][2] * LED_BRIGHTNESS;
+
+		uint32_t max = MAX(r, MAX(g, b));
+		uint32_t bright = 1;
+		while (bright < LED_BRIGHTNESS && max > bright * 0xFF00)
+			bright++;
+
+		uint32_t recip = color_recip_lut[bright];
+		*out++ = 0xE0 | bright;
+		*out++ = dither_channel(b, recip, &led_dither_err[i][2]);
+		*out++ = dither_channel(g, recip, &led_dither_err[i][1]);
+		*out++ = dither_channel(r, recip, &led_dither_err[i][0]);
+	}
+}
+
+// Sends led_front, with led_spi_mutex held
+static void send_leds(int dither) {
 	struct spi_config spi_cfg = {0};
 	spi_cfg.operation = SPI_WORD_SET(8);
-	spi_cfg.frequency = 1000000;
-
-	struct spi_buf bufs[] = {
-		{
-			.buf = led_buf,
-			.len = sizeof(led_buf),
-		},
-	};
+	spi_cfg.frequency = dither ? LED_SPI_FREQ_DITHER : LED_SPI_FREQ;
 
+	struct spi_buf bufs[3];
 	struct spi_buf_set tx = {
 		.buffers = bufs,
-		.count = 1,
 	};
 
-	spi_write(spi_leds, &spi_cfg, &tx);
+	uint32_t frame_start = k_cycle_get_32();
+	uint32_t encode_cycles = 0;
+	int n = num_front_leds;
+
+	// measured rather than assumed, the refresh thread can be held up
+	if (led_stats.frames && frame_start - led_last_frame_start > led_stats.gap_max_cycles)
+		led_stats.gap_max_cycles = frame_start - led_last_frame_start;
+	led_last_frame_start = frame_start;
+
+	for (int first = 0; first < n; first += LED_CHUNK_LEDS) {
+		int count = MIN(n - first, LED_CHUNK_LEDS);
+
+		uint32_t encode_start = k_cycle_get_32();
+		if (dither)
+			encode_leds_dither(led_chunk, first, count);
+		else
+			encode_leds(led_chunk, first, count);
+		encode_cycles += k_cycle_get_32() - encode_start;
+
+		// the start and end frames ride along with the first and last chunks
+		tx.count = 0;
+		if (first == 0) {
+			bufs[tx.count].buf = (void *)led_start_frame;
+			bufs[tx.count].len = sizeof(led_start_frame);
+			tx.count++;
+		}
+		bufs[tx.count].buf = led_chunk;
+		bufs[tx.count].len = count * 4;
+		tx.count++;
+		if (first + count == n) {
+			bufs[tx.count].buf = (void *)led_end_frame;
+			bufs[tx.count].len = LED_END_FRAME_SZ(n);
+			tx.count++;
+		}
+
+		if (spi_write(spi_leds, &spi_cfg, &tx))
+			led_stats.errors++;
+	}
+
+	led_stats.frames++;
+	led_stats.encode_cycles += encode_cycles;
+	led_stats.frame_cycles += k_cycle_get_32() - frame_start;
+}
+
+void update_leds() {
+	k_mutex_lock(&led_spi_mutex, K_FOREVER);
+	int n = num_leds;
+	int fine = 0;
+	for (int i = 0; i < n; i++) {
+		led_front[i][0] = led_pixels[i][0];
+		led_front[i][1] = led_pixels[i][1];
+		led_front[i][2] = led_pixels[i][2];
+		fine |= (led_pixels[i][0] | led_pixels[i][1] | led_pixels[i][2]) & 0xFF;
+	}
+	num_front_leds = n;
+	led_front_fine = fine != 0;
+
+	if (led_dither && led_front_fine) {
+		// the refresh thread sends it (and keeps sending it)
+		k_mutex_unlock(&led_spi_mutex);
+		k_sem_give(&led_dither_sem);
+		return;
+	}
+	send_leds(0);
+	k_mutex_unlock(&led_spi_mutex);
+}
+
+void set_led_dither(int enable) {
+	led_dither = enable;
+	if (enable)
+		k_sem_give(&led_dither_sem);
+}
+
+int get_led_dither() {
+	return led_dither;
+}
+
+void get_led_stats(struct led_stats *out) {
+	k_mutex_lock(&led_spi_mutex, K_FOREVER);
+	*out = led_stats;
+	memset(&led_stats, 0, sizeof(led_stats));
+	k_mutex_unlock(&led_spi_mutex);
+}
+
+static void led_refresh(void *_0, void *_1, void *_2) {
+	while (1) {
+		k_mutex_lock(&led_spi_mutex, K_FOREVER);
+		int refresh = led_dither && led_front_fine;
+		if (refresh)
+			send_leds(1);
+		k_mutex_unlock(&led_spi_mutex);
+
+		if (!refresh)
+			k_sem_take(&led_dither_sem, K_FOREVER);
+		else
+			k_msleep(LED_DITHER_PERIOD_MS);
+	}
+}
+
+K_THREAD_STACK_DEFINE(led_refresh_thread_stack, 512);
+static struct k_thread led_refresh_thread;
+
+int setup_leds() {
+	if (!device_is_ready(spi_leds)) return -1;
+
+	k_thread_create(
+		&led_refresh_thread,
+		led_refresh_thread_stack,
+		K_THREAD_STACK_SIZEOF(led_refresh_thread_stack),
+		led_refresh,
+		NULL, NULL, NULL,
+		12, 0, K_NO_WAIT);
+
+	return 0;
 }
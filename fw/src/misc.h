@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 int setup_buttons();
 int read_all_buttons();
 
@@ -11,7 +13,48 @@ int setup_eyes();
 void set_left_eye(int r, int g, int b);
 void set_right_eye(int r, int g, int b);
 
+// Hardware-sequenced fades, played back by the PWM peripheral without the CPU
+// For each color in turn: dark for num_steps steps, up for num_steps steps, down for num_steps steps
+// Each step is held for step_ms. Calling set_*_eye() stops the fade.
+// Sized for the longest fade in main.c (8 bytes per entry per eye), longer ones
+// are refused with -EINVAL and a message on the console
+#define EYE_FADE_MAX_COLORS 2
+#define EYE_FADE_MAX_STEPS 32
+#define EYE_SEQ_MAX_LEN (EYE_FADE_MAX_COLORS * EYE_FADE_MAX_STEPS * 3)
+int fade_left_eye(int num_colors, const uint16_t *colors, int num_steps, int step_ms, int loop);
+int fade_right_eye(int num_colors, const uint16_t *colors, int num_steps, int step_ms, int loop);
+// 1 while a non-looping fade is still playing on either eye
+int eye_fade_busy();
+// Which eyes' PWMs are running (1 left, 2 right), they keep going while they show a color
+int eyes_running();
+
+// LEDs on the badge itself
 #define NLEDS 21
+// more APA102 strips can be chained after them, up to this many LEDs in total
+#define NLEDS_MAX CONFIG_BADGE_LEDS_MAX
 int setup_leds();
+int get_num_leds();
+void set_num_leds(int n);
 void set_led(int idx, int r, int g, int b);
+// Same as set_led() but in 8.8 fixed point, the fraction only shows when dithering
+void set_led_fine(int idx, int r, int g, int b);
 void update_leds();
+
+// Dithered rendering (see misc.c), on by default, but it only keeps resending
+// frames while they have fine levels (set_led_fine()) in them
+void set_led_dither(int enable);
+int get_led_dither();
+
+struct led_stats {
+	uint32_t frames;
+	// both summed over all frames, in k_cycle_get_32() cycles (64 bits, frames can
+	// take most of the time, and 32 bits of cycles is only ~67 s)
+	uint64_t encode_cycles;
+	uint64_t frame_cycles;
+	// longest time from the start of one frame to the next
+	uint32_t gap_max_cycles;
+	// SPI writes that failed
+	uint32_t errors;
+};
+// Counts since the last call
+void get_led_stats(struct led_stats *out);
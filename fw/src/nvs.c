@@ -1,11 +1,14 @@
 // Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
 // See LICENSE file in project root for terms.
 
+#include <string.h>
 #include <zephyr.h>
 #include <device.h>
 #include <storage/flash_map.h>
 #include <fs/nvs.h>
 
+#include "hll.h"
+#include "misc.h"
 #include "nvs.h"
 
 static struct nvs_fs fs;
@@ -29,6 +32,9 @@ int nvs_setup() {
 
 #define NVS_ID_FACTORY	1
 #define NVS_ID_PATTERNS	2
+#define NVS_ID_NUM_LEDS	3
+#define NVS_ID_HLL	4
+#define NVS_ID_FACTORY_RESULTS	5
 
 enum factory_mode nvs_get_factory() {
 	uint32_t mode = factory_before_sw1;
@@ -47,6 +53,16 @@ void nvs_set_factory(enum factory_mode mode) {
 	(void)nvs_write(&fs, NVS_ID_FACTORY, &mode_, sizeof(mode_));
 }
 
+void nvs_get_factory_results(struct factory_results *results) {
+	int ret = nvs_read(&fs, NVS_ID_FACTORY_RESULTS, results, sizeof(*results));
+	if (ret != sizeof(*results))
+		memset(results, 0, sizeof(*results));
+}
+
+void nvs_set_factory_results(const struct factory_results *results) {
+	(void)nvs_write(&fs, NVS_ID_FACTORY_RESULTS, results, sizeof(*results));
+}
+
 uint32_t nvs_get_unlocked_blinky_patterns() {
 	uint32_t patterns = 0;
 	int ret = nvs_read(&fs, NVS_ID_PATTERNS, &patterns, sizeof(patterns));
@@ -62,3 +78,31 @@ uint32_t nvs_get_unlocked_blinky_patterns() {
 void nvs_set_unlocked_blinky_patterns(uint32_t patterns) {
 	(void)nvs_write(&fs, NVS_ID_PATTERNS, &patterns, sizeof(patterns));
 }
+
+int nvs_get_num_leds() {
+	uint32_t num_leds = NLEDS;
+	int ret = nvs_read(&fs, NVS_ID_NUM_LEDS, &num_leds, sizeof(num_leds));
+	if (ret > 0) {
+		printk("NVS number of LEDs: %d\n", num_leds);
+	}
+
+	return num_leds;
+}
+
+void nvs_set_num_leds(int num_leds) {
+	uint32_t num_leds_ = num_leds;
+	(void)nvs_write(&fs, NVS_ID_NUM_LEDS, &num_leds_, sizeof(num_leds_));
+}
+
+void nvs_get_hll(struct hll *hll) {
+	int ret = nvs_read(&fs, NVS_ID_HLL, hll->regs, sizeof(hll->regs));
+	if (ret != sizeof(hll->regs)) {
+		printk("No NVS badges met sketch found\n");
+		hll_init(hll);
+	}
+}
+
+void nvs_set_hll(const struct hll *hll) {
+	// (NVS itself skips the write if nothing changed)
+	(void)nvs_write(&fs, NVS_ID_HLL, hll->regs, sizeof(hll->regs));
+}
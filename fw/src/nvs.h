@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "hll.h"
+
 int nvs_setup();
 
 enum factory_mode {
@@ -38,5 +40,23 @@ enum factory_mode {
 enum factory_mode nvs_get_factory();
 void nvs_set_factory(enum factory_mode mode);
 
+// What the USB-driven production test (see factory.h) has found so far
+struct factory_results {
+	// bitmask of the enum factory_stage stages that passed
+	uint32_t passed;
+	// mic signal to noise ratio in 0.1 dB, from the last mic stage
+	int32_t mic_snr;
+};
+void nvs_get_factory_results(struct factory_results *results);
+void nvs_set_factory_results(const struct factory_results *results);
+
 uint32_t nvs_get_unlocked_blinky_patterns();
 void nvs_set_unlocked_blinky_patterns(uint32_t patterns);
+
+// Total number of LEDs including any chained strips
+int nvs_get_num_leds();
+void nvs_set_num_leds(int num_leds);
+
+// Sketch of all the badges ever met
+void nvs_get_hll(struct hll *hll);
+void nvs_set_hll(const struct hll *hll);
@@ -0,0 +1,168 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <string.h>
+
+#include "peers.h"
+
+#define SLOT_MASK	(PEER_TABLE_SIZE - 1)
+
+static unsigned int peer_hash(const uint8_t *addr) {
+	// BLE random addresses are already random, so a multiplicative hash of the
+	// address bytes is plenty (the type byte is left out)
+	uint32_t lo = addr[1] | (addr[2] << 8) | (addr[3] << 16) | ((uint32_t)addr[4] << 24);
+	uint32_t hi = addr[5] | (addr[6] << 8);
+	uint32_t h = (lo ^ (hi * 0x85ebca6bu)) * 0x9e3779b1u;
+	return h >> (32 - PEER_TABLE_BITS);
+}
+
+static void count(struct peer_table *table, uint8_t type, int delta) {
+	table->num_peers += delta;
+	if (type == PEER_TYPE_EASTEREGG)
+		table->num_badge_makers += delta;
+	else if (type != PEER_TYPE_BADGE)
+		table->num_imposters += delta;
+}
+
+// Empties slot i and shifts the rest of its run back so that lookups don't need tombstones
+static void remove_slot(struct peer_table *table, unsigned int i) {
+	if (table->on_remove)
+		table->on_remove(&table->slots[i]);
+	count(table, table->slots[i].type, -1);
+
+	unsigned int hole = i;
+	unsigned int j = i;
+	while (1) {
+		j = (j + 1) & SLOT_MASK;
+		struct peer_entry *e = &table->slots[j];
+		if (e->type == PEER_TYPE_EMPTY)
+			break;
+
+		// can move e into the hole only if the hole is between its home slot and j
+		unsigned int home = peer_hash(e->addr);
+		if (((j - home) & SLOT_MASK) >= ((j - hole) & SLOT_MASK)) {
+			table->slots[hole] = *e;
+			hole = j;
+		}
+	}
+	table->slots[hole].type = PEER_TYPE_EMPTY;
+}
+
+void peers_init(struct peer_table *table) {
+	memset(table, 0, sizeof(*table));
+}
+
+const struct peer_entry *peers_find(const struct peer_table *table, const uint8_t *addr) {
+	unsigned int i = peer_hash(addr);
+	while (table->slots[i].type != PEER_TYPE_EMPTY) {
+		if (!memcmp(table->slots[i].addr, addr, PEER_ADDR_LEN))
+			return &table->slots[i];
+		i = (i + 1) & SLOT_MASK;
+	}
+	return NULL;
+}
+
+int peers_seen(struct peer_table *table, const uint8_t *addr, enum peer_type type, int8_t rssi, uint32_t now) {
+	int ret = 1;
+	unsigned int home = peer_hash(addr);
+	unsigned int i = home;
+
+	while (table->slots[i].type != PEER_TYPE_EMPTY) {
+		if (!memcmp(table->slots[i].addr, addr, PEER_ADDR_LEN)) {
+			table->slots[i].last_seen = now;
+			// (an entry is refreshed at least every max_age, so this never wraps)
+			uint16_t now_s = now / 1000;
+			if ((uint16_t)(now_s - table->slots[i].first_seen_s) > PEER_DURATION_MAX)
+				table->slots[i].first_seen_s = now_s - PEER_DURATION_MAX;
+			if (rssi > table->slots[i].rssi_max)
+				table->slots[i].rssi_max = rssi;
+			return 0;
+		}
+		i = (i + 1) & SLOT_MASK;
+	}
+
+	if (table->num_peers >= PEER_TABLE_MAX_LOAD) {
+		// evict whoever was seen longest ago near where the new peer goes
+		// (keep looking past the window if it happens to be all empty)
+		int oldest = -1;
+		uint32_t oldest_age = 0;
+		for (int k = 0; k < PEER_EVICT_WINDOW || oldest < 0; k++) {
+			unsigned int j = (home + k) & SLOT_MASK;
+			if (table->slots[j].type == PEER_TYPE_EMPTY)
+				continue;
+			uint32_t age = now - table->slots[j].last_seen;
+			if (oldest < 0 || age > oldest_age) {
+				oldest_age = age;
+				oldest = j;
+			}
+		}
+		remove_slot(table, oldest);
+		table->num_evictions++;
+		ret = 2;
+
+		// the run may have shifted
+		i = home;
+		while (table->slots[i].type != PEER_TYPE_EMPTY)
+			i = (i + 1) & SLOT_MASK;
+	}
+
+	memcpy(table->slots[i].addr, addr, PEER_ADDR_LEN);
+	table->slots[i].type = type;
+	table->slots[i].last_seen = now;
+	table->slots[i].first_seen_s = now / 1000;
+	table->slots[i].rssi_max = rssi;
+	count(table, type, 1);
+	return ret;
+}
+
+int peers_expire(struct peer_table *table, uint32_t now, uint32_t max_age, uint32_t *oldest_seen) {
+	int removed = 0;
+	uint32_t oldest_age = 0;
+
+	for (unsigned int i = 0; i < PEER_TABLE_SIZE; ) {
+		struct peer_entry *e = &table->slots[i];
+		if (e->type != PEER_TYPE_EMPTY) {
+			uint32_t age = now - e->last_seen;
+			if (age >= max_age) {
+				remove_slot(table, i);
+				removed++;
+				// something else may have been shifted into slot i
+				continue;
+			}
+			if (age > oldest_age)
+				oldest_age = age;
+		}
+		i++;
+	}
+
+	*oldest_seen = now - oldest_age;
+	return removed;
+}
+
+// Fields are accessed with relaxed atomics so that a torn read is merely discarded
+// rather than undefined, the fences order them against seq
+void peers_publish(const struct peer_table *table, struct peer_counts_snapshot *snap) {
+	uint32_t seq = __atomic_load_n(&snap->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&snap->counts.num_peers, table->num_peers, __ATOMIC_RELAXED);
+	__atomic_store_n(&snap->counts.num_imposters, table->num_imposters, __ATOMIC_RELAXED);
+	__atomic_store_n(&snap->counts.num_badge_makers, table->num_badge_makers, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void peers_read(const struct peer_counts_snapshot *snap, struct peer_counts *out) {
+	uint32_t seq0, seq1;
+	do {
+		seq0 = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+
+		out->num_peers = __atomic_load_n(&snap->counts.num_peers, __ATOMIC_RELAXED);
+		out->num_imposters = __atomic_load_n(&snap->counts.num_imposters, __ATOMIC_RELAXED);
+		out->num_badge_makers = __atomic_load_n(&snap->counts.num_badge_makers, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq1 = __atomic_load_n(&snap->seq, __ATOMIC_RELAXED);
+	} while ((seq0 & 1) || seq0 != seq1);
+}
@@ -0,0 +1,95 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+// Table of nearby devices, keyed on the BLE address
+// Open addressing with linear probing and backward-shift deletion (no tombstones),
+// so lookups, inserts and evictions only ever touch a short run of slots
+// This doesn't depend on Zephyr so that it can be built on the host (see test_peers.py)
+
+// Number of slots, must be a power of 2
+#ifndef PEER_TABLE_BITS
+#define PEER_TABLE_BITS		10
+#endif
+#define PEER_TABLE_SIZE		(1 << PEER_TABLE_BITS)
+// Start evicting above 3/4 full to keep the probe runs short (~8 slots for a miss)
+#define PEER_TABLE_MAX_LOAD	(PEER_TABLE_SIZE - PEER_TABLE_SIZE / 4)
+// On eviction, the oldest of this many slots from where the new peer hashes to is dropped
+// (8 kept only 94-98% of the most recent peers under churn, 16 keeps 98-100%)
+#ifndef PEER_EVICT_WINDOW
+#define PEER_EVICT_WINDOW	16
+#endif
+
+// Same layout as bt_addr_le_t (type followed by the 6 address bytes)
+#define PEER_ADDR_LEN		7
+// Encounters are counted up to this long (in s, ~13.6 hours), first_seen_s is kept from
+// falling further behind so that its 16 bits never wrap around while someone is around
+#define PEER_DURATION_MAX	0xC000
+
+enum peer_type {
+	PEER_TYPE_EMPTY = 0,
+	// no appearance field
+	PEER_TYPE_NO_APPEARANCE = 1,
+	PEER_TYPE_BADGE = 2,
+	PEER_TYPE_EASTEREGG = 3,
+	// wrong appearance (e.g. Android phone)
+	PEER_TYPE_SPOOFED = 4,
+};
+
+// 16 bytes
+struct peer_entry {
+	uint8_t addr[PEER_ADDR_LEN];
+	// enum peer_type
+	uint8_t type;
+	// in ms, wraps around
+	uint32_t last_seen;
+	// in s, wraps around, but at most PEER_DURATION_MAX behind last_seen
+	uint16_t first_seen_s;
+	// strongest advert, i.e. closest it came
+	int8_t rssi_max;
+};
+
+struct peer_table {
+	struct peer_entry slots[PEER_TABLE_SIZE];
+	int num_peers;
+	int num_imposters;
+	int num_badge_makers;
+	uint32_t num_evictions;
+	// if set (after peers_init()), called with every entry about to be expired or evicted
+	void (*on_remove)(const struct peer_entry *e);
+};
+
+void peers_init(struct peer_table *table);
+
+// Records that addr was seen at now, with an advert at rssi
+// Returns 0 if it was already known, 1 if it was added, 2 if it was added by evicting another peer
+int peers_seen(struct peer_table *table, const uint8_t *addr, enum peer_type type, int8_t rssi, uint32_t now);
+
+// Returns the entry for addr or NULL
+const struct peer_entry *peers_find(const struct peer_table *table, const uint8_t *addr);
+
+// Removes everyone not seen in the last max_age ms, returns how many were removed
+// oldest_seen is set to the last_seen of whoever is left that will expire next (now if nobody)
+int peers_expire(struct peer_table *table, uint32_t now, uint32_t max_age, uint32_t *oldest_seen);
+
+// Copy of the counts for readers that must never block (a seqlock)
+// There must only be one writer at a time, and on a single core the writer must not
+// be preemptible by a reader (otherwise the reader spins until it is preempted itself)
+struct peer_counts {
+	int num_peers;
+	int num_imposters;
+	int num_badge_makers;
+};
+struct peer_counts_snapshot {
+	// odd while being written
+	uint32_t seq;
+	struct peer_counts counts;
+};
+
+// Copies the table's current counts into snap
+void peers_publish(const struct peer_table *table, struct peer_counts_snapshot *snap);
+// Retries (without blocking) if it raced with peers_publish()
+void peers_read(const struct peer_counts_snapshot *snap, struct peer_counts *out);
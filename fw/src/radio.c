@@ -4,28 +4,30 @@
 #include <zephyr.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
-
+#include <random/rand32.h>
+
+#include "adv.h"
+#include "enclog.h"
+#include "gatt.h"
+#include "hll.h"
+#include "nvs.h"
+#include "peers.h"
 #include "radio.h"
 
-// This is a trick borrowed from DCFurs
-// Android phones cannot set this value via the API, so we can prevent
-// trivial badge spoofing via an app
-#define MAGIC_APPEARANCE "Y!"
-#define MAGIC_APPEARANCE_EASTEREGG "?R"
-
-// We cheat and don't put in a manufacturer ID
-#define MAGIC_MANUF_DATA	"Stay paranoid!"
-#define MAGIC_MANUF_DATA_LEN (sizeof(MAGIC_MANUF_DATA) - 1)
-
 // Friendly name
 #define DEVICE_NAME "Paranoids Badge"
 #define DEVICE_NAME_LEN (sizeof(DEVICE_NAME) - 1)
 
+// Rewritten by gossip_handler()
+static uint8_t gossip_data[GOSSIP_DATA_LEN];
+
 // Advertising payload
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
 	BT_DATA(BT_DATA_GAP_APPEARANCE, MAGIC_APPEARANCE, 2),
 	BT_DATA(BT_DATA_MANUFACTURER_DATA, MAGIC_MANUF_DATA, MAGIC_MANUF_DATA_LEN),
+	// has to stay last so that old badges don't see it
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, gossip_data, GOSSIP_DATA_LEN),
 };
 
 // Scan response payload
@@ -35,163 +37,470 @@ static const struct bt_data sd[] = {
 
 
 // Peer tracking
-K_MUTEX_DEFINE(peer_info_mutex);
-struct peer_info {
-	int age;
-	// 0 = empty
-	// 1 = not correct (no appearance field)
-	// 2 = badge
-	// 3 = easteregg
-	// 4 = not correct (e.g. Android phone)
-	uint8_t type;
+// The table is only touched from the system workqueue, which is cooperative, so it
+// needs no lock and can't be preempted in peers_publish() by get_peer_infos()
+// in ms
+#define PEER_MAX_AGE 60000
+// Expiry passes happen at most this often (in ms), so a crowd coming and going
+// doesn't keep the CPU busy
+#define PEER_EXPIRY_MIN_INTERVAL 1000
+static struct peer_table peers;
+static struct peer_counts_snapshot peer_counts;
+BUILD_ASSERT(sizeof(bt_addr_le_t) == PEER_ADDR_LEN, "peer table addresses are bt_addr_le_t");
+
+// Adverts from badges are handed from the BT RX callback to the system workqueue
+// through this ring (single producer, single consumer, no locks)
+struct adv_event {
 	bt_addr_le_t addr;
+	int8_t rssi;
+	// enum peer_type
+	uint8_t type;
+	struct adv_gossip gossip;
+	// k_uptime_get_32() when it came in
+	uint32_t rx_time;
 };
-#define NUM_TRACKED_PEERS 10
-// in units of 5 seconds
-#define PEER_MAX_AGE 12
-static struct peer_info peers[NUM_TRACKED_PEERS];
-
-static int num_peers;
-static int num_imposters;
-static int num_badge_makers;
-
-struct adv_parse_state {
-	// 0 = no
-	// 1 = yes, badge
-	// 2 = yes, easteregg
-	// 3 = yes, not correct (e.g. Android phone)
-	uint8_t found_appearance;
-	// 0 = no
-	// 1 = yes, valid, ours
-	// 2 = yes, not correct (not relevant to us)
-	uint8_t found_manuf_data;
-};
+// must be a power of 2
+#define ADV_RING_SIZE	64
+// most events handled per work item run, so that other work doesn't starve
+#define ADV_BATCH_MAX	32
+static struct adv_event adv_ring[ADV_RING_SIZE];
+// only written by device_found()
+static atomic_t adv_ring_head;
+// only written by adv_work_handler()
+static atomic_t adv_ring_tail;
+
+// for get_radio_stats()
+static atomic_t adv_count;
+static atomic_t badge_adv_count;
+static atomic_t adv_ring_overflows;
+// time between two adverts from the same badge, i.e. how long it would take to notice a new one
+static atomic_t sighting_gap_sum;
+static atomic_t sighting_gap_count;
+static atomic_t sighting_gap_max;
+// ms spent in each level, and ms actually scanning
+static atomic_t level_ms[RADIO_NUM_LEVELS];
+static atomic_t scan_ms;
+
+// peers added since radio_sched_handler() last ran
+static int new_peers;
+
+// Every badge ever met (not spoofers), only written from the system workqueue
+static struct hll badges_met;
+// Written to NVS at most this often (in ms) and only if it changed
+// NVS has 3 8 KB sectors and the sketch is 256 bytes, so even with a new badge every
+// interval a sector is only erased every ~5 hours
+#define BADGES_MET_CHECKPOINT_INTERVAL	(10 * 60 * 1000)
+
+static void badges_met_checkpoint_handler(struct k_work *work) {
+	nvs_set_hll(&badges_met);
+}
 
-static bool parse_adv_data(struct bt_data *data, void *state_) {
-	struct adv_parse_state *state = state_;
-
-	switch (data->type) {
-		case BT_DATA_GAP_APPEARANCE:
-			if (data->data_len != 2) {
-				state->found_appearance = 3;
-			} else {
-				if (!memcmp(data->data, MAGIC_APPEARANCE, 2)) {
-					state->found_appearance = 1;
-				} else if (!memcmp(data->data, MAGIC_APPEARANCE_EASTEREGG, 2)) {
-					state->found_appearance = 2;
-				} else {
-					state->found_appearance = 3;
-				}
+K_WORK_DELAYABLE_DEFINE(badges_met_checkpoint_work, badges_met_checkpoint_handler);
+
+static void badges_met_reset_handler(struct k_work *work) {
+	hll_init(&badges_met);
+	nvs_set_hll(&badges_met);
+}
+
+K_WORK_DEFINE(badges_met_reset_work, badges_met_reset_handler);
+
+// Every badge in the venue, as far as we and everyone we've heard know
+// Each badge advertises one slice of its sketch at a time and merges the slices it
+// hears, so this converges on the union of everyone's sketches. Only in RAM, and only
+// written from the system workqueue
+static struct hll crowd;
+// The gossip element is rewritten every this many ms, which is also the resolution of
+// the animation clock it carries (the same as a tick of the patterns in main.c)
+#define GOSSIP_STEP_MS		64
+// Next slice to advertise every this many steps (~0.5 s)
+#define GOSSIP_STEPS_PER_SLICE	8
+// With no other badge around, nobody follows our clock, so the element is only
+// rewritten every this many steps. A badge that turns up gets an epoch up to this
+// stale until we hear it, which only sets its clock a little behind to start with
+#define GOSSIP_ALONE_STEPS	GOSSIP_STEPS_PER_SLICE
+
+// Animation clock shared with nearby badges
+// Everyone follows the badge with the lowest address they can hear, if it's lower than
+// their own (so the lowest one in a group leads, and it carries over hop by hop).
+// The gossip element carries the step of the sender's clock it was written in, and it's
+// rewritten right at the start of each step, so when an advert is heard the sender's
+// clock is at least epoch * GOSSIP_STEP_MS. The highest of these lower bounds is the
+// one that was delayed the least on the way, so the offset to our uptime is max-filtered,
+// with a slow leak so that it can follow the crystals drifting apart
+// The epoch wraps, so the clock does too (every ~70 minutes, everyone at the same time)
+#define SYNC_WRAP_MS		((uint32_t)GOSSIP_STEP_MS << 16)
+// Let a higher badge take over if the leader isn't heard for this long (in ms)
+// In idle, a neighbor is only heard every few seconds
+#define SYNC_LEADER_TIMEOUT	30000
+// The filtered offset drops by 1 ms this often (in ms), i.e. 50 ppm, more than
+// two 20 ppm crystals can drift apart
+#define SYNC_LEAK_INTERVAL	20000
+// An advert is normally at most one step late (plus the RX path, plus the sender's
+// workqueue being busy), anything further behind means the leader itself jumped back,
+// e.g. because it changed leaders
+#define SYNC_MAX_DELAY		(4 * GOSSIP_STEP_MS)
+
+// Added to k_uptime_get_32() for the shared clock, in [0, SYNC_WRAP_MS)
+// Only written from the system workqueue
+static atomic_t sync_offset;
+static bt_addr_le_t own_addr;
+static bt_addr_le_t sync_leader;
+static int sync_following;
+static uint32_t sync_leader_seen;
+static uint32_t sync_leak_time;
+// for get_sync_stats()
+static atomic_t sync_samples;
+static atomic_t sync_lag_sum;
+static atomic_t sync_lag_max;
+static atomic_t sync_resets;
+
+static uint32_t sync_clock(uint32_t uptime) {
+	return (uptime % SYNC_WRAP_MS + (uint32_t)atomic_get(&sync_offset)) % SYNC_WRAP_MS;
+}
+
+// a - b, wrapped to [-SYNC_WRAP_MS / 2, SYNC_WRAP_MS / 2)
+static int32_t sync_diff(uint32_t a, uint32_t b) {
+	int32_t d = (int32_t)((a + SYNC_WRAP_MS - b) % SYNC_WRAP_MS);
+	return d >= (int32_t)(SYNC_WRAP_MS / 2) ? d - (int32_t)SYNC_WRAP_MS : d;
+}
+
+// Called for every badge advert with gossip in it, rx_time is when it came in
+static void sync_sample(const bt_addr_le_t *addr, uint16_t epoch, uint32_t rx_time, uint32_t now) {
+	if (bt_addr_le_cmp(addr, &own_addr) >= 0)
+		return;
+	if (sync_following && now - sync_leader_seen >= SYNC_LEADER_TIMEOUT)
+		sync_following = 0;
+	if (sync_following && bt_addr_le_cmp(addr, &sync_leader) > 0)
+		return;
+
+	// what the leader's clock was at least at rx_time
+	uint32_t leader_clock = (uint32_t)epoch * GOSSIP_STEP_MS;
+	int32_t lag = sync_diff(leader_clock, sync_clock(rx_time));
+	uint32_t offset = atomic_get(&sync_offset);
+
+	if (bt_addr_le_cmp(addr, &sync_leader) || lag < -SYNC_MAX_DELAY) {
+		// new leader (or it jumped), take its clock as is
+		// (the same one coming back after a while just carries on)
+		bt_addr_le_copy(&sync_leader, addr);
+		sync_leak_time = now;
+		atomic_inc(&sync_resets);
+		offset = (offset + SYNC_WRAP_MS + lag) % SYNC_WRAP_MS;
+		lag = 0;
+	} else {
+		// all the leaking since the last sample at once, at most SYNC_MAX_DELAY
+		// (any more gives the same result, lag is no lower than -SYNC_MAX_DELAY
+		// here), so a leader coming back after hours costs no more than usual
+		uint32_t leaks = (now - sync_leak_time) / SYNC_LEAK_INTERVAL;
+		sync_leak_time += leaks * SYNC_LEAK_INTERVAL;
+		if (leaks > SYNC_MAX_DELAY)
+			leaks = SYNC_MAX_DELAY;
+		offset = (offset + SYNC_WRAP_MS - leaks) % SYNC_WRAP_MS;
+		lag += leaks;
+		if (lag > 0) {
+			offset = (offset + lag) % SYNC_WRAP_MS;
+			lag = 0;
+		}
+	}
+	// (also when the leader we had timed out on comes back)
+	sync_following = 1;
+	sync_leader_seen = now;
+	atomic_set(&sync_offset, offset);
+
+	// how far behind the filtered clock this one came in
+	atomic_inc(&sync_samples);
+	atomic_add(&sync_lag_sum, -lag);
+	if (-lag > atomic_get(&sync_lag_max))
+		atomic_set(&sync_lag_max, -lag);
+}
+
+static void gossip_handler(struct k_work *work) {
+	static int slice = GOSSIP_NUM_SLICES - 1;
+	static int slice_steps;
+
+	struct peer_counts counts;
+	peers_read(&peer_counts, &counts);
+	int steps = counts.num_peers ? 1 : GOSSIP_ALONE_STEPS;
+
+	// skip the empty slices, so that small crowds converge quickly
+	slice_steps -= steps;
+	if (slice_steps <= 0) {
+		slice_steps = GOSSIP_STEPS_PER_SLICE;
+		for (int i = 0; i < GOSSIP_NUM_SLICES; i++) {
+			slice = (slice + 1) % GOSSIP_NUM_SLICES;
+			const uint8_t *regs = &crowd.regs[slice * GOSSIP_REGS_PER_SLICE];
+			if (regs[0] || regs[1] || regs[2] || regs[3])
+				break;
+		}
+	}
+
+	// runs at the start of each step or a little later, never before, so that
+	// neighbors can take epoch * GOSSIP_STEP_MS as a lower bound for our clock
+	uint32_t step = sync_clock(k_uptime_get_32()) / GOSSIP_STEP_MS;
+
+	struct adv_gossip gossip = { .slice = slice, .epoch = step };
+	memcpy(gossip.regs, &crowd.regs[slice * GOSSIP_REGS_PER_SLICE], GOSSIP_REGS_PER_SLICE);
+	uint8_t data[GOSSIP_DATA_LEN];
+	adv_gossip_encode(data, &gossip);
+	// only when the epoch or slice moved (not when the clock was pulled back
+	// into the same step), each update is an HCI command to the controller
+	if (memcmp(data, gossip_data, GOSSIP_DATA_LEN)) {
+		memcpy(gossip_data, data, GOSSIP_DATA_LEN);
+		// fails harmlessly if not advertising yet
+		bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+	}
+
+	// aim for the start of the next step we write
+	int32_t delay = sync_diff(((step + steps) * GOSSIP_STEP_MS) % SYNC_WRAP_MS, sync_clock(k_uptime_get_32()));
+	if (delay <= 0)
+		delay = 1;
+	k_work_schedule(k_work_delayable_from_work(work), K_MSEC(delay));
+}
+
+K_WORK_DELAYABLE_DEFINE(gossip_work, gossip_handler);
+
+// Runs when the peer seen longest ago is due to expire
+static void peer_expiry_handler(struct k_work *work) {
+	uint32_t now = k_uptime_get_32();
+	uint32_t oldest_seen;
+
+	if (peers_expire(&peers, now, PEER_MAX_AGE, &oldest_seen))
+		peers_publish(&peers, &peer_counts);
+
+	if (peers.num_peers) {
+		int32_t delay = oldest_seen + PEER_MAX_AGE - now;
+		if (delay < PEER_EXPIRY_MIN_INTERVAL)
+			delay = PEER_EXPIRY_MIN_INTERVAL;
+		k_work_schedule(k_work_delayable_from_work(work), K_MSEC(delay));
+	}
+}
+
+K_WORK_DELAYABLE_DEFINE(peer_expiry_work, peer_expiry_handler);
+
+static void adv_work_handler(struct k_work *work) {
+	atomic_val_t head = atomic_get(&adv_ring_head);
+	atomic_val_t tail = atomic_get(&adv_ring_tail);
+	uint32_t now = k_uptime_get_32();
+
+	int n = 0;
+	while (tail != head && n < ADV_BATCH_MAX) {
+		struct adv_event *ev = &adv_ring[tail & (ADV_RING_SIZE - 1)];
+		const struct peer_entry *e = peers_find(&peers, (const uint8_t *)&ev->addr);
+		if (e) {
+			uint32_t gap = now - e->last_seen;
+			// several in the same batch
+			if (gap) {
+				atomic_add(&sighting_gap_sum, gap);
+				atomic_inc(&sighting_gap_count);
+				if (gap > atomic_get(&sighting_gap_max))
+					atomic_set(&sighting_gap_max, gap);
 			}
-			break;
-
-		case BT_DATA_MANUFACTURER_DATA:
-			if (data->data_len == MAGIC_MANUF_DATA_LEN) {
-				if (!memcmp(data->data, MAGIC_MANUF_DATA, MAGIC_MANUF_DATA_LEN)) {
-					state->found_manuf_data = 1;
-				} else {
-					state->found_manuf_data = 2;
+		}
+		if (peers_seen(&peers, (const uint8_t *)&ev->addr, ev->type, ev->rssi, now)) {
+			new_peers++;
+
+			if (ev->type == PEER_TYPE_BADGE || ev->type == PEER_TYPE_EASTEREGG) {
+				hll_add(&crowd, (const uint8_t *)&ev->addr, sizeof(ev->addr));
+				if (hll_add(&badges_met, (const uint8_t *)&ev->addr, sizeof(ev->addr))) {
+					// does nothing if a checkpoint is already coming up
+					k_work_schedule(&badges_met_checkpoint_work, K_MSEC(BADGES_MET_CHECKPOINT_INTERVAL));
 				}
-			} else {
-				state->found_manuf_data = 2;
 			}
-			break;
+		}
 
-		default:
-			break;
+		// only trust gossip from real badges (registers only grow, so a spoofer
+		// could inflate everyone's estimate for good)
+		if (ev->gossip.valid && (ev->type == PEER_TYPE_BADGE || ev->type == PEER_TYPE_EASTEREGG)) {
+			uint8_t *regs = &crowd.regs[ev->gossip.slice * GOSSIP_REGS_PER_SLICE];
+			for (int i = 0; i < GOSSIP_REGS_PER_SLICE; i++) {
+				if (ev->gossip.regs[i] > regs[i])
+					regs[i] = ev->gossip.regs[i];
+			}
+			sync_sample(&ev->addr, ev->gossip.epoch, ev->rx_time, now);
+		}
+		tail++;
+		n++;
 	}
+	peers_publish(&peers, &peer_counts);
+	// hands the slots back to device_found()
+	atomic_set(&adv_ring_tail, tail);
+	atomic_add(&badge_adv_count, n);
+
+	if (tail != head)
+		k_work_submit(work);
 
-	return !state->found_appearance || !state->found_manuf_data;
+	// does nothing if it's already scheduled (for an earlier deadline)
+	if (n)
+		k_work_schedule(&peer_expiry_work, K_MSEC(PEER_MAX_AGE));
 }
 
+K_WORK_DEFINE(adv_work, adv_work_handler);
+
+// Runs in the BT RX thread, keep it short
 static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
 			 struct net_buf_simple *ad)
 {
-	char dev[BT_ADDR_LE_STR_LEN];
-	bt_addr_le_to_str(addr, dev, sizeof(dev));
+	uint32_t rx_time = k_uptime_get_32();
+	atomic_inc(&adv_count);
 
 	// check if it's one of ours
-	struct adv_parse_state state = {0};
-	bt_data_parse(ad, parse_adv_data, &state);
-
-	if (state.found_manuf_data == 1) {
-		const char *desc;
-		switch (state.found_appearance) {
-			case 1:
-				desc = "badge";
-				break;
-			case 2:
-				desc = "badge maker's badge";
-				break;
-			default:
-				desc = "spoofed badge";
-				break;
+	struct adv_gossip gossip;
+	enum peer_type peer_type = adv_classify(ad->data, ad->len, &gossip);
+
+	if (peer_type != PEER_TYPE_EMPTY) {
+		atomic_val_t head = atomic_get(&adv_ring_head);
+		if (head - atomic_get(&adv_ring_tail) >= ADV_RING_SIZE) {
+			atomic_inc(&adv_ring_overflows);
+			return;
 		}
-		printk("[DEVICE]: %s -- %s RSSI %i\n", dev, desc, rssi);
-
-		k_mutex_lock(&peer_info_mutex, K_FOREVER);
-		int idx_first_empty = -1;
-		int idx_oldest = -1;
-		int age_oldest = -1;
-		int found_existing = 0;
-		for (int i = 0; i < NUM_TRACKED_PEERS; i++) {
-			if (peers[i].type) {
-				if (!bt_addr_le_cmp(addr, &peers[i].addr)) {
-					printk(" -> found @ %d\n", i);
-					found_existing = 1;
-					peers[i].age = 0;
-					break;
-				}
 
-				if (peers[i].age > age_oldest) {
-					age_oldest = peers[i].age;
-					idx_oldest = i;
-				}
-			} else {
-				if (idx_first_empty == -1)
-					idx_first_empty = i;
-			}
-		}
+		struct adv_event *ev = &adv_ring[head & (ADV_RING_SIZE - 1)];
+		bt_addr_le_copy(&ev->addr, addr);
+		ev->rssi = rssi;
+		ev->type = peer_type;
+		ev->gossip = gossip;
+		ev->rx_time = rx_time;
+		// publishes the event to adv_work_handler()
+		atomic_set(&adv_ring_head, head + 1);
 
-		if (!found_existing) {
-			if (idx_first_empty != -1) {
-				printk(" -> peer #%d\n", idx_first_empty);
-				peers[idx_first_empty].type = state.found_appearance + 1;
-				peers[idx_first_empty].age = 0;
-				bt_addr_le_copy(&peers[idx_first_empty].addr, addr);
-				num_peers++;
-
-				if (state.found_appearance == 2)
-					num_badge_makers++;
-				else if (state.found_appearance != 1)
-					num_imposters++;
-			} else {
-				if (idx_oldest == -1) {
-					printk("BUG BUG BUG, dropping discovered peer\n");
-				} else {
-					printk(" -> replacing oldest @ %d (age %d)\n", idx_oldest, age_oldest);
-
-					if (peers[idx_oldest].type == 3)
-						num_badge_makers--;
-					else if (peers[idx_oldest].type != 2)
-						num_imposters--;
-
-					if (state.found_appearance == 2)
-						num_badge_makers++;
-					else if (state.found_appearance != 1)
-						num_imposters++;
-
-					peers[idx_oldest].type = state.found_appearance + 1;
-					peers[idx_oldest].age = 0;
-					bt_addr_le_copy(&peers[idx_oldest].addr, addr);
-				}
-			}
-		}
-		printk("NOW %d peers (%d imposters %d badge makers)\n", num_peers, num_imposters, num_badge_makers);
-		k_mutex_unlock(&peer_info_mutex);
+		k_work_submit(&adv_work);
+	}
+}
+
+// Scan and advertising duty cycle
+// Sprint while new badges are showing up, then back off to normal and idle as the set
+// of neighbors stays the same. All in 0.625 ms units
+struct radio_level_params {
+	const char *name;
+	uint16_t scan_interval;
+	uint16_t scan_window;
+	uint16_t adv_interval_min;
+	uint16_t adv_interval_max;
+	// scanning is restarted every this many scan intervals, see scan_refresh_handler()
+	uint16_t scan_refresh;
+};
+static const struct radio_level_params radio_levels[RADIO_NUM_LEVELS] = {
+	// scanning 30 ms of every 60 ms, advertising every 100-150 ms (same as before)
+	// every neighbor reported about once a second
+	[RADIO_LEVEL_SPRINT] = { "sprint", BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW,
+		BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, 16 },
+	// 200 ms of every 1 s, advertising every 250-300 ms, reported every 2 s
+	[RADIO_LEVEL_NORMAL] = { "normal", 1600, 320, 400, 480, 2 },
+	// 320 ms of every 2.56 s, advertising every 500-600 ms, reported every window
+	// still ~20 chances to see a neighbor before it expires
+	[RADIO_LEVEL_IDLE] = { "idle", 4096, 512, 800, 960, 1 },
+};
+
+#define RADIO_SCHED_PERIOD	1000
+// Sprint for this long after the last new peer (in ms)
+#define RADIO_SPRINT_HOLD	10000
+// Go idle after this long without a new peer (in ms)
+#define RADIO_IDLE_AFTER	60000
+// Don't sprint above this many adverts/s (badges or not), we'd only be busy
+// hearing the same ones over and over (with duplicate filtering, this is
+// how many devices are reported per second, so a big crowd)
+#define RADIO_BUSY_ADVERTS	300
+
+static int cur_level = -1;
+static atomic_t radio_forced_level = ATOMIC_INIT(-1);
+
+// With duplicate filtering, the controller only reports the first advert from each
+// address after scanning starts, so in a crowd the host isn't woken up for every
+// advert from neighbors it already knows about (and most of what's heard isn't a
+// badge at all). Peers still have to be heard again before they expire, and gossip
+// and the animation clock need fresh adverts, so scanning is restarted every few scan
+// intervals, which clears the controller's list
+static atomic_t scan_dup_filter = ATOMIC_INIT(1);
+static atomic_t scan_refreshes;
+
+static void scan_start(const struct radio_level_params *p) {
+	int opt = atomic_get(&scan_dup_filter) ? BT_LE_SCAN_OPT_FILTER_DUPLICATE : BT_LE_SCAN_OPT_NONE;
+	int err = bt_le_scan_start(BT_LE_SCAN_PARAM(BT_LE_SCAN_TYPE_PASSIVE, opt,
+		p->scan_interval, p->scan_window), device_found);
+	if (err)
+		printk("Scanning failed to start (err %d)\n", err);
+}
+
+// in ms
+static uint32_t scan_refresh_period(const struct radio_level_params *p) {
+	return (uint32_t)p->scan_refresh * p->scan_interval * 5 / 8;
+}
+
+static void scan_refresh_handler(struct k_work *work) {
+	if (cur_level == -1)
+		return;
+
+	const struct radio_level_params *p = &radio_levels[cur_level];
+	bt_le_scan_stop();
+	scan_start(p);
+	atomic_inc(&scan_refreshes);
+
+	if (atomic_get(&scan_dup_filter))
+		k_work_schedule(k_work_delayable_from_work(work), K_MSEC(scan_refresh_period(p)));
+}
+
+K_WORK_DELAYABLE_DEFINE(scan_refresh_work, scan_refresh_handler);
+
+static void radio_set_level(int level) {
+	const struct radio_level_params *p = &radio_levels[level];
+	int err;
+
+	if (cur_level != -1) {
+		bt_le_scan_stop();
+		bt_le_adv_stop();
+	}
+	cur_level = level;
+
+	// non-connectable advertising would otherwise get a new random address every time
+	// it's restarted, and neighbors would count us again after each level change
+	err = bt_le_adv_start(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_USE_IDENTITY, p->adv_interval_min, p->adv_interval_max, NULL),
+		ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+	if (err)
+		printk("Advertising failed to start (err %d)\n", err);
+
+	scan_start(p);
+	if (atomic_get(&scan_dup_filter))
+		k_work_reschedule(&scan_refresh_work, K_MSEC(scan_refresh_period(p)));
+}
+
+static void radio_sched_handler(struct k_work *work) {
+	static int quiet_ms;
+	static uint32_t last_adv_count;
+
+	uint32_t count = atomic_get(&adv_count);
+	int adverts_per_sec = (count - last_adv_count) * 1000 / RADIO_SCHED_PERIOD;
+	last_adv_count = count;
+
+	if (new_peers)
+		quiet_ms = 0;
+	else if (quiet_ms < RADIO_IDLE_AFTER)
+		quiet_ms += RADIO_SCHED_PERIOD;
+	new_peers = 0;
+
+	int level;
+	if (atomic_get(&radio_forced_level) >= 0)
+		level = atomic_get(&radio_forced_level);
+	else if (quiet_ms < RADIO_SPRINT_HOLD && adverts_per_sec < RADIO_BUSY_ADVERTS)
+		level = RADIO_LEVEL_SPRINT;
+	else if (quiet_ms < RADIO_IDLE_AFTER)
+		level = RADIO_LEVEL_NORMAL;
+	else
+		level = RADIO_LEVEL_IDLE;
+
+	// account for the period that just ended
+	if (cur_level != -1) {
+		const struct radio_level_params *p = &radio_levels[cur_level];
+		atomic_add(&level_ms[cur_level], RADIO_SCHED_PERIOD);
+		atomic_add(&scan_ms, RADIO_SCHED_PERIOD * p->scan_window / p->scan_interval);
 	}
+
+	if (level != cur_level)
+		radio_set_level(level);
+
+	k_work_schedule(k_work_delayable_from_work(work), K_MSEC(RADIO_SCHED_PERIOD));
 }
 
+K_WORK_DELAYABLE_DEFINE(radio_sched_work, radio_sched_handler);
+
 static void bt_ready(int err)
 {
 	if (err) {
@@ -201,72 +510,135 @@ static void bt_ready(int err)
 
 	printk("Bluetooth initialized\n");
 
-	err = bt_le_adv_start(BT_LE_ADV_NCONN, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
-	if (err) {
-		printk("Advertising failed to start (err %d)\n", err);
-		return;
-	}
+	// we're part of the crowd too
+	size_t count = 1;
+	bt_id_get(&own_addr, &count);
+	if (count)
+		hll_add(&crowd, (const uint8_t *)&own_addr, sizeof(own_addr));
+	k_work_schedule(&gossip_work, K_NO_WAIT);
 
-	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
-	if (err) {
-		printk("Scanning failed to start (err %d)\n", err);
-		return;
-	}
-	printk("Scanning successfully started\n");
+	// starts in sprint right away
+	k_work_schedule(&radio_sched_work, K_NO_WAIT);
+
+	if ((err = gatt_start()))
+		printk("GATT service failed to start (err %d)\n", err);
 }
 
-static void peer_aging(void *_0, void *_1, void *_2) {
-	while (1) {
-		printk("Aging peers...\n");
-
-		k_mutex_lock(&peer_info_mutex, K_FOREVER);
-		for (int i = 0; i < NUM_TRACKED_PEERS; i++) {
-			if (peers[i].type) {
-				peers[i].age++;
-				if (peers[i].age >= PEER_MAX_AGE) {
-					char dev[BT_ADDR_LE_STR_LEN];
-					bt_addr_le_to_str(&peers[i].addr, dev, sizeof(dev));
-					printk("Peer %s aged out\n", dev);
-
-					if (peers[i].type == 3)
-						num_badge_makers--;
-					else if (peers[i].type != 2)
-						num_imposters--;
-
-					peers[i].type = 0;
-					num_peers--;
-				}
-			}
-		}
-		printk("NOW %d peers (%d imposters %d badge makers)\n", num_peers, num_imposters, num_badge_makers);
-		k_mutex_unlock(&peer_info_mutex);
+int badge_bt_setup() {
+	nvs_get_hll(&badges_met);
+	// everyone who leaves the table goes into the encounter log
+	peers.on_remove = enclog_add;
+
+	// a new random static address every boot, same as the random address
+	// non-connectable advertising used to get (before bt_enable() it has to
+	// be given one, it can't make one up itself)
+	bt_addr_le_t addr = { .type = BT_ADDR_LE_RANDOM };
+	sys_rand_get(addr.a.val, sizeof(addr.a.val));
+	BT_ADDR_SET_STATIC(&addr.a);
+	int ret = bt_id_create(&addr, NULL);
+	if (ret < 0) return ret;
+
+	return bt_enable(bt_ready);
+}
+
+void get_peer_infos(int *out_num_peers, int *out_num_imposters, int *out_num_badge_makers) {
+	struct peer_counts counts;
+	peers_read(&peer_counts, &counts);
+	*out_num_peers = counts.num_peers;
+	*out_num_imposters = counts.num_imposters;
+	*out_num_badge_makers = counts.num_badge_makers;
+}
 
-		k_msleep(5000);
+void get_radio_stats(struct radio_stats *out_stats) {
+	static uint32_t last_time;
+	static uint32_t last_adv_count;
+	static uint32_t last_badge_adv_count;
+
+	uint32_t now = k_uptime_get_32();
+	uint32_t elapsed = now - last_time;
+	uint32_t count = atomic_get(&adv_count);
+	uint32_t badge_count = atomic_get(&badge_adv_count);
+
+	out_stats->adverts_per_sec = elapsed ? (count - last_adv_count) * 1000 / elapsed : 0;
+	out_stats->badge_adverts_per_sec = elapsed ? (badge_count - last_badge_adv_count) * 1000 / elapsed : 0;
+	out_stats->ring_overflows = atomic_get(&adv_ring_overflows);
+	out_stats->dup_filter = atomic_get(&scan_dup_filter);
+	out_stats->scan_refreshes = atomic_clear(&scan_refreshes);
+
+	out_stats->level = cur_level;
+	uint32_t total_ms = 0;
+	for (int i = 0; i < RADIO_NUM_LEVELS; i++) {
+		out_stats->level_ms[i] = atomic_clear(&level_ms[i]);
+		total_ms += out_stats->level_ms[i];
 	}
+	uint32_t scanned_ms = atomic_clear(&scan_ms);
+	out_stats->scan_duty_permille = total_ms ? scanned_ms * 1000 / total_ms : 0;
+
+	uint32_t gap_count = atomic_clear(&sighting_gap_count);
+	uint32_t gap_sum = atomic_clear(&sighting_gap_sum);
+	out_stats->sighting_gap_avg_ms = gap_count ? gap_sum / gap_count : 0;
+	out_stats->sighting_gap_max_ms = atomic_clear(&sighting_gap_max);
+
+	last_time = now;
+	last_adv_count = count;
+	last_badge_adv_count = badge_count;
 }
 
-K_THREAD_STACK_DEFINE(aging_thread_stack, 1024);
-static struct k_thread aging_thread;
+void get_radio_counters(struct radio_counters *out_counters) {
+	out_counters->adverts = atomic_get(&adv_count);
+	out_counters->badge_adverts = atomic_get(&badge_adv_count);
+	out_counters->ring_overflows = atomic_get(&adv_ring_overflows);
+}
 
-int badge_bt_setup() {
-	int ret = bt_enable(bt_ready);
-	if (ret) return ret;
-
-	k_thread_create(
-		&aging_thread,
-		aging_thread_stack,
-		K_THREAD_STACK_SIZEOF(aging_thread_stack),
-		peer_aging,
-		NULL, NULL, NULL,
-		13, 0, K_NO_WAIT);
-
-	return 0;
+void set_radio_level(int level) {
+	atomic_set(&radio_forced_level, level);
+	k_work_reschedule(&radio_sched_work, K_NO_WAIT);
 }
 
-void get_peer_infos(int *out_num_peers, int *out_num_imposters, int *out_num_badge_makers) {
-	k_mutex_lock(&peer_info_mutex, K_FOREVER);
-	*out_num_peers = num_peers;
-	*out_num_imposters = num_imposters;
-	*out_num_badge_makers = num_badge_makers;
-	k_mutex_unlock(&peer_info_mutex);
+void set_scan_dup_filter(int on) {
+	atomic_set(&scan_dup_filter, on);
+	// restarts scanning with it right away
+	k_work_reschedule(&scan_refresh_work, K_NO_WAIT);
+}
+
+int get_scan_dup_filter() {
+	return atomic_get(&scan_dup_filter);
+}
+
+int get_radio_level() {
+	return cur_level;
+}
+
+const char *get_radio_level_name(int level) {
+	return level >= 0 && level < RADIO_NUM_LEVELS ? radio_levels[level].name : "none";
+}
+
+int get_badges_met() {
+	return hll_estimate(&badges_met);
+}
+
+void reset_badges_met() {
+	k_work_submit(&badges_met_reset_work);
+}
+
+int get_crowd_size() {
+	return hll_estimate(&crowd);
+}
+
+uint32_t get_anim_clock_ms() {
+	return sync_clock(k_uptime_get_32());
+}
+
+void get_sync_stats(struct sync_stats *out_stats) {
+	// racy, but only for display
+	out_stats->following = sync_following;
+	memcpy(out_stats->leader, sync_leader.a.val, sizeof(out_stats->leader));
+	out_stats->offset_ms = atomic_get(&sync_offset);
+	out_stats->resets = atomic_get(&sync_resets);
+
+	uint32_t samples = atomic_clear(&sync_samples);
+	uint32_t lag_sum = atomic_clear(&sync_lag_sum);
+	out_stats->samples = samples;
+	out_stats->lag_avg_ms = samples ? lag_sum / samples : 0;
+	out_stats->lag_max_ms = atomic_clear(&sync_lag_max);
 }
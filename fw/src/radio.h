@@ -3,5 +3,84 @@
 
 #pragma once
 
+#include <stdint.h>
+
 int badge_bt_setup();
 void get_peer_infos(int *num_peers, int *num_imposters, int *num_badge_makers);
+
+// Estimated number of distinct badges ever seen (kept in NVS)
+int get_badges_met();
+void reset_badges_met();
+// Estimated number of badges in the whole venue, gossiped between badges
+int get_crowd_size();
+
+// Animation clock in ms, kept in step with nearby badges (wraps around every ~70 minutes)
+uint32_t get_anim_clock_ms();
+
+enum radio_level {
+	RADIO_LEVEL_SPRINT,
+	RADIO_LEVEL_NORMAL,
+	RADIO_LEVEL_IDLE,
+	RADIO_NUM_LEVELS,
+};
+
+// Pins the scan/advertising duty cycle to a level, -1 to pick it automatically
+void set_radio_level(int level);
+const char *get_radio_level_name(int level);
+// Level in use right now, -1 before Bluetooth is up
+int get_radio_level();
+// Turns the controller's duplicate filtering (on by default) on or off
+void set_scan_dup_filter(int on);
+int get_scan_dup_filter();
+
+// Rates are averaged since the last call
+struct radio_stats {
+	// all adverts heard, badges or not
+	uint32_t adverts_per_sec;
+	uint32_t badge_adverts_per_sec;
+	// badge adverts dropped because they came in faster than they were processed
+	uint32_t ring_overflows;
+	// if the controller filters duplicates, and how often scanning was restarted to
+	// hear everyone again
+	int dup_filter;
+	uint32_t scan_refreshes;
+
+	// current enum radio_level
+	int level;
+	// time spent in each level
+	uint32_t level_ms[RADIO_NUM_LEVELS];
+	// fraction of the time the radio was scanning
+	uint32_t scan_duty_permille;
+	// time between hearing the same badge twice, an upper bound for how long
+	// it takes to notice a new badge
+	uint32_t sighting_gap_avg_ms;
+	uint32_t sighting_gap_max_ms;
+};
+void get_radio_stats(struct radio_stats *stats);
+
+// Totals since boot
+struct radio_counters {
+	uint32_t adverts;
+	uint32_t badge_adverts;
+	uint32_t ring_overflows;
+};
+void get_radio_counters(struct radio_counters *counters);
+
+// Averages are since the last call
+struct sync_stats {
+	// 0 if nobody lower is around and we're on our own clock
+	int following;
+	// address of the badge we follow (or last followed), most significant byte last
+	uint8_t leader[6];
+	// added to the uptime for the animation clock
+	uint32_t offset_ms;
+	// times the clock was set outright rather than filtered (new leader or the leader jumped)
+	uint32_t resets;
+	// adverts from the leader used
+	uint32_t samples;
+	// how far the leader's adverts came in behind the filtered clock, i.e. how much
+	// the clock would be off if it only went by a single advert
+	uint32_t lag_avg_ms;
+	uint32_t lag_max_ms;
+};
+void get_sync_stats(struct sync_stats *stats);
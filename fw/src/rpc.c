@@ -0,0 +1,118 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include <string.h>
+
+#include "rpc.h"
+
+// CRC-16/CCITT-FALSE (poly 0x1021, MSB first, start at 0xFFFF), same as binascii.crc_hqx()
+uint16_t rpc_crc16(uint16_t crc, const uint8_t *data, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		crc ^= data[i] << 8;
+		for (int b = 0; b < 8; b++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+void rpc_decoder_init(struct rpc_decoder *d) {
+	memset(d, 0, sizeof(*d));
+}
+
+static void decoder_reset(struct rpc_decoder *d) {
+	d->len = 0;
+	d->code = 0;
+	d->left = 0;
+	d->skip = 0;
+}
+
+int rpc_decode_byte(struct rpc_decoder *d, uint8_t c) {
+	if (c == 0) {
+		int ok = 0;
+		// (empty frames are just the delimiter being sent twice)
+		if (d->code) {
+			if (!d->skip && !d->left && d->len >= 4) {
+				uint16_t crc = d->buf[d->len - 2] | (d->buf[d->len - 1] << 8);
+				ok = crc == rpc_crc16(0xffff, d->buf, d->len - 2);
+			}
+			if (!ok)
+				d->bad_frames++;
+		}
+		// (len stays for the caller)
+		uint32_t len = d->len;
+		decoder_reset(d);
+		d->len = len;
+		return ok;
+	}
+	if (d->skip)
+		return 0;
+
+	if (!d->left) {
+		// a block ended, and unless it was a full one there was a 0 after it
+		if (!d->code) {
+			// first one of a frame
+			d->len = 0;
+		} else if (d->code != 0xff) {
+			if (d->len == sizeof(d->buf)) {
+				d->skip = 1;
+				return 0;
+			}
+			d->buf[d->len++] = 0;
+		}
+		d->code = c;
+		d->left = c - 1;
+		return 0;
+	}
+
+	if (d->len == sizeof(d->buf)) {
+		d->skip = 1;
+		return 0;
+	}
+	d->buf[d->len++] = c;
+	d->left--;
+	return 0;
+}
+
+struct encoder {
+	void (*write)(const uint8_t *data, uint32_t len);
+	// code byte and up to 254 data bytes
+	uint8_t block[255];
+	uint32_t n;
+	uint16_t crc;
+};
+
+static void encoder_flush(struct encoder *e) {
+	e->block[0] = e->n + 1;
+	e->write(e->block, e->n + 1);
+	e->n = 0;
+}
+
+static void encoder_put(struct encoder *e, const uint8_t *data, uint32_t len) {
+	e->crc = rpc_crc16(e->crc, data, len);
+	for (uint32_t i = 0; i < len; i++) {
+		if (data[i]) {
+			e->block[1 + e->n++] = data[i];
+			if (e->n == 254)
+				encoder_flush(e);
+		} else {
+			encoder_flush(e);
+		}
+	}
+}
+
+void rpc_encode(void (*write)(const uint8_t *data, uint32_t len), uint8_t type, uint8_t seq,
+	const uint8_t *hdr, uint32_t hdr_len, const uint8_t *data, uint32_t data_len) {
+	struct encoder e = { .write = write, .crc = 0xffff };
+	uint8_t head[2] = { type, seq };
+	encoder_put(&e, head, sizeof(head));
+	encoder_put(&e, hdr, hdr_len);
+	encoder_put(&e, data, data_len);
+
+	uint16_t crc = e.crc;
+	uint8_t tail[2] = { crc, crc >> 8 };
+	encoder_put(&e, tail, sizeof(tail));
+	encoder_flush(&e);
+
+	static const uint8_t delimiter = 0;
+	write(&delimiter, 1);
+}
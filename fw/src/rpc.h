@@ -0,0 +1,46 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <stdint.h>
+
+// Framing for the binary protocol on the USB link (the messages are in usb.c)
+// This doesn't depend on Zephyr so that it can be built on the host
+// A frame is COBS-encoded and ends with a 0 byte, which appears nowhere else, so a
+// reader that lost bytes picks up again at the next frame. Decoded, it's
+//  type, sequence number, payload, CRC-16/CCITT-FALSE of all of the above (LE)
+
+// Longest payload the decoder takes, longer frames are dropped
+// (frames the badge sends can be any length)
+#define RPC_PAYLOAD_MAX		256
+
+// Most bytes rpc_encode() writes for a payload: a COBS code byte per 254 bytes
+// plus one, and the delimiter
+#define RPC_FRAME_MAX(payload_len)	((2 + (payload_len) + 2) * 255 / 254 + 2)
+
+struct rpc_decoder {
+	// type, sequence number, payload and CRC
+	uint8_t buf[2 + RPC_PAYLOAD_MAX + 2];
+	uint32_t len;
+	// code byte of the current COBS block, 0 at the start of a frame
+	uint8_t code;
+	// bytes left in the current block
+	uint8_t left;
+	// frame too long or malformed, skipping to the next 0
+	uint8_t skip;
+	uint32_t bad_frames;
+};
+
+void rpc_decoder_init(struct rpc_decoder *d);
+// Feeds one received byte, returns 1 once a whole frame with a good CRC is in
+// (type in buf[0], sequence number in buf[1], payload from buf[2], len - 4 bytes long)
+int rpc_decode_byte(struct rpc_decoder *d, uint8_t c);
+
+// Encodes one frame with the payload in two pieces (a header and data, so that
+// nothing needs to be copied in front of big data) and passes it to write a COBS
+// block (<= 255 bytes) at a time
+void rpc_encode(void (*write)(const uint8_t *data, uint32_t len), uint8_t type, uint8_t seq,
+	const uint8_t *hdr, uint32_t hdr_len, const uint8_t *data, uint32_t data_len);
+
+uint16_t rpc_crc16(uint16_t crc, const uint8_t *data, uint32_t len);
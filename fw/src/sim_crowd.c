@@ -0,0 +1,399 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// Host simulator for peer tracking in a big crowd: badges walk around a venue, come and
+// go, and advertise. A sample of them run the real peer table (peers.c) on what they
+// hear, and their counts are checked against who was actually around
+// cc -O2 -o sim_crowd sim_crowd.c peers.c -lm
+// ./sim_crowd [-n badges] [-s seconds] [-S sampled] [-A m^2 per badge] [-R range m]
+//             [-t average stay s] [-a max age ms] [-l sprint|normal|idle]
+// Table designs are picked at build time, e.g. -DPEER_TABLE_BITS=8 -DPEER_EVICT_WINDOW=4
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "peers.h"
+
+// one step of the simulation, in ms
+#define STEP_MS		100
+// counts are checked and expiry runs this often (in ms), like PEER_EXPIRY_MIN_INTERVAL in radio.c
+#define MEASURE_MS	1000
+// on-air time of one advert on one channel (31 bytes at 1M), in ms
+#define ADV_AIRTIME_MS	0.376
+#define WALK_M_PER_S	1.0
+// longest a badge stands still at a waypoint, in s
+#define MAX_PAUSE_S	120
+
+// scan interval, scan window, advertising interval (ms), as radio_levels in radio.c
+struct level {
+	const char *name;
+	double scan_interval;
+	double scan_window;
+	double adv_interval;
+};
+static const struct level levels[] = {
+	{ "sprint", 60, 30, 100 },
+	{ "normal", 1000, 200, 250 },
+	{ "idle", 2560, 320, 500 },
+};
+
+struct badge {
+	float x, y;
+	float target_x, target_y;
+	// in ms
+	double pause_until;
+	double leave_at;
+	double next_adv;
+	uint8_t addr[PEER_ADDR_LEN];
+	// adverts sent in the current step
+	uint8_t adverts;
+};
+
+struct heard {
+	uint32_t badge;
+	uint32_t time;
+};
+
+struct receiver {
+	struct peer_table table;
+	// per badge: ms + 1 when it came in range without being in the table, 0 if not waiting
+	uint32_t *entered;
+	// per badge: step + 1 it was last in range, 0 if never
+	uint32_t *last_in_range;
+	struct heard *heard;
+	int num_heard;
+};
+
+static uint64_t rng_state = 1;
+static uint32_t rng() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 32;
+}
+static double rng_uniform(double lo, double hi) {
+	return lo + (hi - lo) * (rng() / 4294967296.0);
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int num_badges = 5000;
+static int seconds = 600;
+static int num_sampled = 16;
+static double area_per_badge = 10;
+static double range_m = 20;
+static double stay_s = 1800;
+static uint32_t max_age = 60000;
+static const struct level *level = &levels[1];
+
+static double side;
+static struct badge *badges;
+static struct receiver *receivers;
+
+static void new_badge(struct badge *b, double now) {
+	b->x = b->target_x = rng_uniform(0, side);
+	b->y = b->target_y = rng_uniform(0, side);
+	b->pause_until = now;
+	// the sampled ones stay for the whole run
+	b->leave_at = now - stay_s * 1000 * log(rng_uniform(1e-9, 1));
+	b->next_adv = now + rng_uniform(0, level->adv_interval);
+	b->addr[0] = 1;
+	for (int i = 1; i < PEER_ADDR_LEN; i++)
+		b->addr[i] = rng();
+}
+
+static void walk(struct badge *b, double now) {
+	if (now < b->pause_until)
+		return;
+	float dx = b->target_x - b->x, dy = b->target_y - b->y;
+	float d = sqrtf(dx * dx + dy * dy);
+	float step = WALK_M_PER_S * STEP_MS / 1000;
+	if (d <= step) {
+		b->x = b->target_x;
+		b->y = b->target_y;
+		b->target_x = rng_uniform(0, side);
+		b->target_y = rng_uniform(0, side);
+		b->pause_until = now + rng_uniform(0, MAX_PAUSE_S * 1000);
+	} else {
+		b->x += dx / d * step;
+		b->y += dy / d * step;
+	}
+}
+
+// reception falls off over the outer half of the range
+static double p_receive(double d) {
+	if (d < range_m / 2)
+		return 1;
+	return 2 * (range_m - d) / range_m;
+}
+
+int main(int argc, char **argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:S:A:R:t:a:l:")) != -1) {
+		switch (opt) {
+			case 'n': num_badges = atoi(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			case 'S': num_sampled = atoi(optarg); break;
+			case 'A': area_per_badge = atof(optarg); break;
+			case 'R': range_m = atof(optarg); break;
+			case 't': stay_s = atof(optarg); break;
+			case 'a': max_age = atoi(optarg); break;
+			case 'l':
+				level = NULL;
+				for (int i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++)
+					if (!strcmp(optarg, levels[i].name))
+						level = &levels[i];
+				if (level)
+					break;
+				// fall through
+			default:
+				fprintf(stderr, "usage: %s [-n badges] [-s seconds] [-S sampled] [-A m^2 per badge] [-R range m] "
+					"[-t average stay s] [-a max age ms] [-l sprint|normal|idle]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (num_sampled > num_badges)
+		num_sampled = num_badges;
+
+	side = sqrt(num_badges * area_per_badge);
+	badges = calloc(num_badges, sizeof(*badges));
+	for (int i = 0; i < num_badges; i++) {
+		new_badge(&badges[i], 0);
+		if (i < num_sampled)
+			badges[i].leave_at = INFINITY;
+	}
+	receivers = calloc(num_sampled, sizeof(*receivers));
+	for (int r = 0; r < num_sampled; r++) {
+		peers_init(&receivers[r].table);
+		receivers[r].entered = calloc(num_badges, sizeof(uint32_t));
+		receivers[r].last_in_range = calloc(num_badges, sizeof(uint32_t));
+		receivers[r].heard = calloc(num_badges * 4, sizeof(struct heard));
+	}
+
+	// grid of range sized cells, so that only nearby badges are looked at
+	int grid_n = (int)ceil(side / range_m);
+	if (grid_n < 1)
+		grid_n = 1;
+	int *cell_start = calloc(grid_n * grid_n + 1, sizeof(int));
+	int *cell_of = calloc(num_badges, sizeof(int));
+	int *by_cell = calloc(num_badges, sizeof(int));
+
+	double scan_duty = level->scan_window / level->scan_interval;
+
+	size_t latencies_cap = 1 << 16, num_latencies = 0;
+	uint32_t *latencies = malloc(latencies_cap * sizeof(uint32_t));
+	long encounters = 0, missed = 0;
+	long adverts_processed = 0;
+	double advert_ns = 0, expire_ns = 0;
+	long expire_passes = 0, expired = 0, new_peers = 0;
+	long measurements = 0;
+	double sum_in_range = 0, sum_recent = 0, sum_count = 0;
+	double sum_err_in_range = 0, sum_err_recent = 0;
+	int peak_peers = 0;
+	long departures = 0;
+
+	uint32_t num_steps = (uint32_t)seconds * 1000 / STEP_MS;
+	for (uint32_t step = 0; step < num_steps; step++) {
+		double now = (double)step * STEP_MS;
+
+		// move, come and go, advertise
+		for (int i = 0; i < num_badges; i++) {
+			struct badge *b = &badges[i];
+			if (now >= b->leave_at) {
+				// someone else takes their place, with a new address
+				new_badge(b, now);
+				departures++;
+				for (int r = 0; r < num_sampled; r++) {
+					if (receivers[r].entered[i])
+						missed++;
+					receivers[r].entered[i] = 0;
+					receivers[r].last_in_range[i] = 0;
+				}
+			}
+			walk(b, now);
+			b->adverts = 0;
+			while (b->next_adv < now + STEP_MS) {
+				b->adverts++;
+				// advDelay is 0-10 ms on top of the interval
+				b->next_adv += level->adv_interval + rng_uniform(0, 10);
+			}
+		}
+
+		memset(cell_start, 0, (grid_n * grid_n + 1) * sizeof(int));
+		for (int i = 0; i < num_badges; i++) {
+			int cx = (int)(badges[i].x / range_m), cy = (int)(badges[i].y / range_m);
+			if (cx >= grid_n) cx = grid_n - 1;
+			if (cy >= grid_n) cy = grid_n - 1;
+			cell_of[i] = cy * grid_n + cx;
+			cell_start[cell_of[i] + 1]++;
+		}
+		for (int c = 0; c < grid_n * grid_n; c++)
+			cell_start[c + 1] += cell_start[c];
+		for (int i = 0; i < num_badges; i++)
+			by_cell[cell_start[cell_of[i]]++] = i;
+		// cell_start was shifted up by one cell while filling
+		memmove(cell_start + 1, cell_start, grid_n * grid_n * sizeof(int));
+		cell_start[0] = 0;
+
+		int measure = (step + 1) % (MEASURE_MS / STEP_MS) == 0;
+		for (int r = 0; r < num_sampled; r++) {
+			struct receiver *rx = &receivers[r];
+			struct badge *me = &badges[r];
+			int cx = cell_of[r] % grid_n, cy = cell_of[r] / grid_n;
+
+			// first pass: who's in range (for collisions and the ground truth)
+			int in_range = 0;
+			for (int y = cy - 1; y <= cy + 1; y++) {
+				for (int x = cx - 1; x <= cx + 1; x++) {
+					if (x < 0 || y < 0 || x >= grid_n || y >= grid_n)
+						continue;
+					int c = y * grid_n + x;
+					for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+						int j = by_cell[k];
+						if (j == r)
+							continue;
+						float dx = badges[j].x - me->x, dy = badges[j].y - me->y;
+						if (dx * dx + dy * dy >= range_m * range_m)
+							continue;
+						in_range++;
+						if (rx->last_in_range[j] != step) {
+							// came into range (last step would be step - 1 + 1)
+							if (rx->entered[j])
+								missed++;
+							rx->entered[j] = 0;
+							if (!peers_find(&rx->table, badges[j].addr)) {
+								rx->entered[j] = (uint32_t)now + 1;
+								encounters++;
+							}
+						}
+						rx->last_in_range[j] = step + 1;
+					}
+				}
+			}
+
+			// everyone in range advertising at the same time collide now and then
+			double p_no_collision = exp(-2.0 * in_range * ADV_AIRTIME_MS / level->adv_interval);
+			rx->num_heard = 0;
+			for (int y = cy - 1; y <= cy + 1; y++) {
+				for (int x = cx - 1; x <= cx + 1; x++) {
+					if (x < 0 || y < 0 || x >= grid_n || y >= grid_n)
+						continue;
+					int c = y * grid_n + x;
+					for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+						int j = by_cell[k];
+						if (j == r || rx->last_in_range[j] != step + 1)
+							continue;
+						float dx = badges[j].x - me->x, dy = badges[j].y - me->y;
+						double p = scan_duty * p_no_collision * p_receive(sqrt(dx * dx + dy * dy));
+						for (int a = 0; a < badges[j].adverts; a++) {
+							if (rng_uniform(0, 1) < p) {
+								rx->heard[rx->num_heard].badge = j;
+								rx->heard[rx->num_heard].time = (uint32_t)now + rng() % STEP_MS;
+								rx->num_heard++;
+							}
+						}
+					}
+				}
+			}
+
+			// what adv_work_handler() does, timed on its own
+			double t0 = now_ns();
+			for (int h = 0; h < rx->num_heard; h++) {
+				const uint8_t *addr = badges[rx->heard[h].badge].addr;
+				peers_find(&rx->table, addr);
+				if (peers_seen(&rx->table, addr, PEER_TYPE_BADGE, -60, rx->heard[h].time))
+					new_peers++;
+			}
+			advert_ns += now_ns() - t0;
+			adverts_processed += rx->num_heard;
+
+			for (int h = 0; h < rx->num_heard; h++) {
+				uint32_t j = rx->heard[h].badge;
+				if (rx->entered[j]) {
+					uint32_t latency = rx->heard[h].time - (rx->entered[j] - 1);
+					if (num_latencies == latencies_cap) {
+						latencies_cap *= 2;
+						latencies = realloc(latencies, latencies_cap * sizeof(uint32_t));
+					}
+					latencies[num_latencies++] = latency;
+					rx->entered[j] = 0;
+				}
+			}
+
+			if (measure) {
+				uint32_t t = (uint32_t)now + STEP_MS;
+				uint32_t oldest_seen;
+				t0 = now_ns();
+				expired += peers_expire(&rx->table, t, max_age, &oldest_seen);
+				expire_ns += now_ns() - t0;
+				expire_passes++;
+
+				// everyone in range at some point within the max age, i.e. what a
+				// perfect table would count
+				int recent = 0;
+				uint32_t age_steps = max_age / STEP_MS;
+				for (int j = 0; j < num_badges; j++)
+					if (rx->last_in_range[j] && step + 1 - rx->last_in_range[j] < age_steps)
+						recent++;
+
+				int count = rx->table.num_peers;
+				if (count > peak_peers)
+					peak_peers = count;
+				measurements++;
+				sum_in_range += in_range;
+				sum_recent += recent;
+				sum_count += count;
+				sum_err_in_range += abs(count - in_range);
+				sum_err_recent += abs(count - recent);
+			}
+		}
+	}
+
+	// whoever is still waiting to be noticed
+	for (int r = 0; r < num_sampled; r++)
+		for (int i = 0; i < num_badges; i++)
+			if (receivers[r].entered[i])
+				missed++;
+
+	long evictions = 0;
+	for (int r = 0; r < num_sampled; r++)
+		evictions += receivers[r].table.num_evictions;
+
+	qsort(latencies, num_latencies, sizeof(uint32_t), cmp_u32);
+	#define PCT(p) (num_latencies ? latencies[(size_t)((num_latencies - 1) * (p))] : 0)
+
+	double minutes = seconds / 60.0 * num_sampled;
+	printf("%d badges on %.0fx%.0f m (%.0f m^2 each), %.0f m range, %s level, staying %.0f min on average\n",
+		num_badges, side, side, area_per_badge, range_m, level->name, stay_s / 60);
+	printf("%d sampled for %d s, %ld left and were replaced\n", num_sampled, seconds, departures);
+	printf("table: %d slots (%d max), evict window %d, max age %u ms, %zu bytes (%.1f per peer at max load)\n",
+		PEER_TABLE_SIZE, PEER_TABLE_MAX_LOAD, PEER_EVICT_WINDOW, max_age,
+		sizeof(struct peer_table), (double)sizeof(struct peer_table) / PEER_TABLE_MAX_LOAD);
+	printf("detection: %ld encounters, noticed after %.1f/%.1f/%.1f s (p50/p90/p99), %.1f%% missed\n",
+		encounters, PCT(0.5) / 1000.0, PCT(0.9) / 1000.0, PCT(0.99) / 1000.0,
+		encounters ? 100.0 * missed / encounters : 0);
+	printf("count: %.1f in range, %.1f within max age, table says %.1f (peak %d)\n",
+		sum_in_range / measurements, sum_recent / measurements, sum_count / measurements, peak_peers);
+	printf("count error: %.1f vs in range, %.1f vs within max age (mean absolute)\n",
+		sum_err_in_range / measurements, sum_err_recent / measurements);
+	printf("churn per badge per minute: %.1f new, %.1f expired, %.1f evicted\n",
+		new_peers / minutes, expired / minutes, evictions / minutes);
+	printf("cpu: %.1f ns per advert (%ld processed), %.0f ns per expiry pass (on this host)\n",
+		adverts_processed ? advert_ns / adverts_processed : 0, adverts_processed,
+		expire_passes ? expire_ns / expire_passes : 0);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Simulates a group of badges in range of each other disciplining their animation clocks
+# from each other's adverts (see sync_sample() in radio.c, which this mirrors), and shows
+# how far apart the clocks and the frames on the LEDs end up
+# python3 sim_sync.py [sprint|normal|idle] [nodup] [badges...]
+# (nodup turns off the controller's duplicate filtering, see scan_refresh_handler())
+
+import sys
+
+import numpy as np
+
+# same as radio.c and main.c
+GOSSIP_STEP_MS = 64
+SYNC_WRAP_MS = GOSSIP_STEP_MS << 16
+SYNC_LEADER_TIMEOUT = 30000
+SYNC_LEAK_INTERVAL = 20000
+SYNC_MAX_DELAY = 4 * GOSSIP_STEP_MS
+ANIM_TICK_MS = 64
+
+# scan interval, scan window, advertising interval (ms), scan intervals per refresh
+LEVELS = {
+	'sprint': (60, 30, 100, 16),
+	'normal': (1000, 200, 250, 2),
+	'idle': (2560, 320, 500, 1),
+}
+level = sys.argv[1] if len(sys.argv) > 1 and sys.argv[1] in LEVELS else 'normal'
+SCAN_INTERVAL, SCAN_WINDOW, ADV_INTERVAL, SCAN_REFRESH = LEVELS[level]
+DUP_FILTER = 'nodup' not in sys.argv
+GROUP_SIZES = [int(n) for n in sys.argv[1:] if n not in LEVELS and n != 'nodup'] or [2, 10, 50]
+
+# crystals are +-20 ppm
+PPM = 20
+# chance of receiving an advert sent while scanning (collisions etc.)
+P_RX = 0.8
+# from the advert going out to device_found() taking the time, in ms
+RX_LATENCY = (0.4, 1.5)
+DURATION_MS = 10 * 60 * 1000
+# only measure once everyone has had time to settle
+SETTLE_MS = 2 * 60 * 1000
+MEASURE_EVERY_MS = 50
+
+rng = np.random.default_rng(1)
+
+def sync_diff(a, b):
+	d = (a - b) % SYNC_WRAP_MS
+	return d - SYNC_WRAP_MS if d >= SYNC_WRAP_MS // 2 else d
+
+class Badge:
+	def __init__(self, addr):
+		self.addr = addr
+		self.boot = rng.uniform(0, 3600e3)
+		self.rate = 1 + rng.uniform(-PPM, PPM) * 1e-6
+		self.scan_phase = rng.uniform(0, SCAN_INTERVAL)
+		self.offset = 0
+		self.following = False
+		self.leader = None
+		self.leader_seen = 0
+		self.leak_time = 0
+		self.lags = []
+		self.resets = 0
+		# sender address -> refresh it was last reported in
+		self.reported = {}
+
+	def uptime(self, t):
+		return int((t + self.boot) * self.rate)
+
+	def clock(self, t):
+		return (self.uptime(t) % SYNC_WRAP_MS + self.offset) % SYNC_WRAP_MS
+
+	def scanning(self, t):
+		return (self.uptime(t) - self.scan_phase) % SCAN_INTERVAL < SCAN_WINDOW
+
+	def reported_by_controller(self, addr, t):
+		if not DUP_FILTER:
+			return True
+		refresh = (self.uptime(t) - self.scan_phase) // (SCAN_INTERVAL * SCAN_REFRESH)
+		if self.reported.get(addr) == refresh:
+			return False
+		self.reported[addr] = refresh
+		return True
+
+	def epoch(self, t):
+		# gossip_handler() runs a little after each step starts
+		return (self.clock(t - 0.2) // GOSSIP_STEP_MS) & 0xffff
+
+	def sample(self, addr, epoch, rx_time):
+		now = rx_time
+		if addr >= self.addr:
+			return
+		if self.following and now - self.leader_seen >= SYNC_LEADER_TIMEOUT:
+			self.following = False
+		if self.following and addr > self.leader:
+			return
+
+		leader_clock = epoch * GOSSIP_STEP_MS
+		lag = sync_diff(leader_clock, (rx_time % SYNC_WRAP_MS + self.offset) % SYNC_WRAP_MS)
+		if addr != self.leader or lag < -SYNC_MAX_DELAY:
+			self.leader = addr
+			self.leak_time = now
+			self.resets += 1
+			self.offset = (self.offset + lag) % SYNC_WRAP_MS
+			lag = 0
+		else:
+			leaks = int((now - self.leak_time) // SYNC_LEAK_INTERVAL)
+			self.leak_time += leaks * SYNC_LEAK_INTERVAL
+			leaks = min(leaks, SYNC_MAX_DELAY)
+			self.offset = (self.offset - leaks) % SYNC_WRAP_MS
+			lag += leaks
+			if lag > 0:
+				self.offset = (self.offset + lag) % SYNC_WRAP_MS
+				lag = 0
+		self.following = True
+		self.leader_seen = now
+		self.lags.append(-lag)
+
+def simulate(n):
+	addrs = rng.choice(1 << 40, n, replace=False)
+	badges = [Badge(int(a)) for a in addrs]
+	lowest = min(badges, key=lambda b: b.addr)
+	# game_loop() runs every ANIM_TICK_MS of uptime, at some phase
+	loop_phase = rng.uniform(0, ANIM_TICK_MS, n)
+
+	next_adv = rng.uniform(0, ADV_INTERVAL, n)
+	next_measure = 0
+	clock_errors = []
+	frame_errors = []
+	converged_at = None
+	while True:
+		i = int(np.argmin(next_adv))
+		t = next_adv[i]
+		if t >= DURATION_MS:
+			break
+		# advDelay is 0-10 ms on top of the interval
+		next_adv[i] = t + ADV_INTERVAL * badges[i].rate + rng.uniform(0, 10)
+
+		sender = badges[i]
+		epoch = sender.epoch(t)
+		for b in badges:
+			if b is sender or not b.scanning(t) or rng.random() >= P_RX:
+				continue
+			if not b.reported_by_controller(sender.addr, t):
+				continue
+			b.sample(sender.addr, epoch, b.uptime(t + rng.uniform(*RX_LATENCY)))
+
+		while next_measure <= t:
+			errs = np.array([sync_diff(b.clock(next_measure), lowest.clock(next_measure)) for b in badges])
+			if converged_at is None and np.all(np.abs(errs) < ANIM_TICK_MS):
+				converged_at = next_measure
+			if next_measure >= SETTLE_MS:
+				clock_errors.extend(np.abs(errs))
+				# the frame each badge shows is from the last time its game_loop() ran
+				frames = []
+				for k, b in enumerate(badges):
+					up = (next_measure + b.boot) * b.rate
+					last_run = next_measure - ((up - loop_phase[k]) % ANIM_TICK_MS) / b.rate
+					frames.append(b.clock(last_run) // ANIM_TICK_MS)
+				frame_errors.extend(np.abs(np.array(frames) - frames[badges.index(lowest)]))
+			next_measure += MEASURE_EVERY_MS
+
+	clock_errors = np.array(clock_errors)
+	frame_errors = np.array(frame_errors)
+	lags = np.concatenate([b.lags for b in badges if b is not lowest])
+	resets = sum(b.resets for b in badges if b is not lowest) / (n - 1)
+	conv = f"{converged_at / 1000:7.1f}" if converged_at is not None else "      -"
+	print(f"{n:6} {conv} {np.median(clock_errors):7.1f} {np.percentile(clock_errors, 99):7.1f} {clock_errors.max():7.0f}"
+		f" {np.mean(frame_errors == 0):8.1%} {np.mean(frame_errors <= 1):8.1%} {np.median(lags):7.0f} {resets:6.1f}")
+
+dup = f"duplicates filtered, restarted every {SCAN_INTERVAL * SCAN_REFRESH} ms" if DUP_FILTER else "no duplicate filtering"
+print(f"{level}: scanning {SCAN_WINDOW} ms of every {SCAN_INTERVAL} ms ({dup}), advertising every {ADV_INTERVAL} ms, "
+	f"+-{PPM} ppm crystals, measured after {SETTLE_MS // 1000} s")
+print("(clock error is against the lowest address badge, in ms, frames are what game_loop() last drew)")
+print("badges  within   error   error   error  same     frames   single  resets")
+print("        1 frame    p50     p99     max  frame    within 1 lag p50")
+for n in GROUP_SIZES:
+	simulate(n)
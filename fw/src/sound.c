@@ -1,12 +1,18 @@
 // Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
 // See LICENSE file in project root for terms.
 
+#include <errno.h>
+#include <math.h>
 #include <zephyr.h>
 #include <devicetree.h>
 #include <audio/dmic.h>
 #include <hal/nrf_pdm.h>
 #include <random/rand32.h>
+#include <sys/byteorder.h>
 
+#include "adpcm.h"
+#include "color.h"
+#include "gatt.h"
 #include "misc.h"
 #include "sound.h"
 #include "usb.h"
@@ -22,7 +28,8 @@
 #define SAMPLES_LOG2		10
 #define SAMPLES_PER_BLOCK	(1 << SAMPLES_LOG2)
 #define BLOCK_SIZE			(SAMPLES_PER_BLOCK * BYTES_PER_SAMPLE)
-#define BLOCK_COUNT			4
+// (one more than the driver and the main loop need, for a block lent to USB)
+#define BLOCK_COUNT			5
 K_MEM_SLAB_DEFINE_STATIC(mem_slab, BLOCK_SIZE, BLOCK_COUNT, 4);
 
 _Static_assert(sizeof(hanning_window) / sizeof(hanning_window[0]) == SAMPLES_PER_BLOCK / 2, "Wrong data size");
@@ -31,11 +38,38 @@ static const struct device *const dmic_dev = DEVICE_DT_GET(DT_NODELABEL(pdm));
 
 static int debug_enabled;
 static int debug_fft_enabled;
+static int debug_bands_enabled;
+
+// see sound.h
+static uint8_t adpcm_frame[SOUND_ADPCM_HEADER_SIZE + SAMPLES_PER_BLOCK / 2];
+static struct adpcm_state adpcm_state;
+static uint16_t adpcm_seq;
+
+static struct {
+	atomic_t adpcm_blocks;
+	atomic_t adpcm_cycles;
+} stats;
+
+// One frequency band per LED on the badge itself
+#define NUM_BANDS	NLEDS
 
 // Accumulated data across loops
-float fft_history[NLEDS];
+float fft_history[NUM_BANDS];
 // colors
-int led_hues[NLEDS];
+int led_hues[NUM_BANDS];
+
+// last values sent in the bands stream, what the next deltas are from
+static struct {
+	uint8_t energy[NUM_BANDS];
+	uint8_t history[NUM_BANDS];
+	uint8_t hue[NUM_BANDS];
+} bands_sent;
+static uint8_t bands_seq;
+static int bands_since_key;
+
+// for sound_get_level()
+static float sound_avg;
+static int sound_level;
 
 // FIXME code duplication
 // select from [0, n) without bias by rerolling "bad" results
@@ -82,15 +116,23 @@ int setup_sound() {
 
 	debug_enabled = 0;
 
-	for (int i = 0; i < NLEDS; i++) {
-		led_hues[i] = rand_choice(6 * 256);
+	for (int i = 0; i < NUM_BANDS; i++) {
+		led_hues[i] = rand_choice(COLOR_HUE_STEPS);
 	}
 
 	return 0;
 }
 
 int start_sound() {
-	return dmic_trigger(dmic_dev, DMIC_TRIGGER_START);
+	// (the factory test can get here before or after main.c does)
+	static int started;
+	if (started)
+		return 0;
+
+	int ret = dmic_trigger(dmic_dev, DMIC_TRIGGER_START);
+	if (!ret)
+		started = 1;
+	return ret;
 }
 
 // Yoink this function from the SYLT-FFT code, except modify it
@@ -115,57 +157,114 @@ void badge_fft_permutate(fft_complex_t * restrict out, const int16_t * restrict
 // FFT work buffer (integer)
 fft_complex_t sound_fft[SAMPLES_PER_BLOCK];
 // FFT work buffer (each loop, float, logarithmic)
-float fft_data_log[NLEDS];
+float fft_data_log[NUM_BANDS];
 
 static inline float mag_sq(fft_complex_t x) {
 	return	(float)x.r * (float)x.r +
 			(float)x.i * (float)x.i;
 }
 
-static void set_led_hsvish(int idx, int h, int v) {
-	int r, g, b;
-
-	// awkward HSV-ish --> RGB, except S = 1 always
-	int huebin = h / 256;
-	int hue_in_bin = h % 256;
-
-	// hue_in_bin in [0, 255]
-
-	switch (huebin) {
-		case 0:
-			r = v;
-			g = v * hue_in_bin / 255;
-			b = 0;
-			break;
-		case 1:
-			r = v * (255 - hue_in_bin) / 255;
-			g = v;
-			b = 0;
-			break;
-		case 2:
-			r = 0;
-			g = v;
-			b = v * hue_in_bin / 255;
-			break;
-		case 3:
-			r = 0;
-			g = v * (255 - hue_in_bin) / 255;
-			b = v;
-			break;
-		case 4:
-			r = v * hue_in_bin / 255;
-			g = 0;
-			b = v;
-			break;
-		case 5:
+static void sound_block_sent(const void *data) {
+	void *block = (void *)data;
+	k_mem_slab_free(&mem_slab, &block);
+}
+
+static void send_adpcm(const int16_t *samples) {
+	uint32_t start = k_cycle_get_32();
+
+	// the state before the block, so that it can be decoded after lost ones
+	adpcm_frame[0] = 'A';
+	adpcm_frame[1] = 'D';
+	sys_put_le16(adpcm_seq++, adpcm_frame + 2);
+	sys_put_le16(adpcm_state.predictor, adpcm_frame + 4);
+	adpcm_frame[6] = adpcm_state.index;
+	adpcm_frame[7] = 0;
+	adpcm_encode(&adpcm_state, samples, SAMPLES_PER_BLOCK, adpcm_frame + SOUND_ADPCM_HEADER_SIZE);
+
+	atomic_add(&stats.adpcm_cycles, k_cycle_get_32() - start);
+	atomic_inc(&stats.adpcm_blocks);
+	badge_usb_stream(USB_STREAM_ADPCM, adpcm_frame, sizeof(adpcm_frame));
+}
+
+// Returns 1 if the block was lent to USB, it goes back to the slab once it's sent
+// (the FFT has its own copy of the samples by now)
+static int send_debug(void *block, uint32_t size) {
+	switch (debug_enabled) {
+		case SOUND_DEBUG_RAW:
+			return !badge_usb_stream_lend(USB_STREAM_SOUND, block, size, sound_block_sent);
+		case SOUND_DEBUG_ADPCM:
+			send_adpcm(block);
+			return 0;
 		default:
-			r = v;
-			g = 0;
-			b = v * (255 - hue_in_bin) / 255;
-			break;
+			return 0;
 	}
+}
 
-	set_led(idx, r, g, b);
+static uint8_t quantise_energy(float energy) {
+	float v = log2f(1 + energy) * SOUND_BANDS_STEPS_PER_DOUBLING + 0.5f;
+	return v < 255 ? (uint8_t)v : 255;
+}
+
+// See sound.h for the format
+static void send_bands() {
+	uint8_t energy[NUM_BANDS], history[NUM_BANDS], hue[NUM_BANDS];
+	for (int i = 0; i < NUM_BANDS; i++) {
+		energy[i] = quantise_energy(fft_data_log[i]);
+		history[i] = quantise_energy(fft_history[i]);
+		hue[i] = led_hues[i] * 256 / COLOR_HUE_STEPS;
+	}
+
+	// (the history either decays, by about 5 steps a block, or jumps to the energy)
+	int key = ++bands_since_key >= SOUND_BANDS_KEY_INTERVAL;
+	for (int i = 0; i < NUM_BANDS && !key; i++) {
+		int dh = history[i] - bands_sent.history[i];
+		if (history[i] != energy[i] && (dh < -7 || dh > 7))
+			key = 1;
+	}
+
+	uint8_t record[SOUND_BANDS_HEADER_SIZE + 3 * NUM_BANDS];
+	uint8_t *p = record + SOUND_BANDS_HEADER_SIZE;
+	if (key) {
+		memcpy(p, energy, NUM_BANDS);
+		memcpy(p + NUM_BANDS, history, NUM_BANDS);
+		memcpy(p + 2 * NUM_BANDS, hue, NUM_BANDS);
+		p += 3 * NUM_BANDS;
+		bands_since_key = 0;
+	} else {
+		// the energies change too much from block to block to be worth it
+		memcpy(p, energy, NUM_BANDS);
+		p += NUM_BANDS;
+		// a nibble for each history, first band in the low one
+		const int nibbles_len = (NUM_BANDS + 1) / 2;
+		memset(p, 0, nibbles_len);
+		uint32_t hue_changed = 0;
+		for (int i = 0; i < NUM_BANDS; i++) {
+			int dh = history[i] == energy[i] ? SOUND_BANDS_HISTORY_IS_ENERGY : history[i] - bands_sent.history[i];
+			p[i / 2] |= (dh & 0xf) << (i % 2 * 4);
+			if (hue[i] != bands_sent.hue[i])
+				hue_changed |= 1 << i;
+		}
+		p += nibbles_len;
+		sys_put_le16(hue_changed, p);
+		p[2] = hue_changed >> 16;
+		p += 3;
+		for (int i = 0; i < NUM_BANDS; i++) {
+			if (hue_changed & (1 << i))
+				*p++ = hue[i];
+		}
+	}
+
+	record[0] = 'B';
+	record[1] = key ? 'K' : 'D';
+	record[2] = bands_seq++;
+	record[3] = sound_level;
+	sys_put_le32(k_uptime_get_32(), record + 4);
+
+	memcpy(bands_sent.energy, energy, NUM_BANDS);
+	memcpy(bands_sent.history, history, NUM_BANDS);
+	memcpy(bands_sent.hue, hue, NUM_BANDS);
+
+	badge_usb_stream(USB_STREAM_BANDS, record, p - record);
 }
 
 void process_sound(bool do_leds) {
@@ -184,15 +283,13 @@ void process_sound(bool do_leds) {
 	int16_t *buffer = buffer_;
 	badge_fft_permutate(sound_fft, buffer);
 
-	if (debug_enabled)
-		badge_usb_write(buffer_, size);
-
-	k_mem_slab_free(&mem_slab, &buffer_);
+	if (!send_debug(buffer_, size))
+		k_mem_slab_free(&mem_slab, &buffer_);
 
 	fft_forward(sound_fft, SAMPLES_LOG2);
 
 	if (debug_fft_enabled)
-		badge_usb_write((uint8_t *)&sound_fft, sizeof(sound_fft));
+		badge_usb_stream(USB_STREAM_FFT, (uint8_t *)&sound_fft, sizeof(sound_fft));
 
 	// XXX we use FPU, guess that should be fine
 	// (wrt both perf *and* RTOS bugs)
@@ -285,83 +382,151 @@ void process_sound(bool do_leds) {
 	fft_data_log[20] = sum;
 
 	// update the history data
-	for (int i = 0; i < NLEDS; i++) {
+	for (int i = 0; i < NUM_BANDS; i++) {
 		// if more than 10% louder --> new color
 		if (fft_data_log[i] > fft_history[i] * 1.1f) {
-			led_hues[i] = rand_choice(6 * 256);
+			led_hues[i] = rand_choice(COLOR_HUE_STEPS);
 		}
 	}
 
-	for (int i = 0; i < NLEDS; i++) {
+	for (int i = 0; i < NUM_BANDS; i++) {
 		// aging, calculated s.t. after ~0.5s we get 1% of old value
 		fft_history[i] *= 0.55f;
 	}
 
-	for (int i = 0; i < NLEDS; i++) {
+	for (int i = 0; i < NUM_BANDS; i++) {
 		// update history if we are louder
 		if (fft_data_log[i] > fft_history[i]) {
 			fft_history[i] = fft_data_log[i];
 		}
 	}
 
+	// loudness of this block vs. the long-term average, for effects
+	sum = 0;
+	for (int i = 0; i < NUM_BANDS; i++)
+		sum += fft_data_log[i];
+	// ~2 s time constant
+	sound_avg = sound_avg * 0.97f + sum * 0.03f;
+	if (sound_avg > 0) {
+		float level = sum / sound_avg * 128;
+		sound_level = level > 255 ? 255 : level;
+	}
+
+	gatt_send_bands(sound_level, fft_data_log, NUM_BANDS);
+
+	if (debug_bands_enabled)
+		send_bands();
+
 	// calculate max to scale colors
 	float max_val = 0;
-	for (int i = 0; i < NLEDS; i++) {
+	for (int i = 0; i < NUM_BANDS; i++) {
 		if (fft_history[i] > max_val)
 			max_val = fft_history[i];
 	}
 
 	if (do_leds) {
-		for (int led = 0; led < NLEDS; led++) {
-			// printk("bin[%d] = %d\n", led, (int)(fft_history[led]));
-			uint32_t led_val = fft_history[led] / max_val * 0xFF;
+		// spread the bands evenly over however many LEDs are chained
+		const int nleds = get_num_leds();
+		int led = 0;
+
+		for (int band = 0; band < NUM_BANDS; band++) {
+			// printk("bin[%d] = %d\n", band, (int)(fft_history[band]));
+			uint32_t led_val = fft_history[band] / max_val * 0xFF;
 			if (led_val > 0xFF) led_val = 0xFF;
-			set_led_hsvish(led, led_hues[led], led_val);
+
+			int r, g, b;
+			color_hue_to_rgb(led_hues[band], led_val, &r, &g, &b);
+
+			int band_end = (band + 1) * nleds / NUM_BANDS;
+			for (; led < band_end; led++)
+				set_led(led, r, g, b);
 		}
 	}
 }
 
 // FIXME the code duplication is ugly
-int process_sound_factory() {
+int sound_measure_tone(struct sound_tone *out) {
 	void *buffer_;
 	uint32_t size;
 	int ret = dmic_read(dmic_dev, 0, &buffer_, &size, 1000);
 	if (ret < 0) {
 		printk("pdm - read failed: %d\n", ret);
-		return 0;
+		return ret;
 	}
 	if (size != BLOCK_SIZE) {
 		printk("pdm - bad block size: %u\n", size);
-		return 0;
+		k_mem_slab_free(&mem_slab, &buffer_);
+		return -EIO;
 	}
 
 	int16_t *buffer = buffer_;
 	badge_fft_permutate(sound_fft, buffer);
 
-	if (debug_enabled)
-		badge_usb_write(buffer_, size);
-
-	k_mem_slab_free(&mem_slab, &buffer_);
+	if (!send_debug(buffer_, size))
+		k_mem_slab_free(&mem_slab, &buffer_);
 
 	fft_forward(sound_fft, SAMPLES_LOG2);
 
-	printk("FFT [0] = %d %d\n", sound_fft[0].r, sound_fft[0].i);
-	printk("FFT [10] = %d %d\n", sound_fft[10].r, sound_fft[10].i);
-	printk("FFT [28] = %d %d\n", sound_fft[28].r, sound_fft[28].i);
-	printk("FFT [29] = %d %d\n", sound_fft[29].r, sound_fft[29].i);
+	out->dc = mag_sq(sound_fft[0]);
+	out->bin_440 = mag_sq(sound_fft[SOUND_TONE_BIN]);
+
+	// the window spreads the tone over the bins either side, so those count
+	// towards it and the rest of the speech band is the noise
+	out->tone = 0;
+	float noise = 0;
+	int noise_bins = 0;
+	for (int i = SOUND_NOISE_FIRST_BIN; i <= SOUND_NOISE_LAST_BIN; i++) {
+		if (i >= SOUND_TONE_BIN - 2 && i <= SOUND_TONE_BIN + 2) {
+			if (i >= SOUND_TONE_BIN - 1 && i <= SOUND_TONE_BIN + 1)
+				out->tone += mag_sq(sound_fft[i]);
+		} else {
+			noise += mag_sq(sound_fft[i]);
+			noise_bins++;
+		}
+	}
+	// over the same 3 bins as the tone
+	out->noise = noise * 3 / noise_bins;
 
-	// DC check is a workaround for weird mic data that shows up right after reset
-	uint32_t m_dc = mag_sq(sound_fft[0]);
-	uint32_t m_440 = mag_sq(sound_fft[28]);
+	return 0;
+}
+
+int process_sound_factory() {
+	struct sound_tone m;
+	if (sound_measure_tone(&m))
+		return 0;
 
+	printk("Factory: mic dc %u, 440 Hz %u, tone %u noise %u\n",
+		(uint32_t)m.dc, (uint32_t)m.bin_440, (uint32_t)m.tone, (uint32_t)m.noise);
+
+	// DC check is a workaround for weird mic data that shows up right after reset
 	// arbitrary thresholds that seem to work ok
-	return m_dc < 25 && m_440 > 100;
+	return m.dc < 25 && m.bin_440 > 100;
 }
 
-void sound_enable_debug(int enable) {
-	debug_enabled = enable;
+void sound_enable_debug(int mode) {
+	if (mode == SOUND_DEBUG_ADPCM && debug_enabled != SOUND_DEBUG_ADPCM) {
+		adpcm_state.predictor = 0;
+		adpcm_state.index = 0;
+		adpcm_seq = 0;
+	}
+	debug_enabled = mode;
+}
+
+void get_sound_stats(struct sound_stats *out) {
+	out->adpcm_blocks = atomic_clear(&stats.adpcm_blocks);
+	out->adpcm_cycles = atomic_clear(&stats.adpcm_cycles);
 }
 
 void sound_enable_fft_debug(int enable) {
 	debug_fft_enabled = enable;
 }
+
+void sound_enable_bands_debug(int enable) {
+	// starts with a key record
+	bands_since_key = SOUND_BANDS_KEY_INTERVAL;
+	debug_bands_enabled = enable;
+}
+
+int sound_get_level() {
+	return sound_level;
+}
@@ -7,5 +7,61 @@ int setup_sound();
 int start_sound();
 void process_sound(bool do_leds);
 int process_sound_factory();
-void sound_enable_debug(int enable);
+
+// One block's worth of the factory mic check, as power (squared FFT magnitude)
+struct sound_tone {
+	float dc;
+	// the bin process_sound_factory() has always looked at
+	float bin_440;
+	// the 3 bins around 440 Hz, and the rest of SOUND_NOISE_*_BIN scaled to 3 bins
+	float tone;
+	float noise;
+};
+// 440 Hz at 15.6 Hz per bin
+#define SOUND_TONE_BIN			28
+// 125 Hz to 4 kHz
+#define SOUND_NOISE_FIRST_BIN	8
+#define SOUND_NOISE_LAST_BIN	255
+// Reads the next block and measures it, 0 or a negative error
+int sound_measure_tone(struct sound_tone *out);
+enum sound_debug {
+	SOUND_DEBUG_OFF,
+	// the samples as they are, signed 16-bit little endian at 16 kHz, 32 KB/s
+	SOUND_DEBUG_RAW,
+	// IMA-ADPCM (see adpcm.h), 8 KB/s. Each 64 ms block is a frame of
+	//  'A', 'D', sequence number (u16), predictor (i16), step index (u8), 0,
+	//  then 512 bytes for 1024 samples
+	// with the encoder state from before the block, so each decodes on its own
+	SOUND_DEBUG_ADPCM,
+};
+#define SOUND_ADPCM_HEADER_SIZE	8
+void sound_enable_debug(int mode);
 void sound_enable_fft_debug(int enable);
+
+// The state process_sound() ends up with for each 64 ms block, about 50 bytes
+// instead of the 8 KB FFT dump. Each record is
+//  'B', 'K' or 'D', sequence number (u8), sound level (u8), uptime in ms (u32)
+// then for a key record ('K'), for each of the 21 bands its energy, then its
+// history, then its hue (hue * 256 / COLOR_HUE_STEPS), all u8. Energies are
+// log2(1 + energy) * SOUND_BANDS_STEPS_PER_DOUBLING, so 0.5 dB steps.
+// A delta record ('D') has the energies the same way, then each band's history
+// as the change from the record before in a signed nibble (first band in the
+// low one, 11 bytes), or SOUND_BANDS_HISTORY_IS_ENERGY, then a bitmask of the
+// bands whose hue changed (u24), then their hues.
+// Key records come every SOUND_BANDS_KEY_INTERVAL, and whenever a change doesn't
+// fit in a nibble. Decode with bands.py
+void sound_enable_bands_debug(int enable);
+#define SOUND_BANDS_HEADER_SIZE			8
+#define SOUND_BANDS_STEPS_PER_DOUBLING	6
+#define SOUND_BANDS_KEY_INTERVAL		16
+#define SOUND_BANDS_HISTORY_IS_ENERGY	-8
+// 128 = as loud as the last couple of seconds on average, 255 = twice as loud or more
+int sound_get_level();
+
+struct sound_stats {
+	uint32_t adpcm_blocks;
+	// summed over the blocks, in k_cycle_get_32() cycles
+	uint32_t adpcm_cycles;
+};
+// Counts since the last call
+void get_sound_stats(struct sound_stats *out);
@@ -0,0 +1,163 @@
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Host test for peers.c, builds it as a shared library with the system compiler
+# python3 test_peers.py [table bits]
+
+import ctypes
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+BITS = int(sys.argv[1]) if len(sys.argv) > 1 else 10
+SIZE = 1 << BITS
+MAX_LOAD = SIZE - SIZE // 4
+ADDR_LEN = 7
+PEER_DURATION_MAX = 0xC000
+
+PEER_TYPE_BADGE = 2
+PEER_TYPE_EASTEREGG = 3
+PEER_TYPE_SPOOFED = 4
+
+src = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'peers.c')
+lib_file = os.path.join(tempfile.mkdtemp(), 'peers.so')
+subprocess.check_call(['cc', '-O2', '-shared', '-fPIC', f'-DPEER_TABLE_BITS={BITS}', '-o', lib_file, src])
+lib = ctypes.CDLL(lib_file)
+
+class PeerEntry(ctypes.Structure):
+	_fields_ = [
+		('addr', ctypes.c_uint8 * ADDR_LEN),
+		('type', ctypes.c_uint8),
+		('last_seen', ctypes.c_uint32),
+		('first_seen_s', ctypes.c_uint16),
+		('rssi_max', ctypes.c_int8),
+	]
+
+class PeerTable(ctypes.Structure):
+	_fields_ = [
+		('slots', PeerEntry * SIZE),
+		('num_peers', ctypes.c_int),
+		('num_imposters', ctypes.c_int),
+		('num_badge_makers', ctypes.c_int),
+		('num_evictions', ctypes.c_uint32),
+		('on_remove', ctypes.c_void_p),
+	]
+
+lib.peers_seen.argtypes = [ctypes.POINTER(PeerTable), ctypes.c_char_p, ctypes.c_int, ctypes.c_int8, ctypes.c_uint32]
+lib.peers_find.argtypes = [ctypes.POINTER(PeerTable), ctypes.c_char_p]
+lib.peers_find.restype = ctypes.POINTER(PeerEntry)
+lib.peers_expire.argtypes = [ctypes.POINTER(PeerTable), ctypes.c_uint32, ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint32)]
+
+random.seed(1)
+
+def random_addr():
+	# random static address
+	return bytes([1]) + random.randbytes(ADDR_LEN - 1)
+
+def check_counts(table, expected):
+	assert table.num_peers == len(expected), (table.num_peers, len(expected))
+	assert table.num_badge_makers == sum(1 for t in expected.values() if t == PEER_TYPE_EASTEREGG)
+	assert table.num_imposters == sum(1 for t in expected.values() if t == PEER_TYPE_SPOOFED)
+	occupied = sum(1 for s in table.slots if s.type)
+	assert occupied == len(expected), (occupied, len(expected))
+
+table = PeerTable()
+lib.peers_init(ctypes.byref(table))
+
+# insert, find, re-insert
+expected = {}
+for i in range(MAX_LOAD):
+	addr = random_addr()
+	t = random.choice([PEER_TYPE_BADGE, PEER_TYPE_EASTEREGG, PEER_TYPE_SPOOFED])
+	assert lib.peers_seen(ctypes.byref(table), addr, t, -60, i) == 1
+	expected[addr] = t
+for addr in expected:
+	assert lib.peers_find(ctypes.byref(table), addr)
+	assert lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_BADGE, -60, MAX_LOAD) == 0
+for _ in range(100):
+	assert not lib.peers_find(ctypes.byref(table), random_addr())
+check_counts(table, expected)
+print(f"insert/find ok with {MAX_LOAD} of {SIZE} slots")
+
+# over capacity, the new peer evicts someone
+addr = random_addr()
+assert lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_BADGE, -60, MAX_LOAD + 1) == 2
+assert table.num_peers == MAX_LOAD
+assert table.num_evictions == 1
+expected = {a: t for a, t in expected.items() if lib.peers_find(ctypes.byref(table), a)}
+expected[addr] = PEER_TYPE_BADGE
+check_counts(table, expected)
+print("eviction ok")
+
+# expire half of them by age, everything left must still be findable
+lib.peers_init(ctypes.byref(table))
+expected = {}
+for i in range(MAX_LOAD):
+	addr = random_addr()
+	lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_SPOOFED, -60, i * 10)
+	expected[addr] = (PEER_TYPE_SPOOFED, i * 10)
+now = MAX_LOAD * 10
+max_age = now // 2
+oldest_seen = ctypes.c_uint32()
+removed = lib.peers_expire(ctypes.byref(table), now, max_age, ctypes.byref(oldest_seen))
+expected_seen = {a: seen for a, (t, seen) in expected.items() if now - seen < max_age}
+expected = {a: t for a, (t, seen) in expected.items() if now - seen < max_age}
+assert removed == MAX_LOAD - len(expected), removed
+assert oldest_seen.value == min(expected_seen.values()), oldest_seen.value
+for addr in expected:
+	assert lib.peers_find(ctypes.byref(table), addr)
+check_counts(table, expected)
+print(f"expiry ok ({removed} removed)")
+
+# expiry across the 32-bit ms wraparound
+lib.peers_init(ctypes.byref(table))
+addr = random_addr()
+lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_BADGE, -60, 0xffffff00)
+assert lib.peers_expire(ctypes.byref(table), 0x100, 0x1000, ctypes.byref(oldest_seen)) == 0
+assert oldest_seen.value == 0xffffff00
+assert lib.peers_expire(ctypes.byref(table), 0x1000, 0x1000, ctypes.byref(oldest_seen)) == 1
+print("wraparound ok")
+
+# strongest RSSI, and everyone removed goes through on_remove
+lib.peers_init(ctypes.byref(table))
+removed_entries = []
+OnRemove = ctypes.CFUNCTYPE(None, ctypes.POINTER(PeerEntry))
+on_remove = OnRemove(lambda e: removed_entries.append((bytes(e.contents.addr), e.contents.first_seen_s, e.contents.rssi_max)))
+table.on_remove = ctypes.cast(on_remove, ctypes.c_void_p)
+addr = random_addr()
+for now, rssi in [(5000, -80), (6000, -50), (7000, -70)]:
+	lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_BADGE, rssi, now)
+lib.peers_expire(ctypes.byref(table), 100000, 1000, ctypes.byref(oldest_seen))
+assert removed_entries == [(addr, 5, -50)], removed_entries
+
+# someone around for a day, seen every 30 s: the 16-bit first_seen_s stops at
+# PEER_DURATION_MAX behind instead of wrapping back to a short encounter
+removed_entries.clear()
+for now in range(1000, 24 * 3600 * 1000, 30000):
+	lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_BADGE, -60, now)
+lib.peers_expire(ctypes.byref(table), now + 100000, 60000, ctypes.byref(oldest_seen))
+duration = (now // 1000 - removed_entries[0][1]) & 0xffff
+assert PEER_DURATION_MAX <= duration < PEER_DURATION_MAX + 60, duration
+table.on_remove = None
+print("on_remove ok")
+
+# churn: a crowd much bigger than the table walking past, LRU-ish eviction should
+# keep nearly all of the recently seen ones (it only looks at PEER_EVICT_WINDOW slots,
+# so not always all of them)
+lib.peers_init(ctypes.byref(table))
+crowd = [random_addr() for _ in range(SIZE * 4)]
+start = time.perf_counter()
+for now, addr in enumerate(crowd):
+	lib.peers_seen(ctypes.byref(table), addr, PEER_TYPE_BADGE, -60, now)
+elapsed = time.perf_counter() - start
+recent = crowd[-MAX_LOAD // 2:]
+kept = sum(1 for a in recent if lib.peers_find(ctypes.byref(table), a))
+print(f"churn: kept {kept} of the {len(recent)} most recent, {table.num_evictions} evictions, "
+	f"{elapsed / len(crowd) * 1e9:.0f} ns per call (including ctypes)")
+assert kept > len(recent) * 0.95
+
+print(f"{ctypes.sizeof(PeerEntry)} bytes per slot, {ctypes.sizeof(PeerTable)} bytes total, "
+	f"{ctypes.sizeof(PeerTable) / MAX_LOAD:.1f} bytes per peer at max load")
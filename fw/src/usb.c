@@ -2,20 +2,97 @@
 // See LICENSE file in project root for terms.
 
 #include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <zephyr.h>
+#include <sys/byteorder.h>
 #include <sys/ring_buffer.h>
 #include <drivers/uart.h>
 #include <usb/usb_device.h>
 
+#include "enclog.h"
+#include "factory.h"
+#include "gatt.h"
+#include "misc.h"
 #include "nfc.h"
 #include "nvs.h"
+#include "radio.h"
+#include "rpc.h"
 #include "sound.h"
 #include "usb.h"
 
 K_PIPE_DEFINE(usb_rxpipe, 512, 1);
 RING_BUF_DECLARE(usb_txring, 4096);
 
+// A USB_TX_WAIT write gives up after this long without the host reading anything
+#define USB_TX_STALL_MS		100
+// Buffers lent at once (see badge_usb_lend())
+#define USB_TX_LEND_MAX		1
+
+// Writers are serialised by usb_tx_lock, the interrupt handler is the only reader
+K_MUTEX_DEFINE(usb_tx_lock);
+// given by the interrupt handler whenever it sent something
+K_SEM_DEFINE(usb_tx_sem, 0, 1);
+
+// Lent buffers go out once the ring has sent everything that was put in before
+// them (ring_mark, counted in bytes ever put into it)
+struct usb_lend {
+	const uint8_t *data;
+	uint32_t len;
+	uint32_t sent;
+	uint32_t ring_mark;
+	void (*done)(const void *data);
+};
+static struct usb_lend tx_lends[USB_TX_LEND_MAX];
+// head is advanced by the interrupt handler as lends finish (tx_fill()),
+// tail by writers queueing new ones (badge_usb_lend())
+static atomic_t tx_lend_head, tx_lend_tail;
+static uint32_t tx_ring_put_total;
+static uint32_t tx_ring_sent_total;
+// nothing was sent for USB_TX_STALL_MS, USB_TX_WAIT writes don't wait until something is
+static atomic_t tx_stalled;
+
+static struct {
+	atomic_t bytes;
+	atomic_t dropped_bytes;
+	atomic_t dropped_writes;
+	atomic_t lent;
+	atomic_t stalls;
+} tx_stats;
+
+static void tx_fill(const struct device *dev) {
+	struct usb_lend *lend = NULL;
+	uint32_t max = UINT32_MAX;
+	if (atomic_get(&tx_lend_head) != atomic_get(&tx_lend_tail)) {
+		lend = &tx_lends[atomic_get(&tx_lend_head) % USB_TX_LEND_MAX];
+		max = lend->ring_mark - tx_ring_sent_total;
+	}
+
+	if (lend && !max) {
+		int sent = uart_fifo_fill(dev, lend->data + lend->sent, lend->len - lend->sent);
+		if (sent > 0)
+			lend->sent += sent;
+		if (lend->sent == lend->len) {
+			lend->done(lend->data);
+			atomic_inc(&tx_lend_head);
+		}
+	} else {
+		uint8_t *data;
+		uint32_t len = ring_buf_get_claim(&usb_txring, &data, max);
+		if (!len) {
+			uart_irq_tx_disable(dev);
+			return;
+		}
+		int sent = uart_fifo_fill(dev, data, len);
+		if (sent < 0)
+			sent = 0;
+		ring_buf_get_finish(&usb_txring, sent);
+		tx_ring_sent_total += sent;
+	}
+	atomic_clear(&tx_stalled);
+	k_sem_give(&usb_tx_sem);
+}
+
 const struct device *const cdcacm_dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
 
 static void interrupt_handler(const struct device *dev, void *user_data)
@@ -41,43 +118,186 @@ static void interrupt_handler(const struct device *dev, void *user_data)
 			}
 		}
 
-		if (uart_irq_tx_ready(dev)) {
-			uint8_t buffer[64];
-			int rb_len, send_len;
+		if (uart_irq_tx_ready(dev))
+			tx_fill(dev);
+	}
+}
 
-			rb_len = ring_buf_get(&usb_txring, buffer, sizeof(buffer));
-			if (!rb_len) {
-				uart_irq_tx_disable(dev);
-				continue;
-			}
+static int echo_is_on;
 
-			send_len = uart_fifo_fill(dev, buffer, rb_len);
-			if (send_len < rb_len) {
-				printk("Drop %d tx bytes\r\n", rb_len - send_len);
-			}
+// Binary protocol (see rpc.h), switched to by a 0 byte on the text console
+// Message types, host to badge:
+//  ping	replies with the same payload
+//  command	runs a console command line, its output comes back in text messages
+//  get		2-byte parameter id (enum rpc_param), replies with its 4-byte value
+//  set		2-byte parameter id, 4-byte value
+//  exit	back to the text console
+// Every request gets a reply with the same sequence number, its payload is a status
+// (enum rpc_status) and then anything else. The badge also sends stream messages,
+// payload is the stream (enum usb_stream) and then its data, numbered per stream
+// All values are little endian, see badge_rpc.py for the host side
+enum rpc_type {
+	RPC_PING = 0x01,
+	RPC_COMMAND = 0x02,
+	RPC_GET = 0x03,
+	RPC_SET = 0x04,
+	RPC_EXIT = 0x05,
+
+	RPC_REPLY = 0x80,
+	RPC_TEXT = 0x81,
+	RPC_STREAM = 0x82,
+};
+
+enum rpc_status {
+	RPC_OK = 0,
+	RPC_ERR_UNKNOWN = -1,
+	RPC_ERR_LENGTH = -2,
+	RPC_ERR_PARAM = -3,
+	RPC_ERR_READ_ONLY = -4,
+	RPC_ERR_WRITE_ONLY = -5,
+	RPC_ERR_VALUE = -6,
+};
+
+static atomic_t rpc_mode;
+// sequence number of the command whose output is being sent
+static uint8_t rpc_text_seq;
+static uint8_t rpc_stream_seq[USB_NUM_STREAMS];
+
+// usb_tx_lock held
+static uint32_t tx_put(const uint8_t *data, uint32_t sz, enum usb_tx_policy policy) {
+	if (policy == USB_TX_DROP && ring_buf_space_get(&usb_txring) < sz) {
+		atomic_add(&tx_stats.dropped_bytes, sz);
+		atomic_inc(&tx_stats.dropped_writes);
+		return 0;
+	}
+
+	uint32_t queued = 0;
+	while (1) {
+		uint32_t n = ring_buf_put(&usb_txring, data + queued, sz - queued);
+		queued += n;
+		tx_ring_put_total += n;
+		uart_irq_tx_enable(cdcacm_dev);
+		if (queued == sz || atomic_get(&tx_stalled))
+			break;
+		if (k_sem_take(&usb_tx_sem, K_MSEC(USB_TX_STALL_MS))) {
+			atomic_set(&tx_stalled, 1);
+			atomic_inc(&tx_stats.stalls);
+			break;
 		}
 	}
+
+	atomic_add(&tx_stats.bytes, queued);
+	if (queued < sz) {
+		atomic_add(&tx_stats.dropped_bytes, sz - queued);
+		atomic_inc(&tx_stats.dropped_writes);
+	}
+	return queued;
 }
 
-static int echo_is_on;
+// for rpc_encode()
+static void tx_put_wait(const uint8_t *data, uint32_t len) {
+	tx_put(data, len, USB_TX_WAIT);
+}
+
+// Whole frames go into the TX ring at once. With USB_TX_DROP the frame is sent
+// only if all of it fits
+static int rpc_send_policy(uint8_t type, uint8_t seq, const uint8_t *hdr, uint32_t hdr_len,
+	const uint8_t *data, uint32_t len, enum usb_tx_policy policy) {
+	int ret = 0;
+	k_mutex_lock(&usb_tx_lock, K_FOREVER);
+	uint32_t frame_max = RPC_FRAME_MAX(hdr_len + len);
+	if (policy == USB_TX_DROP && ring_buf_space_get(&usb_txring) < frame_max) {
+		atomic_add(&tx_stats.dropped_bytes, frame_max);
+		atomic_inc(&tx_stats.dropped_writes);
+		ret = -ENOSPC;
+	} else {
+		rpc_encode(tx_put_wait, type, seq, hdr, hdr_len, data, len);
+	}
+	k_mutex_unlock(&usb_tx_lock);
+	return ret;
+}
+
+static void rpc_send(uint8_t type, uint8_t seq, const uint8_t *hdr, uint32_t hdr_len,
+	const uint8_t *data, uint32_t len) {
+	rpc_send_policy(type, seq, hdr, hdr_len, data, len, USB_TX_WAIT);
+}
+
+// Console output, as text messages in binary mode
+static void console_write(const uint8_t *data, uint32_t len) {
+	if (atomic_get(&rpc_mode))
+		rpc_send(RPC_TEXT, rpc_text_seq, NULL, 0, data, len);
+	else
+		badge_usb_write(data, len);
+}
+
+// Received bytes are taken from usb_rxpipe as many at a time as there are, and the
+// echo for them is collected and written once they've all been handled (or the
+// line is done), rather than a pipe read and a write for each byte
+static struct {
+	uint8_t buf[64];
+	uint32_t len;
+	uint32_t pos;
+} rx;
+
+static struct {
+	uint8_t buf[128];
+	uint32_t len;
+} echo;
+
+static void echo_flush() {
+	if (echo.len)
+		badge_usb_write(echo.buf, echo.len);
+	echo.len = 0;
+}
+
+static void echo_put(const uint8_t *data, uint32_t len) {
+	if (!echo_is_on)
+		return;
+	if (echo.len + len > sizeof(echo.buf))
+		echo_flush();
+	if (len > sizeof(echo.buf)) {
+		badge_usb_write(data, len);
+		return;
+	}
+	memcpy(echo.buf + echo.len, data, len);
+	echo.len += len;
+}
+
+static void echo_repeat(uint8_t c, uint32_t n) {
+	while (n--)
+		echo_put(&c, 1);
+}
+
+static uint8_t rx_next() {
+	if (rx.pos == rx.len) {
+		// about to wait, so the host gets the echo for everything so far first
+		echo_flush();
+		size_t got;
+		k_pipe_get(&usb_rxpipe, rx.buf, sizeof(rx.buf), &got, 1, K_FOREVER);
+		rx.len = got;
+		rx.pos = 0;
+	}
+	return rx.buf[rx.pos++];
+}
 
 static uint8_t rx_getchar() {
 	uint8_t c[2];
-	size_t sz;
-	k_pipe_get(&usb_rxpipe, &c, 1, &sz, 1, K_FOREVER);
-	if (echo_is_on) {
-		if (c[0] == '\r' || c[0] == '\n') {
-			// echo CRLF for either CR or LF
-			c[0] = '\r';
-			c[1] = '\n';
-			badge_usb_write(c, 2);
-		} else {
-			badge_usb_write(c, 1);
-		}
+	c[0] = rx_next();
+	if (c[0] == '\r' || c[0] == '\n') {
+		// echo CRLF for either CR or LF
+		c[0] = '\r';
+		c[1] = '\n';
+		echo_put(c, 2);
+	} else {
+		echo_put(c, 1);
 	}
+	echo_flush();
 	return c[0];
 }
 
+// rx_getline() got a 0, the switch to the binary protocol
+#define LINE_RPC	UINT32_MAX
+
 enum LineEditState {
 	LineNone,
 	LineSawCR,
@@ -85,15 +305,23 @@ enum LineEditState {
 	LineSawEscLBracket,
 };
 
+// the last line ended with a CR, so an LF right after it is part of the same line ending
+static int rx_saw_cr;
+
 static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 	uint32_t pos = 0;
 	uint32_t len = 0;
-	enum LineEditState state = LineNone;
+	enum LineEditState state = rx_saw_cr ? LineSawCR : LineNone;
+	rx_saw_cr = 0;
 
 	while (1) {
 		uint8_t c[3];
-		size_t _;
-		k_pipe_get(&usb_rxpipe, &c, 1, &_, 1, K_FOREVER);
+		c[0] = rx_next();
+
+		if (c[0] == 0) {
+			echo_flush();
+			return LINE_RPC;
+		}
 
 		switch (state) {
 			case LineSawCR:
@@ -110,15 +338,13 @@ static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 				if (c[0] == '\r' || c[0] == '\n') {
 					// Got a newline, we are done!
 
-					if (echo_is_on) {
-						// Gotta echo the newline though
-						c[0] = '\r';
-						c[1] = '\n';
-						badge_usb_write(c, 2);
-					}
+					rx_saw_cr = c[0] == '\r';
 
-					if (c[0] == '\r')
-						state = LineSawCR;
+					// Gotta echo the newline though, and before whatever the command prints
+					c[0] = '\r';
+					c[1] = '\n';
+					echo_put(c, 2);
+					echo_flush();
 
 					return len;
 				}
@@ -128,34 +354,22 @@ static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 					if (len == 0 || pos == 0)
 						break;
 
-					if (echo_is_on) {
-	                	// Echo a backspace explicitly (screen doesn't like 0x7f)
-	                	c[0] = '\x08';
-	                	badge_usb_write(c, 1);
-	                }
+	                // Echo a backspace explicitly (screen doesn't like 0x7f)
+	                echo_put("\x08", 1);
 
 	                if (len != pos) {
 	                    // Deleting a character from the middle, so we need to move everything left
 	                    memmove(&buf[pos - 1], &buf[pos], len - pos);
 
 	                    // Need to reprint everything too
-	                    if (echo_is_on) {
-	                    	badge_usb_write(&buf[pos - 1], len - pos);
-		                }
+	                    echo_put(&buf[pos - 1], len - pos);
 	                }
 
-	                if (echo_is_on) {
-		                // Need this to actually wipe the (deleted/last) character away
-		                c[0] = ' ';
-		                c[1] = '\x08';
-		                badge_usb_write(c, 2);
+	                // Need this to actually wipe the (deleted/last) character away
+	                echo_put(" \x08", 2);
 
-		                // Need to adjust the cursor back
-		                c[0] = '\x08';
-		                for (int _ = 0; _ < len - pos; _++) {
-		                	badge_usb_write(c, 1);
-		                }
-		            }
+	                // Need to adjust the cursor back
+	                echo_repeat('\x08', len - pos);
 
 	                pos -= 1;
 	                len -= 1;
@@ -182,21 +396,16 @@ static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 
 	            buf[pos] = c[0];
 
-	            if (echo_is_on) {
-		            // Echo the character
-		            badge_usb_write(c, 1);
+	            // Echo the character
+	            echo_put(c, 1);
 
-		            // If a character was inserted, we have to print everything else too
-		            if (len != pos) {
-		            	badge_usb_write(&buf[pos + 1], len - pos);
+	            // If a character was inserted, we have to print everything else too
+	            if (len != pos) {
+	            	echo_put(&buf[pos + 1], len - pos);
 
-		                // Now backspace to the same position
-		                c[0] = '\x08';
-		                for (int _ = 0; _ < len - pos; _++) {
-		                	badge_usb_write(c, 1);
-		                }
-		            }
-		        }
+	                // Now backspace to the same position
+	                echo_repeat('\x08', len - pos);
+	            }
 
 	            pos++;
 	            len++;
@@ -215,13 +424,8 @@ static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 	                if (pos != 0) {
 	                    pos--;
 
-	                    if (echo_is_on) {
-		                    // Echo the entire sequence
-		                    c[0] = '\x1b';
-		                    c[1] = '[';
-		                    c[2] = 'D';
-		                    badge_usb_write(c, 3);
-		                }
+	                    // Echo the entire sequence
+	                    echo_put("\x1b[D", 3);
 	                }
 	            }
 	            // Right arrow
@@ -229,13 +433,8 @@ static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 	                if (pos != len) {
 	                    pos++;
 
-	                    if (echo_is_on) {
-		                    // Echo the entire sequence
-		                    c[0] = '\x1b';
-		                    c[1] = '[';
-		                    c[2] = 'C';
-		                    badge_usb_write(c, 3);
-		                }
+	                    // Echo the entire sequence
+	                    echo_put("\x1b[C", 3);
 	                }
 	            } else {
 	                // Got ESC[-x which we don't understand. Just ignore it
@@ -247,54 +446,477 @@ static uint32_t rx_getline(uint8_t *buf, uint32_t bufsz) {
 }
 
 static void usb_putstr(const char *str) {
-	badge_usb_write(str, strlen(str));
+	console_write(str, strlen(str));
+}
+
+static void print_led_stats() {
+	static int64_t last_time;
+	int64_t now = k_uptime_get();
+	int64_t elapsed_ms = now - last_time;
+	last_time = now;
+
+	struct led_stats stats;
+	get_led_stats(&stats);
+
+	char buf[128];
+	if (stats.frames && elapsed_ms) {
+		snprintf(buf, sizeof(buf), "%u frames in %d ms (%d fps), encode %u us/frame, frame %u us, max gap %u us, %u errors\r\n",
+			stats.frames, (int)elapsed_ms, (int)(stats.frames * 1000 / elapsed_ms),
+			(uint32_t)k_cyc_to_us_floor64(stats.encode_cycles / stats.frames),
+			(uint32_t)k_cyc_to_us_floor64(stats.frame_cycles / stats.frames),
+			k_cyc_to_us_floor32(stats.gap_max_cycles), stats.errors);
+	} else {
+		snprintf(buf, sizeof(buf), "no frames sent\r\n");
+	}
+	usb_putstr(buf);
+}
+
+static void print_radio_stats() {
+	struct radio_stats stats;
+	get_radio_stats(&stats);
+
+	char buf[128];
+	snprintf(buf, sizeof(buf), "%u adverts/s (%u from badges), %u dropped\r\n",
+		stats.adverts_per_sec, stats.badge_adverts_per_sec, stats.ring_overflows);
+	usb_putstr(buf);
+	snprintf(buf, sizeof(buf), "level %s, %u ms sprint %u ms normal %u ms idle, scanning %u.%u%%\r\n",
+		get_radio_level_name(stats.level),
+		stats.level_ms[RADIO_LEVEL_SPRINT], stats.level_ms[RADIO_LEVEL_NORMAL], stats.level_ms[RADIO_LEVEL_IDLE],
+		stats.scan_duty_permille / 10, stats.scan_duty_permille % 10);
+	usb_putstr(buf);
+	snprintf(buf, sizeof(buf), "same badge heard again after %u ms on average, %u ms max\r\n",
+		stats.sighting_gap_avg_ms, stats.sighting_gap_max_ms);
+	usb_putstr(buf);
+	snprintf(buf, sizeof(buf), "duplicate filtering %s, scanning restarted %u times\r\n",
+		stats.dup_filter ? "on" : "off", stats.scan_refreshes);
+	usb_putstr(buf);
+}
+
+static void print_sound_stats() {
+	struct sound_stats stats;
+	get_sound_stats(&stats);
+
+	char buf[128];
+	if (stats.adpcm_blocks)
+		snprintf(buf, sizeof(buf), "%u ADPCM blocks, %u cycles (%u us) each to encode\r\n",
+			stats.adpcm_blocks, stats.adpcm_cycles / stats.adpcm_blocks,
+			k_cyc_to_us_floor32(stats.adpcm_cycles / stats.adpcm_blocks));
+	else
+		snprintf(buf, sizeof(buf), "no ADPCM blocks encoded\r\n");
+	usb_putstr(buf);
+}
+
+static void print_usb_stats() {
+	static int64_t last_time;
+	int64_t now = k_uptime_get();
+	int64_t elapsed_ms = now - last_time;
+	last_time = now;
+
+	struct usb_tx_stats stats;
+	get_usb_tx_stats(&stats);
+
+	char buf[128];
+	snprintf(buf, sizeof(buf), "%u bytes sent in %d ms (%u lent buffers), %u dropped in %u writes, %u stalls\r\n",
+		stats.bytes, (int)elapsed_ms, stats.lent, stats.dropped_bytes, stats.dropped_writes, stats.stalls);
+	usb_putstr(buf);
+}
+
+static void print_sync_stats() {
+	struct sync_stats stats;
+	get_sync_stats(&stats);
+
+	char buf[128];
+	if (stats.following)
+		snprintf(buf, sizeof(buf), "following %02X:%02X:%02X:%02X:%02X:%02X, ",
+			stats.leader[5], stats.leader[4], stats.leader[3], stats.leader[2], stats.leader[1], stats.leader[0]);
+	else
+		snprintf(buf, sizeof(buf), "on our own clock, ");
+	usb_putstr(buf);
+	snprintf(buf, sizeof(buf), "clock %u ms, offset %u ms, %u resets\r\n",
+		get_anim_clock_ms(), stats.offset_ms, stats.resets);
+	usb_putstr(buf);
+	snprintf(buf, sizeof(buf), "%u adverts from the leader, %u ms behind on average, %u ms max\r\n",
+		stats.samples, stats.lag_avg_ms, stats.lag_max_ms);
+	usb_putstr(buf);
+}
+
+static void print_badges_met() {
+	char buf[80];
+	snprintf(buf, sizeof(buf), "Met about %d badges, about %d in the crowd so far\r\n",
+		get_badges_met(), get_crowd_size());
+	usb_putstr(buf);
+}
+
+static void enclog_stream_write(const uint8_t *data, uint32_t len) {
+	badge_usb_stream(USB_STREAM_ENCLOG, data, len);
+}
+
+// "ENCLOG <size>" then exactly that many raw bytes, see enclog.py
+static void dump_enclog() {
+	enclog_flush();
+	uint32_t size = enclog_size();
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "ENCLOG %u\r\n", size);
+	usb_putstr(buf);
+	enclog_export(enclog_stream_write, size);
+}
+
+static void run_factory_stage(const char *args) {
+	// <stage> [argument]
+	char name[16];
+	int i;
+	for (i = 0; args[i] && args[i] != ' ' && i < sizeof(name) - 1; i++)
+		name[i] = args[i];
+	name[i] = 0;
+	int arg = args[i] == ' ' ? strtol(args + i + 1, 0, 10) : 0;
+
+	enum factory_stage stage = factory_stage_from_name(name);
+	if (stage == FACTORY_STAGE_NONE) {
+		usb_putstr("Unknown factory stage!\r\n");
+		return;
+	}
+
+	// (this blocks the console until the main loop has run it)
+	char buf[FACTORY_RESULT_MAX];
+	factory_run(stage, arg, buf, sizeof(buf));
+	usb_putstr(buf);
+	usb_putstr("\r\n");
+}
+
+static void run_command(const uint8_t *line_buf, uint32_t linelen) {
+	if (!strcmp(line_buf, "debug console echo off")) {
+		echo_is_on = 0;
+		usb_putstr("Echo is now off\r\n");
+	} else if (!strcmp(line_buf, "debug console echo on")) {
+		echo_is_on = 1;
+		usb_putstr("Echo is now on\r\n");
+	} else if (!strcmp(line_buf, "help")) {
+		usb_putstr("Uhh, we didn't really finish this, sorry...\r\n");
+		usb_putstr("\tdebug console echo [on|off] -- turn echo on/off\r\n");
+		usb_putstr("\tdebug sound [on|off] -- turn sound raw data dump on/off\r\n");
+		usb_putstr("\tdebug sound adpcm -- dump sound as ADPCM instead (decode with adpcm.py)\r\n");
+		usb_putstr("\tdebug sound stats -- show ADPCM encoding cost since last time\r\n");
+		usb_putstr("\tdebug fft [on|off] -- turn fft raw data dump on/off\r\n");
+		usb_putstr("\tdebug bands [on|off] -- turn the compact band data stream on/off (decode with bands.py)\r\n");
+		usb_putstr("\tdebug nfc set <msg> -- set the NFC NDEF message\r\n");
+		usb_putstr("\tdebug leds count <n> -- set the total number of LEDs, including chained strips\r\n");
+		usb_putstr("\tdebug leds dither [on|off] -- turn dithered LED rendering on/off\r\n");
+		usb_putstr("\tdebug leds stats -- show LED frame rate and cost since last time\r\n");
+		usb_putstr("\tdebug radio stats -- show advert rates and duty cycle since last time\r\n");
+		usb_putstr("\tdebug usb stats -- show bytes sent and dropped since last time\r\n");
+		usb_putstr("\tdebug radio level [auto|sprint|normal|idle] -- pin the scan/advertising duty cycle\r\n");
+		usb_putstr("\tdebug radio dupfilter [on|off] -- turn the controller's duplicate advert filtering on/off\r\n");
+		usb_putstr("\tdebug radio sync -- show who the animation clock follows and how closely since last time\r\n");
+		usb_putstr("\tdebug gatt [on|off] -- advertise the GATT telemetry service until reboot (see gatt_stream.py)\r\n");
+		usb_putstr("\tbadges met -- show how many different badges this one has seen\r\n");
+		usb_putstr("\tbadges met reset -- forget all of them\r\n");
+		usb_putstr("\tlog dump -- send the encounter log in binary (decode with enclog.py)\r\n");
+		usb_putstr("\tdebug set factory -- go into factory test mode\r\n");
+		usb_putstr("\tdebug set no_factory -- go out of factory test mode\r\n");
+		usb_putstr("\tfactory run <leds|eyes|buttons|mic|complete> [timeout ms] -- run a factory test stage (see factory_jig.py)\r\n");
+		usb_putstr("\tfactory status -- show which factory test stages have passed\r\n");
+		usb_putstr("\t<0 byte> -- switch to the binary protocol (see badge_rpc.py)\r\n");
+		// don't show this one
+		// usb_putstr("\tdebug __unlock_patterns <hex> -- override unlocked blinky patterns\r\n");
+	} else if (!strcmp(line_buf, "debug sound on")) {
+		sound_enable_debug(SOUND_DEBUG_RAW);
+	} else if (!strcmp(line_buf, "debug sound adpcm")) {
+		sound_enable_debug(SOUND_DEBUG_ADPCM);
+	} else if (!strcmp(line_buf, "debug sound off")) {
+		sound_enable_debug(SOUND_DEBUG_OFF);
+	} else if (!strcmp(line_buf, "debug sound stats")) {
+		print_sound_stats();
+	} else if (!strcmp(line_buf, "debug fft on")) {
+		sound_enable_fft_debug(1);
+	} else if (!strcmp(line_buf, "debug fft off")) {
+		sound_enable_fft_debug(0);
+	} else if (!strcmp(line_buf, "debug bands on")) {
+		sound_enable_bands_debug(1);
+	} else if (!strcmp(line_buf, "debug bands off")) {
+		sound_enable_bands_debug(0);
+	} else if (!strncmp(line_buf, "debug nfc set ", strlen("debug nfc set "))) {
+		badge_nfc_set_msg_raw(line_buf + strlen("debug nfc set "), linelen - strlen("debug nfc set "));
+	} else if (!strncmp(line_buf, "debug leds count ", strlen("debug leds count "))) {
+		int num_leds = strtol(line_buf + strlen("debug leds count "), 0, 10);
+		set_num_leds(num_leds);
+		nvs_set_num_leds(get_num_leds());
+	} else if (!strcmp(line_buf, "debug leds dither on")) {
+		set_led_dither(1);
+	} else if (!strcmp(line_buf, "debug leds dither off")) {
+		set_led_dither(0);
+	} else if (!strcmp(line_buf, "debug leds stats")) {
+		print_led_stats();
+	} else if (!strcmp(line_buf, "debug usb stats")) {
+		print_usb_stats();
+	} else if (!strcmp(line_buf, "debug radio stats")) {
+		print_radio_stats();
+	} else if (!strcmp(line_buf, "debug radio dupfilter on")) {
+		set_scan_dup_filter(1);
+	} else if (!strcmp(line_buf, "debug radio dupfilter off")) {
+		set_scan_dup_filter(0);
+	} else if (!strcmp(line_buf, "debug gatt on")) {
+		int err = gatt_set_enabled(1);
+		if (err == -ENOTSUP)
+			usb_putstr("Built without the GATT service (see overlay-gatt.conf)\r\n");
+		else if (err)
+			usb_putstr("Bluetooth isn't up yet\r\n");
+	} else if (!strcmp(line_buf, "debug gatt off")) {
+		gatt_set_enabled(0);
+	} else if (!strcmp(line_buf, "debug radio sync")) {
+		print_sync_stats();
+	} else if (!strcmp(line_buf, "badges met")) {
+		print_badges_met();
+	} else if (!strcmp(line_buf, "badges met reset")) {
+		reset_badges_met();
+	} else if (!strcmp(line_buf, "log dump")) {
+		dump_enclog();
+	} else if (!strcmp(line_buf, "debug radio level auto")) {
+		set_radio_level(-1);
+	} else if (!strcmp(line_buf, "debug radio level sprint")) {
+		set_radio_level(RADIO_LEVEL_SPRINT);
+	} else if (!strcmp(line_buf, "debug radio level normal")) {
+		set_radio_level(RADIO_LEVEL_NORMAL);
+	} else if (!strcmp(line_buf, "debug radio level idle")) {
+		set_radio_level(RADIO_LEVEL_IDLE);
+	} else if (!strcmp(line_buf, "debug set factory")) {
+		nvs_set_factory(factory_before_sw1);
+		factory_reset();
+	} else if (!strcmp(line_buf, "debug set no_factory")) {
+		nvs_set_factory(factory_completed);
+	} else if (!strncmp(line_buf, "factory run ", strlen("factory run "))) {
+		run_factory_stage(line_buf + strlen("factory run "));
+	} else if (!strcmp(line_buf, "factory status")) {
+		char buf[FACTORY_RESULT_MAX];
+		factory_status(buf, sizeof(buf));
+		usb_putstr(buf);
+		usb_putstr("\r\n");
+	} else if (!strncmp(line_buf, "debug __unlock_patterns ", strlen("debug __unlock_patterns "))) {
+		uint32_t patterns = strtol(line_buf + strlen("debug __unlock_patterns "), 0, 16);
+		nvs_set_unlocked_blinky_patterns(patterns);
+	} else {
+		usb_putstr("Unrecognized command!\r\n");
+	}
+}
+
+static int rpc_get_peers() {
+	int peers, imposters, badge_makers;
+	get_peer_infos(&peers, &imposters, &badge_makers);
+	return peers;
+}
+
+static int rpc_get_factory() {
+	return nvs_get_factory();
+}
+
+static int rpc_get_unlocked_patterns() {
+	return nvs_get_unlocked_blinky_patterns();
+}
+
+static int rpc_get_anim_clock() {
+	return get_anim_clock_ms();
+}
+
+static int rpc_get_adverts() {
+	struct radio_counters counters;
+	get_radio_counters(&counters);
+	return counters.adverts;
+}
+
+static int rpc_get_badge_adverts() {
+	struct radio_counters counters;
+	get_radio_counters(&counters);
+	return counters.badge_adverts;
+}
+
+static int rpc_get_ring_overflows() {
+	struct radio_counters counters;
+	get_radio_counters(&counters);
+	return counters.ring_overflows;
+}
+
+static int rpc_set_num_leds(int value) {
+	if (value < NLEDS || value > NLEDS_MAX)
+		return RPC_ERR_VALUE;
+	set_num_leds(value);
+	nvs_set_num_leds(get_num_leds());
+	return RPC_OK;
+}
+
+static int rpc_set_radio_level(int value) {
+	if (value < -1 || value >= RADIO_NUM_LEVELS)
+		return RPC_ERR_VALUE;
+	set_radio_level(value);
+	return RPC_OK;
+}
+
+static int rpc_set_dup_filter(int value) {
+	set_scan_dup_filter(!!value);
+	return RPC_OK;
+}
+
+static int rpc_set_factory(int value) {
+	if (value < factory_before_sw1 || value > factory_completed)
+		return RPC_ERR_VALUE;
+	nvs_set_factory(value);
+	return RPC_OK;
+}
+
+static int rpc_set_unlocked_patterns(int value) {
+	nvs_set_unlocked_blinky_patterns(value);
+	return RPC_OK;
+}
+
+static int rpc_set_sound_stream(int value) {
+	if (value < SOUND_DEBUG_OFF || value > SOUND_DEBUG_ADPCM)
+		return RPC_ERR_VALUE;
+	sound_enable_debug(value);
+	return RPC_OK;
+}
+
+static int rpc_set_fft_stream(int value) {
+	sound_enable_fft_debug(!!value);
+	return RPC_OK;
+}
+
+static int rpc_set_bands_stream(int value) {
+	sound_enable_bands_debug(!!value);
+	return RPC_OK;
+}
+
+enum rpc_param {
+	RPC_PARAM_NUM_LEDS = 1,
+	RPC_PARAM_RADIO_LEVEL,
+	RPC_PARAM_DUP_FILTER,
+	RPC_PARAM_FACTORY,
+	RPC_PARAM_UNLOCKED_PATTERNS,
+	RPC_PARAM_SOUND_STREAM,
+	RPC_PARAM_FFT_STREAM,
+	RPC_PARAM_BADGES_MET,
+	RPC_PARAM_CROWD_SIZE,
+	RPC_PARAM_PEERS,
+	RPC_PARAM_SOUND_LEVEL,
+	RPC_PARAM_ANIM_CLOCK,
+	RPC_PARAM_BANDS_STREAM,
+	RPC_PARAM_ADVERTS,
+	RPC_PARAM_BADGE_ADVERTS,
+	RPC_PARAM_RING_OVERFLOWS,
+	RPC_NUM_PARAMS,
+};
+
+// NULL if it can't be read or written
+static const struct {
+	int (*get)();
+	int (*set)(int value);
+} rpc_params[RPC_NUM_PARAMS] = {
+	[RPC_PARAM_NUM_LEDS] = { get_num_leds, rpc_set_num_leds },
+	[RPC_PARAM_RADIO_LEVEL] = { get_radio_level, rpc_set_radio_level },
+	[RPC_PARAM_DUP_FILTER] = { get_scan_dup_filter, rpc_set_dup_filter },
+	[RPC_PARAM_FACTORY] = { rpc_get_factory, rpc_set_factory },
+	[RPC_PARAM_UNLOCKED_PATTERNS] = { rpc_get_unlocked_patterns, rpc_set_unlocked_patterns },
+	[RPC_PARAM_SOUND_STREAM] = { NULL, rpc_set_sound_stream },
+	[RPC_PARAM_FFT_STREAM] = { NULL, rpc_set_fft_stream },
+	[RPC_PARAM_BADGES_MET] = { get_badges_met, NULL },
+	[RPC_PARAM_CROWD_SIZE] = { get_crowd_size, NULL },
+	[RPC_PARAM_PEERS] = { rpc_get_peers, NULL },
+	[RPC_PARAM_SOUND_LEVEL] = { sound_get_level, NULL },
+	[RPC_PARAM_ANIM_CLOCK] = { rpc_get_anim_clock, NULL },
+	[RPC_PARAM_BANDS_STREAM] = { NULL, rpc_set_bands_stream },
+	[RPC_PARAM_ADVERTS] = { rpc_get_adverts, NULL },
+	[RPC_PARAM_BADGE_ADVERTS] = { rpc_get_badge_adverts, NULL },
+	[RPC_PARAM_RING_OVERFLOWS] = { rpc_get_ring_overflows, NULL },
+};
+
+static void rpc_reply(uint8_t seq, int8_t status, const uint8_t *data, uint32_t len) {
+	rpc_send(RPC_REPLY, seq, (const uint8_t *)&status, 1, data, len);
+}
+
+static void rpc_handle(uint8_t type, uint8_t seq, const uint8_t *payload, uint32_t len) {
+	switch (type) {
+		case RPC_PING:
+			rpc_reply(seq, RPC_OK, payload, len);
+			break;
+
+		case RPC_COMMAND: {
+			uint8_t line_buf[81];
+			if (len >= sizeof(line_buf)) {
+				rpc_reply(seq, RPC_ERR_LENGTH, NULL, 0);
+				break;
+			}
+			memcpy(line_buf, payload, len);
+			line_buf[len] = 0;
+			rpc_text_seq = seq;
+			run_command(line_buf, len);
+			rpc_reply(seq, RPC_OK, NULL, 0);
+			break;
+		}
+
+		case RPC_GET:
+		case RPC_SET: {
+			if (len != (type == RPC_GET ? 2 : 6)) {
+				rpc_reply(seq, RPC_ERR_LENGTH, NULL, 0);
+				break;
+			}
+			uint16_t id = sys_get_le16(payload);
+			if (id == 0 || id >= RPC_NUM_PARAMS) {
+				rpc_reply(seq, RPC_ERR_PARAM, NULL, 0);
+			} else if (type == RPC_GET) {
+				if (!rpc_params[id].get) {
+					rpc_reply(seq, RPC_ERR_WRITE_ONLY, NULL, 0);
+					break;
+				}
+				uint8_t value[4];
+				sys_put_le32(rpc_params[id].get(), value);
+				rpc_reply(seq, RPC_OK, value, sizeof(value));
+			} else {
+				if (!rpc_params[id].set) {
+					rpc_reply(seq, RPC_ERR_READ_ONLY, NULL, 0);
+					break;
+				}
+				rpc_reply(seq, rpc_params[id].set(sys_get_le32(payload + 2)), NULL, 0);
+			}
+			break;
+		}
+
+		case RPC_EXIT:
+			rpc_reply(seq, RPC_OK, NULL, 0);
+			atomic_set(&rpc_mode, 0);
+			break;
+
+		default:
+			rpc_reply(seq, RPC_ERR_UNKNOWN, NULL, 0);
+			break;
+	}
+}
+
+static void rpc_loop() {
+	static struct rpc_decoder decoder;
+	rpc_decoder_init(&decoder);
+
+	while (atomic_get(&rpc_mode)) {
+		// (starting with whatever came in after the 0)
+		if (rpc_decode_byte(&decoder, rx_next()))
+			rpc_handle(decoder.buf[0], decoder.buf[1], decoder.buf + 2, decoder.len - 4);
+	}
+	printk("binary protocol off, %u bad frames\n", decoder.bad_frames);
 }
 
 static void usb_rxthread(void *_0, void *_1, void *_2) {
 	uint8_t line_buf[81];
 	while (1) {
-		uint32_t linelen = rx_getline(line_buf, sizeof(line_buf));
-		line_buf[linelen] = 0;
-
-		printk("got command line '%s'\n", line_buf);
-
-		if (linelen > 0) {
-			if (!strcmp(line_buf, "debug console echo off")) {
-				echo_is_on = 0;
-				usb_putstr("Echo is now off\r\n");
-			} else if (!strcmp(line_buf, "debug console echo on")) {
-				echo_is_on = 1;
-				usb_putstr("Echo is now on\r\n");
-			} else if (!strcmp(line_buf, "help")) {
-				usb_putstr("Uhh, we didn't really finish this, sorry...\r\n");
-				usb_putstr("\tdebug console echo [on|off] -- turn echo on/off\r\n");
-				usb_putstr("\tdebug sound [on|off] -- turn sound raw data dump on/off\r\n");
-				usb_putstr("\tdebug fft [on|off] -- turn fft raw data dump on/off\r\n");
-				usb_putstr("\tdebug nfc set <msg> -- set the NFC NDEF message\r\n");
-				usb_putstr("\tdebug set factory -- go into factory test mode\r\n");
-				usb_putstr("\tdebug set no_factory -- go out of factory test mode\r\n");
-				// don't show this one
-				// usb_putstr("\tdebug __unlock_patterns <hex> -- override unlocked blinky patterns\r\n");
-			} else if (!strcmp(line_buf, "debug sound on")) {
-				sound_enable_debug(1);
-			} else if (!strcmp(line_buf, "debug sound off")) {
-				sound_enable_debug(0);
-			} else if (!strcmp(line_buf, "debug fft on")) {
-				sound_enable_fft_debug(1);
-			} else if (!strcmp(line_buf, "debug fft off")) {
-				sound_enable_fft_debug(0);
-			} else if (!strncmp(line_buf, "debug nfc set ", strlen("debug nfc set "))) {
-				badge_nfc_set_msg_raw(line_buf + strlen("debug nfc set "), linelen - strlen("debug nfc set "));
-			} else if (!strcmp(line_buf, "debug set factory")) {
-				nvs_set_factory(factory_before_sw1);
-			} else if (!strcmp(line_buf, "debug set no_factory")) {
-				nvs_set_factory(factory_completed);
-			} else if (!strncmp(line_buf, "debug __unlock_patterns ", strlen("debug __unlock_patterns "))) {
-				uint32_t patterns = strtol(line_buf + strlen("debug __unlock_patterns "), 0, 16);
-				nvs_set_unlocked_blinky_patterns(patterns);
-			} else {
-				usb_putstr("Unrecognized command!\r\n");
-			}
+		// (room for the terminating 0)
+		uint32_t linelen = rx_getline(line_buf, sizeof(line_buf) - 1);
+		if (linelen == LINE_RPC) {
+			printk("binary protocol on\n");
+			atomic_set(&rpc_mode, 1);
+			rpc_loop();
+		} else {
+			line_buf[linelen] = 0;
+
+			printk("got command line '%s'\n", line_buf);
+
+			if (linelen > 0)
+				run_command(line_buf, linelen);
 		}
 		usb_putstr("\x1b[31mP\x1b[33ma\x1b[32mr\x1b[36ma\x1b[34mn\x1b[35mo\x1b[37mi\x1b[0md!> ");
 	}
@@ -327,11 +949,75 @@ int badge_usb_setup() {
 	return 0;
 }
 
+// The sound blocks are dropped rather than holding up the main loop, the others
+// don't fit in the ring or must not be cut short
+static const enum usb_tx_policy stream_policy[USB_NUM_STREAMS] = {
+	[USB_STREAM_SOUND] = USB_TX_DROP,
+	[USB_STREAM_FFT] = USB_TX_WAIT,
+	[USB_STREAM_ENCLOG] = USB_TX_WAIT,
+	[USB_STREAM_ADPCM] = USB_TX_DROP,
+	[USB_STREAM_BANDS] = USB_TX_DROP,
+};
+
+void badge_usb_stream(enum usb_stream stream, const uint8_t *data, uint32_t len) {
+	if (atomic_get(&rpc_mode)) {
+		uint8_t hdr = stream;
+		// (a dropped frame still uses up its sequence number, so the host sees it's missing)
+		rpc_send_policy(RPC_STREAM, rpc_stream_seq[stream]++, &hdr, 1, data, len, stream_policy[stream]);
+	} else {
+		badge_usb_send(data, len, stream_policy[stream]);
+	}
+}
+
+int badge_usb_stream_lend(enum usb_stream stream, const void *data, uint32_t len,
+	void (*done)(const void *data)) {
+	if (!atomic_get(&rpc_mode))
+		return badge_usb_lend(data, len, done);
+	// framing needs a copy anyway
+	badge_usb_stream(stream, data, len);
+	done(data);
+	return 0;
+}
+
+uint32_t badge_usb_send(const uint8_t *data, uint32_t sz, enum usb_tx_policy policy) {
+	k_mutex_lock(&usb_tx_lock, K_FOREVER);
+	uint32_t queued = tx_put(data, sz, policy);
+	k_mutex_unlock(&usb_tx_lock);
+	return queued;
+}
+
 void badge_usb_write(const uint8_t *data, uint32_t sz) {
-	while (sz) {
-		uint32_t xferred = ring_buf_put(&usb_txring, data, sz);
-		sz -= xferred;
-		data += xferred;
+	badge_usb_send(data, sz, USB_TX_WAIT);
+}
+
+int badge_usb_lend(const void *data, uint32_t sz, void (*done)(const void *data)) {
+	int ret = 0;
+	k_mutex_lock(&usb_tx_lock, K_FOREVER);
+	uint32_t tail = atomic_get(&tx_lend_tail);
+	if (tail - atomic_get(&tx_lend_head) == USB_TX_LEND_MAX) {
+		atomic_add(&tx_stats.dropped_bytes, sz);
+		atomic_inc(&tx_stats.dropped_writes);
+		ret = -EBUSY;
+	} else {
+		struct usb_lend *lend = &tx_lends[tail % USB_TX_LEND_MAX];
+		lend->data = data;
+		lend->len = sz;
+		lend->sent = 0;
+		lend->ring_mark = tx_ring_put_total;
+		lend->done = done;
+		atomic_set(&tx_lend_tail, tail + 1);
+		atomic_add(&tx_stats.bytes, sz);
+		atomic_inc(&tx_stats.lent);
 		uart_irq_tx_enable(cdcacm_dev);
 	}
+	k_mutex_unlock(&usb_tx_lock);
+	return ret;
+}
+
+void get_usb_tx_stats(struct usb_tx_stats *stats) {
+	stats->bytes = atomic_clear(&tx_stats.bytes);
+	stats->dropped_bytes = atomic_clear(&tx_stats.dropped_bytes);
+	stats->dropped_writes = atomic_clear(&tx_stats.dropped_writes);
+	stats->lent = atomic_clear(&tx_stats.lent);
+	stats->stalls = atomic_clear(&tx_stats.stalls);
 }
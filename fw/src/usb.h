@@ -6,4 +6,44 @@
 #include <stdint.h>
 
 int badge_usb_setup();
+
+enum usb_tx_policy {
+	// waits for room as long as the host keeps reading, after USB_TX_STALL_MS
+	// without it drops the rest, and doesn't wait at all until it reads again
+	USB_TX_WAIT,
+	// never waits, queues all of it or (if it doesn't fit) none of it
+	USB_TX_DROP,
+};
+// Returns how much was queued, the rest is counted as dropped
+uint32_t badge_usb_send(const uint8_t *data, uint32_t sz, enum usb_tx_policy policy);
+// USB_TX_WAIT, for console output
 void badge_usb_write(const uint8_t *data, uint32_t sz);
+// Sends the buffer itself without copying it, after whatever was written before.
+// done(data) is called from the interrupt handler once it's sent. Returns -EBUSY
+// if too many are lent already, then it's counted as dropped and still the caller's
+int badge_usb_lend(const void *data, uint32_t sz, void (*done)(const void *data));
+
+struct usb_tx_stats {
+	uint32_t bytes;
+	uint32_t dropped_bytes;
+	uint32_t dropped_writes;
+	uint32_t lent;
+	// USB_TX_WAIT writes that gave up
+	uint32_t stalls;
+};
+// Counts since the last call
+void get_usb_tx_stats(struct usb_tx_stats *stats);
+
+enum usb_stream {
+	USB_STREAM_SOUND = 1,
+	USB_STREAM_FFT = 2,
+	USB_STREAM_ENCLOG = 3,
+	USB_STREAM_ADPCM = 4,
+	USB_STREAM_BANDS = 5,
+	USB_NUM_STREAMS,
+};
+// Raw on the text console, as tagged stream messages in binary mode (see usb.c)
+void badge_usb_stream(enum usb_stream stream, const uint8_t *data, uint32_t len);
+// Same with badge_usb_lend() on the text console (done is called right away in binary mode)
+int badge_usb_stream_lend(enum usb_stream stream, const void *data, uint32_t len,
+	void (*done)(const void *data));
@@ -0,0 +1,18 @@
+#!/usr/bin/env bash
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Builds the images run.sh runs, with ZEPHYR_BASE, BSIM_OUT_PATH and
+# BSIM_COMPONENTS_PATH set up as for Zephyr's own BabbleSim tests
+set -ue
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be defined}"
+here=$(cd "$(dirname "$0")" && pwd)
+
+# <name> [overlay]
+build() {
+	west build -p always -b nrf52_bsim -d "${here}/build_$1" "${here}" -- ${2:+-DOVERLAY_CONFIG=${here}/$2}
+	cp "${here}/build_$1/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_bsim_badge_$1"
+}
+
+build gatt
+build gatt_small_mtu small_mtu.conf
@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Runs the badge's GATT service (src/gatt.c) against a client in BabbleSim, twice:
+#  a client that takes the full MTU gets every record type
+#  one that stays at the default MTU of 23 still gets the peers records
+#  (the bands records can never fit there, and used to stop the stream)
+# Both check that the service isn't advertised before it's turned on.
+# Build with compile.sh first
+set -u
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be defined}"
+cd "${BSIM_OUT_PATH}/bin"
+exit_code=0
+
+# <simulation id> <client image>
+simulate() {
+	local pids=""
+	./bs_nrf52_bsim_badge_gatt -v=2 -s=$1 -d=0 -testid=badge & pids="$pids $!"
+	./$2 -v=2 -s=$1 -d=1 -testid=client & pids="$pids $!"
+	./bs_2G4_phy_v1 -v=2 -s=$1 -D=2 -sim_length=60e6 & pids="$pids $!"
+	for pid in $pids; do
+		wait $pid || exit_code=$?
+	done
+}
+
+simulate badge_gatt bs_nrf52_bsim_badge_gatt
+simulate badge_gatt_small_mtu bs_nrf52_bsim_badge_gatt_small_mtu
+exit $exit_code
@@ -0,0 +1,86 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// The badge side: gatt.c as the firmware runs it, with the rest of the badge
+// it reads from stubbed out below
+
+#include <bluetooth/conn.h>
+
+#include "common.h"
+#include "gatt.h"
+#include "radio.h"
+
+void get_peer_infos(int *num_peers, int *num_imposters, int *num_badge_makers) {
+	*num_peers = TEST_PEERS;
+	*num_imposters = 0;
+	*num_badge_makers = 1;
+}
+
+int get_crowd_size() {
+	return TEST_CROWD_SIZE;
+}
+
+int get_badges_met() {
+	return 7;
+}
+
+void get_radio_counters(struct radio_counters *counters) {
+	counters->adverts = k_uptime_get_32() / 10;
+	counters->badge_adverts = k_uptime_get_32() / 100;
+	counters->ring_overflows = 0;
+}
+
+static atomic_t client_was_here;
+
+// (the client runs the same image, where the service is never turned on)
+static void connected(struct bt_conn *conn, uint8_t err) {
+	if (!err && gatt_get_enabled())
+		atomic_set(&client_was_here, 1);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason) {
+	if (atomic_get(&client_was_here))
+		PASS("badge: the client came and went (reason %u)\n", reason);
+}
+
+BT_CONN_CB_DEFINE(test_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+static void test_badge_main() {
+	int err = bt_enable(NULL);
+	if (err)
+		FAIL("Bluetooth init failed (err %d)\n", err);
+	if ((err = gatt_start()))
+		FAIL("gatt_start failed (err %d)\n", err);
+
+	// off after boot (the client checks nothing is advertised yet)
+	k_sleep(K_MSEC(BADGE_ENABLE_MS));
+	if ((err = gatt_set_enabled(1)))
+		FAIL("gatt_set_enabled failed (err %d)\n", err);
+
+	// like process_sound(), once per sound block
+	float bands[TEST_NUM_BANDS];
+	for (int i = 0; i < TEST_NUM_BANDS; i++)
+		bands[i] = i;
+	for (;;) {
+		gatt_send_bands(128, bands, TEST_NUM_BANDS);
+		k_sleep(K_MSEC(64));
+	}
+}
+
+static const struct bst_test_instance test_badge[] = {
+	{
+		.test_id = "badge",
+		.test_descr = "The badge, turns the service on after a while and streams bands",
+		.test_post_init_f = test_init,
+		.test_tick_f = test_tick,
+		.test_main_f = test_badge_main,
+	},
+	BSTEST_END_MARKER
+};
+
+struct bst_test_list *test_badge_install(struct bst_test_list *tests) {
+	return bst_add_tests(tests, test_badge);
+}
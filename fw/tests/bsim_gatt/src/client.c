@@ -0,0 +1,203 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// The client side, like gatt_stream.py: finds the service, subscribes and checks
+// the records that come in. Built with small_mtu.conf it stays at the default MTU,
+// where bands and counters records can't fit but peers records must keep coming
+
+#include <string.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/gatt.h>
+#include <sys/byteorder.h>
+
+#include "common.h"
+#include "gatt.h"
+
+static struct bt_uuid_128 service_uuid = BT_UUID_INIT_128(GATT_UUID_BASE(1));
+static struct bt_uuid_128 stream_uuid = BT_UUID_INIT_128(GATT_UUID_BASE(2));
+
+static struct bt_conn *client_conn;
+static atomic_t connected_flag;
+static atomic_t discovered_flag;
+static atomic_t disconnected_flag;
+
+// records of each type seen
+static atomic_t num_bands;
+static atomic_t num_peers;
+static atomic_t num_counters;
+
+static void wait_for(atomic_t *flag) {
+	while (!atomic_get(flag))
+		k_sleep(K_MSEC(1));
+}
+
+static bool has_service(struct bt_data *data, void *user_data) {
+	int *found = user_data;
+	if (data->type == BT_DATA_UUID128_ALL && data->data_len == 16 &&
+		!memcmp(data->data, service_uuid.val, 16)) {
+		*found = 1;
+		return false;
+	}
+	return true;
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad) {
+	int found = 0;
+	bt_data_parse(ad, has_service, &found);
+	if (!found || client_conn)
+		return;
+	if (k_uptime_get() < BADGE_ENABLE_MS)
+		FAIL("client: the service was advertised before it was turned on\n");
+
+	int err = bt_le_scan_stop();
+	if (err)
+		FAIL("client: stopping the scan failed (err %d)\n", err);
+	err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &client_conn);
+	if (err)
+		FAIL("client: connecting failed (err %d)\n", err);
+}
+
+static void connected(struct bt_conn *conn, uint8_t err) {
+	if (conn != client_conn)
+		return;
+	if (err)
+		FAIL("client: connection failed (err %u)\n", err);
+	atomic_set(&connected_flag, 1);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason) {
+	if (conn != client_conn)
+		return;
+	if (!atomic_get(&discovered_flag) || !atomic_get(&disconnected_flag))
+		FAIL("client: the badge dropped the connection (reason %u)\n", reason);
+}
+
+BT_CONN_CB_DEFINE(test_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+static struct bt_gatt_discover_params discover_params;
+static struct bt_gatt_subscribe_params subscribe_params;
+
+static uint8_t discover_func(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+	struct bt_gatt_discover_params *params) {
+	if (!attr) {
+		if (!subscribe_params.value_handle)
+			FAIL("client: no stream characteristic\n");
+		return BT_GATT_ITER_STOP;
+	}
+	const struct bt_gatt_chrc *chrc = attr->user_data;
+	if (!bt_uuid_cmp(chrc->uuid, &stream_uuid.uuid)) {
+		subscribe_params.value_handle = chrc->value_handle;
+		// (its CCC descriptor is right after it, see badge_svc in gatt.c)
+		subscribe_params.ccc_handle = chrc->value_handle + 1;
+		atomic_set(&discovered_flag, 1);
+		return BT_GATT_ITER_STOP;
+	}
+	return BT_GATT_ITER_CONTINUE;
+}
+
+// Every notification has to be whole records, each the length its type says
+static uint8_t notify_func(struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+	const void *data, uint16_t length) {
+	if (!data)
+		return BT_GATT_ITER_STOP;
+
+	const uint8_t *p = data;
+	uint16_t off = 0;
+	while (off < length) {
+		if (length - off < 2 || length - off < 2 + p[off + 1])
+			FAIL("client: record split across notifications (%u of %u)\n", off, length);
+		uint8_t type = p[off];
+		uint8_t len = p[off + 1];
+		const uint8_t *rec = &p[off + 2 + 4];
+		switch (type) {
+		case GATT_STREAM_BANDS:
+			if (len != 4 + 1 + 2 * TEST_NUM_BANDS)
+				FAIL("client: bands record of %u bytes\n", len);
+			// bands[1] is 1, log2(2) in 8.8
+			if (rec[0] != 128 || sys_get_le16(&rec[3]) != 256)
+				FAIL("client: bands record has the wrong values\n");
+			atomic_inc(&num_bands);
+			break;
+		case GATT_STREAM_PEERS:
+			if (len != 4 + 10)
+				FAIL("client: peers record of %u bytes\n", len);
+			if (sys_get_le16(&rec[0]) != TEST_PEERS || sys_get_le16(&rec[6]) != TEST_CROWD_SIZE)
+				FAIL("client: peers record has the wrong values\n");
+			atomic_inc(&num_peers);
+			break;
+		case GATT_STREAM_COUNTERS:
+			if (len != 4 + 20)
+				FAIL("client: counters record of %u bytes\n", len);
+			atomic_inc(&num_counters);
+			break;
+		default:
+			FAIL("client: record of unknown type %u\n", type);
+		}
+		off += 2 + len;
+	}
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static void test_client_main() {
+	int err = bt_enable(NULL);
+	if (err)
+		FAIL("client: Bluetooth init failed (err %d)\n", err);
+	if ((err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found)))
+		FAIL("client: scanning failed (err %d)\n", err);
+	wait_for(&connected_flag);
+
+	discover_params.uuid = NULL;
+	discover_params.func = discover_func;
+	discover_params.start_handle = 0x0001;
+	discover_params.end_handle = 0xffff;
+	discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+	if ((err = bt_gatt_discover(client_conn, &discover_params)))
+		FAIL("client: discovery failed (err %d)\n", err);
+	wait_for(&discovered_flag);
+
+	subscribe_params.notify = notify_func;
+	subscribe_params.value = BT_GATT_CCC_NOTIFY;
+	if ((err = bt_gatt_subscribe(client_conn, &subscribe_params)))
+		FAIL("client: subscribing failed (err %d)\n", err);
+
+	k_sleep(K_SECONDS(STREAM_SECONDS));
+	int mtu = bt_gatt_get_mtu(client_conn);
+	int bands = atomic_get(&num_bands), peers = atomic_get(&num_peers), counters = atomic_get(&num_counters);
+	bs_trace_info_time(1, "client: MTU %d, %d bands, %d peers, %d counters records\n", mtu, bands, peers, counters);
+
+	// (one of each per second, bands every 64 ms, leaving some for the start)
+	if (peers < STREAM_SECONDS - 1)
+		FAIL("client: only %d peers records\n", peers);
+	if (mtu >= 3 + 2 + 4 + 1 + 2 * TEST_NUM_BANDS) {
+		if (bands < STREAM_SECONDS * 1000 / 64 * 9 / 10)
+			FAIL("client: only %d bands records\n", bands);
+		if (counters < STREAM_SECONDS - 1)
+			FAIL("client: only %d counters records\n", counters);
+	} else if (bands) {
+		FAIL("client: %d bands records at MTU %d\n", bands, mtu);
+	}
+
+	atomic_set(&disconnected_flag, 1);
+	if ((err = bt_conn_disconnect(client_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN)))
+		FAIL("client: disconnecting failed (err %d)\n", err);
+	PASS("client: passed\n");
+}
+
+static const struct bst_test_instance test_client[] = {
+	{
+		.test_id = "client",
+		.test_descr = "Subscribes to the badge's stream and checks the records",
+		.test_post_init_f = test_init,
+		.test_tick_f = test_tick,
+		.test_main_f = test_client_main,
+	},
+	BSTEST_END_MARKER
+};
+
+struct bst_test_list *test_client_install(struct bst_test_list *tests) {
+	return bst_add_tests(tests, test_client);
+}
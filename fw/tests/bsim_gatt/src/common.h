@@ -0,0 +1,44 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/uuid.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+
+extern enum bst_result_t bst_result;
+
+// in simulated time, each device fails if it hasn't passed by then
+#define TEST_TIMEOUT_US		(50 * 1000000)
+// the badge turns the service on this long after boot, the client fails if it
+// sees it advertised any earlier
+#define BADGE_ENABLE_MS		2000
+// how long the client listens to the stream
+#define STREAM_SECONDS		10
+// what the badge side sends (see badge.c)
+#define TEST_NUM_BANDS		21
+#define TEST_PEERS		3
+#define TEST_CROWD_SIZE		42
+
+// the same as in gatt.c
+#define GATT_UUID_BASE(n)	BT_UUID_128_ENCODE(0x9e5c0000 + (n), 0x5061, 0x7261, 0x6e6f, 0x696473626467)
+
+#define FAIL(...) \
+	do { \
+		bst_result = Failed; \
+		bs_trace_error_time_line(__VA_ARGS__); \
+	} while (0)
+
+#define PASS(...) \
+	do { \
+		bst_result = Passed; \
+		bs_trace_info_time(1, __VA_ARGS__); \
+	} while (0)
+
+void test_init();
+void test_tick(bs_time_t HW_device_time);
@@ -0,0 +1,12 @@
+#!/usr/bin/env bash
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Builds the image run.sh runs, with ZEPHYR_BASE, BSIM_OUT_PATH and
+# BSIM_COMPONENTS_PATH set up as for Zephyr's own BabbleSim tests
+set -ue
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be defined}"
+here=$(cd "$(dirname "$0")" && pwd)
+
+west build -p always -b nrf52_bsim -d "${here}/build" "${here}"
+cp "${here}/build/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_bsim_badge_radio"
@@ -0,0 +1,21 @@
+#!/usr/bin/env bash
+# Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+# See LICENSE file in project root for terms.
+
+# Brings the badge's radio up through badge_bt_setup() (src/radio.c) as main() does,
+# steps it through every duty cycle level, and checks from a second device that
+# it's heard at each one, always from the same random static address
+# Build with compile.sh first
+set -u
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be defined}"
+cd "${BSIM_OUT_PATH}/bin"
+exit_code=0
+
+pids=""
+./bs_nrf52_bsim_badge_radio -v=2 -s=badge_radio -d=0 -testid=badge & pids="$pids $!"
+./bs_nrf52_bsim_badge_radio -v=2 -s=badge_radio -d=1 -testid=scanner & pids="$pids $!"
+./bs_2G4_phy_v1 -v=2 -s=badge_radio -D=2 -sim_length=30e6 & pids="$pids $!"
+for pid in $pids; do
+	wait $pid || exit_code=$?
+done
+exit $exit_code
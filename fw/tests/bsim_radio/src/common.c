@@ -0,0 +1,16 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include "common.h"
+
+enum bst_result_t bst_result;
+
+void test_init() {
+	bst_ticker_set_next_tick_absolute(TEST_TIMEOUT_US);
+	bst_result = In_progress;
+}
+
+void test_tick(bs_time_t HW_device_time) {
+	if (bst_result != Passed)
+		FAIL("not passed after %d s\n", TEST_TIMEOUT_US / 1000000);
+}
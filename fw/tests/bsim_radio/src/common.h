@@ -0,0 +1,38 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#pragma once
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+
+extern enum bst_result_t bst_result;
+
+// in simulated time, each device fails if it hasn't passed by then
+#define TEST_TIMEOUT_US		(25 * 1000000)
+// the badge holds each radio level (enum radio_level, in order) this long from boot
+#define LEVEL_MS		5000
+// the scanner only counts adverts this long after each change, the badge changes
+// level a little after the boundary (Bluetooth has to come up first)
+#define LEVEL_MARGIN_MS		500
+// adverts the scanner has to hear at each level (idle advertises every 500-600 ms)
+#define LEVEL_MIN_ADVERTS	5
+
+#define FAIL(...) \
+	do { \
+		bst_result = Failed; \
+		bs_trace_error_time_line(__VA_ARGS__); \
+	} while (0)
+
+#define PASS(...) \
+	do { \
+		bst_result = Passed; \
+		bs_trace_info_time(1, __VA_ARGS__); \
+	} while (0)
+
+void test_init();
+void test_tick(bs_time_t HW_device_time);
@@ -0,0 +1,17 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+#include "bstests.h"
+
+struct bst_test_list *test_badge_install(struct bst_test_list *tests);
+struct bst_test_list *test_scanner_install(struct bst_test_list *tests);
+
+bst_test_install_t test_installers[] = {
+	test_badge_install,
+	test_scanner_install,
+	NULL
+};
+
+void main() {
+	bst_main();
+}
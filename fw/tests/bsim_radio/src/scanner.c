@@ -0,0 +1,73 @@
+// Copyright Yahoo, Licensed under the terms of the Apache-2.0 license.
+// See LICENSE file in project root for terms.
+
+// The other side: listens all the time, like a neighbor in sprint, and checks the
+// badge is heard at every level and never changes its address
+
+#include "common.h"
+#include "adv.h"
+#include "radio.h"
+
+static bt_addr_le_t badge_addr;
+static atomic_t have_addr;
+// badge adverts heard while it was at each level
+static atomic_t heard[RADIO_NUM_LEVELS];
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad) {
+	struct adv_gossip gossip;
+	if (adv_classify(ad->data, ad->len, &gossip) != PEER_TYPE_BADGE)
+		return;
+
+	if (!atomic_get(&have_addr)) {
+		bt_addr_le_copy(&badge_addr, addr);
+		atomic_set(&have_addr, 1);
+	} else if (bt_addr_le_cmp(addr, &badge_addr)) {
+		FAIL("scanner: the badge changed its address\n");
+	}
+
+	int64_t now = k_uptime_get();
+	int level = now / LEVEL_MS;
+	if (level < RADIO_NUM_LEVELS && now % LEVEL_MS >= LEVEL_MARGIN_MS)
+		atomic_inc(&heard[level]);
+}
+
+static void test_scanner_main() {
+	int err = bt_enable(NULL);
+	if (err)
+		FAIL("scanner: Bluetooth init failed (err %d)\n", err);
+	// every advert, not just the first from each address
+	err = bt_le_scan_start(BT_LE_SCAN_PARAM(BT_LE_SCAN_TYPE_PASSIVE, BT_LE_SCAN_OPT_NONE,
+		BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_INTERVAL), device_found);
+	if (err)
+		FAIL("scanner: scanning failed (err %d)\n", err);
+
+	k_sleep(K_MSEC(LEVEL_MS * RADIO_NUM_LEVELS));
+	bt_le_scan_stop();
+
+	if (!atomic_get(&have_addr))
+		FAIL("scanner: never heard the badge\n");
+	if (badge_addr.type != BT_ADDR_LE_RANDOM || !BT_ADDR_IS_STATIC(&badge_addr.a))
+		FAIL("scanner: the badge doesn't advertise from a random static address\n");
+	for (int level = 0; level < RADIO_NUM_LEVELS; level++) {
+		int n = atomic_get(&heard[level]);
+		bs_trace_info_time(1, "scanner: %d adverts at %s\n", n, get_radio_level_name(level));
+		if (n < LEVEL_MIN_ADVERTS)
+			FAIL("scanner: only %d adverts at %s\n", n, get_radio_level_name(level));
+	}
+	PASS("scanner: passed\n");
+}
+
+static const struct bst_test_instance test_scanner[] = {
+	{
+		.test_id = "scanner",
+		.test_descr = "Listens to the badge and checks its address stays the same at every level",
+		.test_post_init_f = test_init,
+		.test_tick_f = test_tick,
+		.test_main_f = test_scanner_main,
+	},
+	BSTEST_END_MARKER
+};
+
+struct bst_test_list *test_scanner_install(struct bst_test_list *tests) {
+	return bst_add_tests(tests, test_scanner);
+}